@@ -0,0 +1,123 @@
+#include "Batch.h"
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <stdint.h>
+
+#include "codegen-llvm/Generator.h"
+#include "runtime/runtime.h"
+
+#include "util.h"
+#include "error.h"
+
+using namespace llvm;
+using namespace std;
+
+static double msSince(chrono::steady_clock::time_point t0) {
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+// Compile a program and its dependencies (the ones that are not already there)
+void Batch::add(string pkg) {
+	Job job;
+	job.Name = pkg;
+	job.Entry = 0;
+	job.Kind = ret_void;
+	job.Failed = false;
+	job.IntResult = 0;
+	job.FloatResult = 0;
+	job.RunTime = 0;
+
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	try {
+		Package *p = Ctx->importProgram(pkg);
+		if (p == 0) throw new PIFError("Could not import '" + pkg + "'.");
+
+		Function *f = Gen->entry(p);
+		Type *retT = f->getReturnType();
+		if (retT->isIntegerTy()) job.Kind = ret_int;
+		if (retT->isFloatingPointTy()) job.Kind = ret_float;
+
+		job.Entry = Gen->ExecEng->getPointerToFunction(f);
+	} catch (PIFError *e) {
+		e->disp();
+		cerr << "Program '" << pkg << "' did not compile, it will be skipped." << endl;
+		job.Failed = true;
+	}
+	job.CompileTime = msSince(t0);
+
+	Jobs.push_back(job);
+}
+
+void Batch::runJob(Job &job) {
+	if (job.Failed) return;
+
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	if (job.Kind == ret_int) {
+		job.IntResult = ((INT (*)())(intptr_t)job.Entry)();
+	} else if (job.Kind == ret_float) {
+		job.FloatResult = ((FLOAT (*)())(intptr_t)job.Entry)();
+	} else {
+		((void (*)())(intptr_t)job.Entry)();
+	}
+	job.RunTime = msSince(t0);
+
+	pif_tls_release();
+}
+
+// Run all compiled programs. Nothing here may touch LLVM : everything
+// was JIT-compiled by add(), we only call into generated code.
+void Batch::run(unsigned threads) {
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+
+	if (threads <= 1) {
+		for (unsigned i = 0; i < Jobs.size(); i++) {
+			runJob(Jobs[i]);
+		}
+	} else {
+		atomic<unsigned> next(0);
+		vector<thread> workers;
+		for (unsigned i = 0; i < threads && i < Jobs.size(); i++) {
+			workers.push_back(thread([this, &next]() {
+				unsigned j;
+				while ((j = next++) < Jobs.size()) {
+					runJob(Jobs[j]);
+				}
+			}));
+		}
+		for (unsigned i = 0; i < workers.size(); i++) {
+			workers[i].join();
+		}
+	}
+
+	WallTime = msSince(t0);
+}
+
+void Batch::report(ostream &out) {
+	double compile = 0, run = 0;
+	unsigned failed = 0;
+
+	out << endl << "Batch results :" << endl;
+	out << fixed << setprecision(2);
+	for (unsigned i = 0; i < Jobs.size(); i++) {
+		Job &job = Jobs[i];
+		out << "  " << left << setw(24) << job.Name << right;
+		if (job.Failed) {
+			out << "  FAILED" << "  compile " << setw(9) << job.CompileTime << " ms" << endl;
+			failed++;
+			continue;
+		}
+		out << "  ok    ";
+		out << "  compile " << setw(9) << job.CompileTime << " ms";
+		out << "  run " << setw(9) << job.RunTime << " ms";
+		if (job.Kind == ret_int) out << "  -> " << job.IntResult;
+		if (job.Kind == ret_float) out << "  -> " << job.FloatResult;
+		out << endl;
+		compile += job.CompileTime;
+		run += job.RunTime;
+	}
+	out << "  " << Jobs.size() << " programs, " << failed << " failed ; total compile " << compile
+		<< " ms, total run " << run << " ms, wall " << WallTime << " ms" << endl;
+}
@@ -0,0 +1,48 @@
+#ifndef DEF_BATCH_H
+#define DEF_BATCH_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "config.h"
+
+class Generator;
+class Package;
+
+// Batch - compile several programs in the same module, so that the packages they
+// have in common are only compiled once, then run them all (possibly concurrently,
+// one program per thread, each with its own copy of the package globals).
+class Batch {
+	enum RetKind {
+		ret_void,
+		ret_int,
+		ret_float,
+	};
+
+	struct Job {
+		std::string Name;
+		void *Entry;
+		RetKind Kind;
+		bool Failed;
+		INT IntResult;
+		FLOAT FloatResult;
+		double CompileTime, RunTime;		// milliseconds
+	};
+
+	Generator *Gen;
+	Package *Ctx;
+	std::vector<Job> Jobs;
+	double WallTime;
+
+	void runJob(Job &job);
+
+	public:
+	Batch(Generator *gen, Package *ctx) : Gen(gen), Ctx(ctx), WallTime(0) {}
+
+	void add(std::string pkg);
+	void run(unsigned threads);
+	void report(std::ostream &out);
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "Package.h"
 
 #include <fstream>
+#include <sstream>
 
 #include "lexer/Lexer.h"
 #include "parser/Parser.h"
@@ -13,6 +14,8 @@ using namespace std;
 
 map<string, Package*> packages;
 
+#define MAX_INSTANCES 64		// of one generic function : types growing at each recursive call never end
+
 // Accessors
 
 Package *Package::getImport(string name) {
@@ -27,6 +30,8 @@ Package::Package(Generator *gen, string name) : Gen(gen), Ctx(this, gen) {
 	SymbolPrefix = "PIF_" + name + ".";
 	PkgType = new PackageTypeAST(this);
 	Complete = false;
+	ConstsBuilt = false;
+	FastMath = false;
 	InitFunction = 0;
 	Ctx.NamedValues.push_back(&Symbols);
 }
@@ -38,21 +43,24 @@ void Package::inputFile(string filename) {
 		DBGB(cout << " - parsing " << filename << endl)
 
 		Lexer lex(filename, file);
-		Parser parser(lex);
+		Parser parser(lex, Types);
 		while (1) {
 			if (lex.tok == tok_eof) {
 				break;
 			} else if (lex.tok == tok_import) {
 				ImportAST *i = parser.ParseImport();
 				import(i);
-			} else if (lex.tok == tok_let || lex.tok == tok_var || lex.tok == tok_func) {
-				DefAST *d;
-				if (lex.tok == tok_func) {
-					d = parser.ParseFuncDefinition();
-				} else {
-					d = parser.ParseVarDefinition();
+			} else if (lex.tok == tok_type) {
+				parser.ParseTypeDefinition();
+			} else if (lex.tok == tok_let || lex.tok == tok_var || lex.tok == tok_func ||
+					lex.tok == tok_const || lex.tok == tok_identifier) {
+				DefAST *d = parser.ParseDefinition();
+				if (d == 0) {		// 'fastmath package'
+					FastMath = true;
+					continue;
 				}
 				DBGP(cerr << "def: " << d->Name << endl)
+				if (GenericFuncDefAST *g = dynamic_cast<GenericFuncDefAST*>(d)) g->Pkg = this;
 
 				if (Symbols.count(d->Name) == 0) {
 					Symbol *s = new Symbol(d);
@@ -131,17 +139,82 @@ void Package::import(ImportAST *def) {
 
 		try {
 			pkg->typeCheck();
+			Gen->declare(pkg);
+			pkg->fold();
 			Gen->build(pkg);
 		} catch (PIFError *e) {
 			throw new PIFError("In importing package '" + package_name + "'.", e);
 		}
 		pkg->Complete = true;
-		Gen->init(pkg);
 
 		DBGB(cout << " <- Imported " << package_name << endl)
 
 		Imports[def->As] = pkg;
 	}
+
+	Package *pkg = Imports[def->As];
+	for (map<string, TypeAST*>::iterator it = pkg->Types.begin(); it != pkg->Types.end(); it++) {
+		if (it->first.find('.') == string::npos) Types[def->As + "." + it->first] = it->second;
+	}
+}
+
+// Instance of a generic function of this package for these types : the text of
+// the generic is parsed again with the type parameters bound to the types. Instances
+// are symbols of the package, named like 'max[float]'. While the package is type
+// checked, they are appended to its symbols and go through the same steps as the others,
+// afterwards (calls from packages importing it) they are built at once.
+ExprAST *Package::instantiate(GenericFuncDefAST *g, const vector<TypeAST*> &types, const FTag &tag) {
+	Symbol *s;
+	string name = g->Name + "[";
+	for (unsigned i = 0; i < types.size(); i++) {
+		if (i != 0) name += ", ";
+		name += types[i]->typeDescStr();
+	}
+	name += "]";
+
+	if (g->Instances.count(types) != 0) {
+		s = g->Instances[types];
+	} else {
+		if (g->Instances.size() >= MAX_INSTANCES) {
+			tag.Throw("Too many instances of generic function '" + g->Name + "' (for " + name + ").");
+		}
+		DBGP(cerr << "instance: " << name << endl)
+
+		map<string, TypeAST*> bound = Types;
+		for (unsigned i = 0; i < types.size(); i++) bound[g->Params[i]] = types[i];
+		DefAST *d;
+		try {
+			istringstream in(g->Text);
+			Lexer lex(g->File, in, g->Line);
+			Parser parser(lex, bound);
+			d = parser.ParseFuncBody(g->Tag, name);
+		} catch (PIFError *e) {
+			tag.Throw("In instance '" + name + "' of generic function '" + g->Name + "'.", e);
+		}
+		d->Const = g->Const;
+
+		s = new Symbol(d);
+		s->SType = d->typeAtDef();
+		Symbols[name] = s;
+		SymbolDefOrder.push_back(s);
+		g->Instances[types] = s;
+
+		if (Complete) {
+			try {
+				d->typeCheck(&Ctx);
+				s->SType = d->typeAtDef();
+				Gen->declareFunction(this, s);
+				d->fold();
+				Gen->buildFunction(this, s);
+			} catch (PIFError *e) {
+				tag.Throw("In instance '" + name + "' of generic function '" + g->Name + "'.", e);
+			}
+		}
+	}
+
+	VarExprAST *v = new VarExprAST(tag, name);
+	v->type(&Ctx);
+	return v;
 }
 
 // Check that everything is ok
@@ -173,9 +246,15 @@ void Package::typeCheck() {
 	}
 }
 
+// Replace constant expressions by their value, see typecheck/fold.cpp
+void Package::fold() {
+	for (unsigned i = 0; i < SymbolDefOrder.size(); i++) {
+		SymbolDefOrder[i]->Def->fold();
+	}
+}
 
-// === Helper function for main ===
-void Package::importAndRunMain(string pkg) {
+// === Helper functions for main ===
+Package *Package::importProgram(string pkg) {
 	vector<string> path;
 	int j = 0;
 	for (unsigned i = 0; i < pkg.length(); i++) {
@@ -191,9 +270,13 @@ void Package::importAndRunMain(string pkg) {
 	}
 	import(new ImportAST(FTag(), path, as));
 
-	if (Imports.count(as) > 0) {
-		Gen->main(Imports[as]);
-	}
+	if (Imports.count(as) > 0) return Imports[as];
+	return 0;
 }
 
-
+void Package::importAndRunMain(string pkg) {
+	Package *p = importProgram(pkg);
+	if (p != 0) {
+		Gen->main(p);
+	}
+}
@@ -19,14 +19,21 @@ class Symbol {
 	TypeAST *SType;
 	llvm::Value *llvmVal;
 
+	llvm::Value *LazyGuard;			// for lazy globals : 0 = not computed, 2 = being computed, 1 = ok
+	llvm::Function *LazyInit;		// for lazy globals : function computing the value
+
 	Symbol(DefAST *def) : Def(def) {
 		llvmVal = 0;
 		SType = 0;
+		LazyGuard = 0;
+		LazyInit = 0;
 	}
 	Symbol(TypeAST *type, llvm::Value *v) {
 		Def = 0;
 		SType = type;
 		llvmVal = v;
+		LazyGuard = 0;
+		LazyInit = 0;
 	}
 };
 
@@ -35,8 +42,15 @@ class MoreContext {
 	TypeAST *FuncRetType;
 	llvm::BasicBlock *BreakTo;
 	llvm::BasicBlock *ContinueTo;
-
-	MoreContext(TypeAST *ret) : FuncRetType(ret), BreakTo(0), ContinueTo(0) {}
+	bool Pure;			// in a const function : no global variables, only calls to const functions
+	bool Parallel;		// in the body of a parallel loop : no return
+	TypeAST *YieldType;	// in a generator : type of the values it yields, 0 elsewhere
+	bool FastMath;		// float operations may be rewritten as if they were exact (see BinaryExprAST::Codegen)
+	FuncExprAST *Lambda;	// in a lambda : the lambda, that captures the variables of enclosing functions
+	std::vector<llvm::Value*> LoopFrames;	// generator frames that enclosing for-in loops put on the heap
+
+	MoreContext(TypeAST *ret) : FuncRetType(ret), BreakTo(0), ContinueTo(0), Pure(false), Parallel(false), YieldType(0),
+		FastMath(false), Lambda(0) {}
 };
 
 class Context {
@@ -54,6 +68,7 @@ class Package {
 	friend class Generator;
 	friend class DotMemberExprAST;
 	friend class PackageTypeAST;
+	friend class FuncExprAST;
 	friend int main(int argc, char *argv[]);
 
 	private:
@@ -63,7 +78,7 @@ class Package {
 	Context Ctx;
 
 	std::map<std::string, Package*> Imports;
-	std::map<std::string, TypeAST*> Types;		//TODO: will be implemented later
+	std::map<std::string, TypeAST*> Types;		// named types ('type Name = ...'), those of imports as 'pkg.Name'
 	std::map<std::string, Symbol*> Symbols;
 	std::vector<Symbol*> SymbolDefOrder;
 
@@ -73,6 +88,8 @@ class Package {
 	std::string SymbolPrefix;
 
 	bool Complete;
+	bool ConstsBuilt;		// const functions are built before the rest, see Generator::buildConsts
+	bool FastMath;			// 'fastmath package' : in all functions of the package
 
 	public:
 
@@ -80,12 +97,16 @@ class Package {
 
 	void inputFile(std::string filename);
 	void typeCheck();
+	void fold();
 
 	void import(ImportAST *def);
 
+	Package *importProgram(std::string pkg);
 	void importAndRunMain(std::string pkg);
 
 	Package *getImport(std::string name);
+
+	ExprAST *instantiate(GenericFuncDefAST *g, const std::vector<TypeAST*> &types, const FTag &tag);
 };
 
 // extern std::map<std::string, Package*> Packages;
@@ -14,6 +14,7 @@
 #include "type.h"
 
 class Context;
+class Symbol;
 
 // ExprAST - Base class for all expression nodes
 class ExprAST {
@@ -30,35 +31,51 @@ class ExprAST {
 	TypeAST *type(Context *ctx);
 	virtual ExprAST *asType(TypeAST *ty);
 	ExprAST *asTypeOrError(TypeAST *ty);
+	virtual Symbol *refSymbol();
 
 	virtual llvm::Value *Codegen() = 0;
+	virtual llvm::Constant *constCodegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out) = 0;
 
 	const FTag Tag;
 
 	ExprAST* cannotConvert(TypeAST *t);
+
+	protected:
+	// helpers for arrays and slices
+	static ExprAST *derefArray(ExprAST *e, Context *ctx);
+	static ExprAST *asIndex(ExprAST *e, Context *ctx);
+	static ExprAST *asAtomic(ExprAST *e, AtomicTypeAST *t);
+	static bool otherLayout(TypeAST *from, TypeAST *to);
 };
 
 // BoolExprAST - Expression class for booleans true and false
 class BoolExprAST : public ExprAST {
+	friend class ConstFold;
+
 	bool Val;
 	TypeAST* getType();
 	public:
 	BoolExprAST(const FTag &tag, bool val) : ExprAST(tag), Val(val) {}
 	virtual llvm::Value *Codegen();
+	virtual llvm::Constant *constCodegen();
 
 	virtual void prettyprint(std::ostream &out);
 };
 
 // IntExprAST - Expression class for integer like "42" or "122222452"
 class IntExprAST : public ExprAST {
+	friend class ConstFold;
+
 	INT Val;
 	IntTypeAST *IType;
 	TypeAST* getType();
 	public:
 	IntExprAST(const FTag &tag, INT val, IntTypeAST *ty): ExprAST(tag), Val(val), IType(ty) {}
 	virtual llvm::Value *Codegen();
+	virtual llvm::Constant *constCodegen();
 
 	virtual ExprAST *asType(TypeAST *ty);
 
@@ -67,18 +84,26 @@ class IntExprAST : public ExprAST {
 
 // FloatExprAST - Expression class for floats like "2.0" or "3.14"
 class FloatExprAST : public ExprAST {
+	friend class ConstFold;
+
 	FLOAT Val;
+	BaseTypeAST *FType;		// float or f32, depending on where the literal is used
 	TypeAST* getType();
 	public:
-	FloatExprAST(const FTag &tag, FLOAT val): ExprAST(tag), Val(val) {}
+	FloatExprAST(const FTag &tag, FLOAT val, BaseTypeAST *ty = FLOATTYPE) :
+		ExprAST(tag), Val(ty == F32TYPE ? (FLOAT)(float)val : val), FType(ty) {}
 	virtual llvm::Value *Codegen();
+	virtual llvm::Constant *constCodegen();
+
+	virtual ExprAST *asType(TypeAST *ty);
 
 	virtual void prettyprint(std::ostream &out);
 };
 
 // VarExprAST - Expression class for referencing a variable, like "a"
-class Symbol;
 class VarExprAST : public ExprAST {
+	friend class AtomicOpExprAST;
+
 	std::string Name;
 	Symbol *Sym;
 	bool IsGlobalConst;
@@ -86,7 +111,12 @@ class VarExprAST : public ExprAST {
 	TypeAST* getType();
 	public:
 	VarExprAST(const FTag &tag, const std::string &name) : ExprAST(tag), Name(name), Sym(0), IsGlobalConst(false) {}
+	void checkPure(Context *userCtx);
+	llvm::Value *constAddr();
+	virtual Symbol *refSymbol();
 	virtual llvm::Value *Codegen();
+	virtual llvm::Constant *constCodegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
@@ -98,6 +128,7 @@ class DerefExprAST : public ExprAST {
 	public:
 	DerefExprAST(const FTag &tag, ExprAST *val) : ExprAST(tag), Val(val) {}
 	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
@@ -111,6 +142,7 @@ class UnaryExprAST : public ExprAST {
 	UnaryExprAST(const FTag &tag, std::string op, ExprAST *expr) :
 		ExprAST(tag), Op(op), Expr(expr) {}
 	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
@@ -124,6 +156,7 @@ class BinaryExprAST : public ExprAST {
 	BinaryExprAST(const FTag &tag, std::string op, ExprAST *lhs, ExprAST *rhs) :
 		ExprAST(tag), Op(op), LHS(lhs), RHS(rhs) {}
 	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
@@ -132,11 +165,15 @@ class BinaryExprAST : public ExprAST {
 class DotMemberExprAST : public ExprAST {
 	ExprAST *Obj;
 	std::string Member;
+	int Field;			// index of the field, for records
 	TypeAST *getType();
 	public:
 	DotMemberExprAST(const FTag &tag, ExprAST *obj, std::string member) :
-		ExprAST(tag), Obj(obj), Member(member) {}
+		ExprAST(tag), Obj(obj), Member(member), Field(-1) {}
+	ExprAST *methodCall(const std::vector<ExprAST*> &args, Context *ctx);
+	virtual Symbol *refSymbol();
 	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 
@@ -152,19 +189,209 @@ class CastExprAST : public ExprAST {
 	CastExprAST(const FTag &tag, ExprAST *expr, TypeAST *type) :
 		ExprAST(tag), Expr(expr), FType(type), NeedCast(true) {};
 	virtual llvm::Value *Codegen();
+	virtual llvm::Constant *constCodegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
 
 // CallExprAST - Expression class for a function call
 class CallExprAST : public ExprAST {
+	friend class SpawnExprAST;
+	friend class ForInAST;
+
 	ExprAST *Callee;
 	std::vector<ExprAST*> Args;
+	ExprAST *Subst;		// what the call really is, when it is a call to a builtin method like 'v.sum()'
 	TypeAST *getType();
+	llvm::Value *codegenCall(llvm::Value *dest);
 	public:
 	CallExprAST(const FTag &tag, ExprAST* callee, const std::vector<ExprAST*> &args) :
-		ExprAST(tag), Callee(callee), Args(args) {}
+		ExprAST(tag), Callee(callee), Args(args), Subst(0) {}
+	virtual llvm::Value *Codegen();
+	bool codegenInto(llvm::Value *dest);
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// StructExprAST - Expression class for records, like "Point(1.0, 2.0)" : values of the fields, in order
+class StructExprAST : public ExprAST {
+	StructTypeAST *SType;
+	std::vector<ExprAST*> Vals;
+	TypeAST *getType();
+	public:
+	StructExprAST(const FTag &tag, StructTypeAST *type, const std::vector<ExprAST*> &vals) : ExprAST(tag), SType(type), Vals(vals) {}
+	virtual llvm::Value *Codegen();
+	virtual llvm::Constant *constCodegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// ArrayExprAST - Expression class for array literals, like "[1, 2, 3]"
+class ArrayExprAST : public ExprAST {
+	std::vector<ExprAST*> Elems;
+	TypeAST *getType();
+	public:
+	ArrayExprAST(const FTag &tag, const std::vector<ExprAST*> &elems) : ExprAST(tag), Elems(elems) {}
+	virtual llvm::Value *Codegen();
+	virtual llvm::Constant *constCodegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// IndexExprAST - Expression class for indexing an array or a slice, like "a[i]"
+class IndexExprAST : public ExprAST {
+	ExprAST *Obj, *Idx;
+	TypeAST *getType();
+	llvm::Value *soaIndex(llvm::Value *&arr);
+	public:
+	IndexExprAST(const FTag &tag, ExprAST *obj, ExprAST *idx) : ExprAST(tag), Obj(obj), Idx(idx) {}
+	virtual llvm::Value *Codegen();
+	// records of soa arrays in memory have no address, only their fields do
+	bool inSoA();
+	llvm::Value *soaFieldAddr(unsigned field);
+	llvm::Value *soaLoad();
+	void soaStore(llvm::Value *v);
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// SliceExprAST - Expression class for taking a slice of an array or a slice, like "a[i..j]"
+class SliceExprAST : public ExprAST {
+	ExprAST *Obj, *Lo, *Hi;		// Lo and Hi can be 0 for start and end
+	TypeAST *getType();
+	public:
+	SliceExprAST(const FTag &tag, ExprAST *obj, ExprAST *lo, ExprAST *hi) : ExprAST(tag), Obj(obj), Lo(lo), Hi(hi) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// SpawnExprAST - Expression class for "spawn f(x)" : the call runs as a task, the value is a handle to it
+class SpawnExprAST : public ExprAST {
+	ExprAST *Call;
+	TypeAST *getType();
+	public:
+	SpawnExprAST(const FTag &tag, ExprAST *call) : ExprAST(tag), Call(call) {}
 	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// JoinExprAST - Expression class for "join h" : waits for the task and gives its result
+class JoinExprAST : public ExprAST {
+	ExprAST *Handle;
+	TypeAST *getType();
+	public:
+	JoinExprAST(const FTag &tag, ExprAST *handle) : ExprAST(tag), Handle(handle) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// AtomicOpExprAST - Expression class for operations on atomics, like "c.load(acquire)" or "c.fetch_add(1)"
+// The ordering is the last argument when given, seq_cst otherwise
+class AtomicOpExprAST : public ExprAST {
+	ExprAST *Ref;
+	std::string Op, Order;
+	std::vector<ExprAST*> Args;
+	TypeAST *getType();
+	public:
+	AtomicOpExprAST(const FTag &tag, ExprAST *ref, const std::string &op, const std::vector<ExprAST*> &args) :
+		ExprAST(tag), Ref(ref), Op(op), Order("seq_cst"), Args(args) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// OrderingExprAST - Expression class for memory orderings, like "acquire" : only
+// valid as the last argument of an atomic operation, that takes it out of its arguments
+class OrderingExprAST : public ExprAST {
+	friend class AtomicOpExprAST;
+	std::string Order;
+	TypeAST *getType();
+	public:
+	OrderingExprAST(const FTag &tag, const std::string &order) : ExprAST(tag), Order(order) {}
+	virtual llvm::Value *Codegen();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// FenceExprAST - Expression class for memory fences : "fence(acquire)"
+class FenceExprAST : public ExprAST {
+	std::string Order;
+	TypeAST *getType();
+	public:
+	FenceExprAST(const FTag &tag, const std::string &order) : ExprAST(tag), Order(order) {}
+	virtual llvm::Value *Codegen();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// NewChanExprAST - Expression class for new channels : "chan int(64)"
+class NewChanExprAST : public ExprAST {
+	TypeAST *ElemType;
+	ExprAST *Capacity;
+	TypeAST *getType();
+	public:
+	NewChanExprAST(const FTag &tag, TypeAST *elem, ExprAST *cap) : ExprAST(tag), ElemType(elem), Capacity(cap) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// ChanOpExprAST - Expression class for operations on channels : "c.send(x)", "c.recv()", "c.try_recv(&x)"...
+class ChanOpExprAST : public ExprAST {
+	ExprAST *Chan;
+	std::string Op;
+	std::vector<ExprAST*> Args;
+	TypeAST *getType();
+	public:
+	ChanOpExprAST(const FTag &tag, ExprAST *chan, const std::string &op, const std::vector<ExprAST*> &args) :
+		ExprAST(tag), Chan(chan), Op(op), Args(args) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// GenOpExprAST - Expression class for operations on generators : "g.next(&x)", "g.free()"
+class GenOpExprAST : public ExprAST {
+	ExprAST *Gen;
+	std::string Op;
+	std::vector<ExprAST*> Args;
+	TypeAST *getType();
+	public:
+	GenOpExprAST(const FTag &tag, ExprAST *gen, const std::string &op, const std::vector<ExprAST*> &args) :
+		ExprAST(tag), Gen(gen), Op(op), Args(args) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// VectorOpExprAST - Expression class for builtin methods of vectors, like "v.sum()" or "m.select(a, b)"
+class VectorOpExprAST : public ExprAST {
+	ExprAST *Vec;
+	std::string Op;
+	std::vector<ExprAST*> Args;
+	TypeAST *getType();
+
+	llvm::Value *reduce(llvm::Value *v, unsigned width);
+	public:
+	VectorOpExprAST(const FTag &tag, ExprAST *vec, std::string op, const std::vector<ExprAST*> &args) :
+		ExprAST(tag), Vec(vec), Op(op), Args(args) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
@@ -178,6 +405,7 @@ class IfThenElseAST : public ExprAST {
 	IfThenElseAST(const FTag &tag, ExprAST *cond, ExprAST *truebr, ExprAST *falsebr) :
 		ExprAST(tag), Cond(cond), TrueBr(truebr), FalseBr(falsebr) {}
 	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
@@ -192,6 +420,65 @@ class WhileAST : public ExprAST {
 	WhileAST(const FTag &tag, ExprAST *cond, ExprAST *inside, bool isuntil) :
 		ExprAST(tag), Cond(cond), Inside(inside), IsUntil(isuntil) {}
 	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// ForAST - Expression class for counted loops : for i in a..b step s
+// The range is half-open, the loop variable is an immutable int
+class ForAST : public ExprAST {
+	protected:
+	std::string Var;
+	ExprAST *From, *To, *Step, *Inside;
+	INT Unroll, Vectorize;		// hints, 0 when not given
+	Symbol *Sym;
+
+	TypeAST *getType();
+	llvm::Value *downTest(llvm::Value *step);
+	llvm::Value *moreTest(llvm::Value *i, llvm::Value *to, llvm::Value *step, llvm::Value *down);
+	public:
+	ForAST(const FTag &tag, const std::string &var, ExprAST *from, ExprAST *to, ExprAST *step, ExprAST *inside, INT unroll, INT vectorize) :
+		ExprAST(tag), Var(var), From(from), To(to), Step(step), Inside(inside), Unroll(unroll), Vectorize(vectorize), Sym(0) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// ParallelForAST - Expression class for parallel loops : parallel for i in a..b reduce + s
+// The body is outlined into a function run on ranges of iterations by the
+// thread pool of the runtime (see runtime/parallel.cpp)
+class ParallelForAST : public ForAST {
+	ExprAST *Grain;
+	std::vector<std::pair<std::string, std::string> > Reductions;	// operator, variable
+	std::vector<Symbol*> RedSyms;
+
+	TypeAST *getType();
+	public:
+	ParallelForAST(const FTag &tag, const std::string &var, ExprAST *from, ExprAST *to, ExprAST *step, ExprAST *inside, INT unroll, INT vectorize,
+			ExprAST *grain, const std::vector<std::pair<std::string, std::string> > &reductions) :
+		ForAST(tag, var, from, to, step, inside, unroll, vectorize), Grain(grain), Reductions(reductions) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// ForInAST - Expression class for loops on the values of a generator : for x in primes(100) { ... }
+// When the generator is a direct call of a 'gen func', its frame is put on the stack
+// and its resume function called directly.
+class ForInAST : public ExprAST {
+	std::string Var;
+	ExprAST *Gen, *Inside;
+	Symbol *Sym;
+
+	TypeAST *getType();
+	public:
+	ForInAST(const FTag &tag, const std::string &var, ExprAST *gen, ExprAST *inside) :
+		ExprAST(tag), Var(var), Gen(gen), Inside(inside), Sym(0) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
@@ -224,6 +511,7 @@ class BlockAST : public ExprAST{
 	BlockAST(const FTag &tag, const std::vector<StmtAST*> &instr) : 
 		ExprAST(tag), Instructions(instr), OwnContext(false) {}
 	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
@@ -235,6 +523,19 @@ class ReturnAST : public ExprAST {
 	public:
 	ReturnAST(const FTag &tag, ExprAST* val) : ExprAST(tag), Val(val) {}
 	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
+
+	virtual void prettyprint(std::ostream &out);
+};
+
+// YieldAST - Class for yield statements, in generators
+class YieldAST : public ExprAST {
+	ExprAST* Val;
+	TypeAST* getType();
+	public:
+	YieldAST(const FTag &tag, ExprAST* val) : ExprAST(tag), Val(val) {}
+	virtual llvm::Value *Codegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
@@ -244,19 +545,41 @@ class FuncExprAST : public ExprAST {
 	friend class Generator;
 	friend class VarExprAST;
 	friend class FuncDefAST;
+	friend class ForInAST;
+	friend class Parser;
 
 	FuncTypeAST *FType;
 	BlockAST *Code;
 	bool OwnContext;
+	bool Pure;
+	bool FastMath;			// 'fastmath func' (see BinaryExprAST::Codegen)
+	TypeAST *YieldType;		// for generators, 0 for normal functions
+
+	// lambdas : variables of the enclosing functions used by the body, which are
+	// those of the scopes before ScopeDepth, and the lambda they are in, if any
+	bool Lambda;
+	unsigned ScopeDepth;
+	FuncExprAST *Outer;
+	std::vector<Symbol*> Captures;
+	llvm::Function *Fn;
+	std::vector<Symbol*> Env;		// the captured variables that are not constants
+	llvm::StructType *EnvTy;
 
 	TypeAST* getType();
+	llvm::Function *lambdaFunction();
 
 	public:
 	FuncExprAST(const FTag &tag, FuncTypeAST *type, BlockAST *code) :
-		ExprAST(tag), FType(type), Code(code), OwnContext(false) {}
+		ExprAST(tag), FType(type), Code(code), OwnContext(false), Pure(false), FastMath(false), YieldType(0),
+		Lambda(false), ScopeDepth(0), Outer(0), Fn(0), EnvTy(0) {}
+
+	void makeGenerator();
+	void capture(Symbol *s, unsigned scope);
 
 
 	virtual llvm::Value *Codegen();
+	virtual llvm::Constant *constCodegen();
+	virtual ExprAST *fold();
 
 	virtual void prettyprint(std::ostream &out);
 };
@@ -21,6 +21,7 @@ class StmtAST {
 	const FTag Tag;
 
 	virtual void typeCheck(Context *ctx) {};
+	virtual void fold() {};
 };
 
 // ExprStmtAST - Class for statements made of expressions
@@ -35,6 +36,7 @@ class ExprStmtAST : public StmtAST {
 	virtual ~ExprStmtAST() {}
 
 	virtual void typeCheck(Context *ctx);
+	virtual void fold();
 };
 
 // ImportAST - Class for import statements
@@ -56,12 +58,15 @@ class DefAST : public StmtAST {
 	friend class Generator;
 	friend class VarExprAST;
 	friend class BlockAST;
+	friend class ConstFold;
 
 	protected:
 	std::string Name;
 
 	public:
-	DefAST(std::string name, const FTag &tag) : StmtAST(tag), Name(name) {}
+	bool Const;		// 'const func' : pure function, calls with constant arguments are evaluated at compile time
+
+	DefAST(std::string name, const FTag &tag) : StmtAST(tag), Name(name), Const(false) {}
 	virtual ~DefAST() {}
 
 	virtual TypeAST* typeAtDef() = 0;
@@ -71,37 +76,51 @@ class VarDefAST  : public DefAST {
 	friend class Package;
 	friend class Generator;
 	friend class VarExprAST;
+	friend class ConstFold;
 	friend class BlockAST;
+	friend class Parser;
+	friend class ParallelForAST;
+	friend class FuncExprAST;
 
 	private:
 	TypeAST *VType;
 	ExprAST *Val;
 	bool Var;
+	bool Lazy;				// toplevel only : computed on first access instead of in _init
+	bool ThreadLocal;		// toplevel only : every thread has its own copy
+	INT Align;				// 0 : natural alignment
+	short FoldState;		// 0 : not folded, 1 : folding, 2 : done
 	public:
 	VarDefAST(const FTag &tag, TypeAST *type, std::string name, ExprAST *value, bool var) :
 		DefAST(name, tag),
-		VType(type), Val(value), Var(var) {}
+		VType(type), Val(value), Var(var), Lazy(false), ThreadLocal(false), Align(0), FoldState(0) {}
 
 	virtual void typeCheck(Context *ctx);
+	virtual void fold();
 	virtual TypeAST* typeAtDef();
 };
 
 // FuncDefAST - Class for function definitions
 class FuncDefAST : public DefAST {
+	friend class Parser;
 	friend class Package;
 	friend class Generator;
 	friend class VarExprAST;
+	friend class ForInAST;
 
 	private:
 	FuncExprAST *Val;
+	bool Memo;			// 'memo func' : results are cached by arguments (see Generator::buildMemo)
+	INT MemoBound;		// 'memo(N) func' : at most N results are kept, 0 : all of them
 	
 	public:
 	virtual ~FuncDefAST() {}
 	FuncDefAST(const FTag &tag, std::string name, FuncExprAST *val) :
 		DefAST(name, tag), 
-		Val(val) {}
+		Val(val), Memo(false), MemoBound(0) {}
 
 	virtual void typeCheck(Context *ctx);
+	virtual void fold();
 	virtual TypeAST* typeAtDef();
 };
 
@@ -125,5 +144,32 @@ class ExternFuncDefAST : public DefAST {
 	virtual TypeAST* typeAtDef();
 };
 
+// GenericFuncDefAST - Class for generic functions, like "func max[T] : (a : T, b : T) -> T".
+// Only instances are compiled : each call gives the type parameters from the types of
+// its arguments, and calls the instance of the generic for these types (see Package::instantiate)
+class GenericFuncDefAST : public DefAST {
+	friend class Package;
+	friend class CallExprAST;
+
+	private:
+	std::vector<std::string> Params;
+	FuncTypeAST *FType;		// prototype, with TypeParamAST for the parameters
+	std::string Text;		// source of the generic after the parameters
+	std::string File;
+	int Line;
+	Package *Pkg;
+	std::map<std::vector<TypeAST*>, Symbol*> Instances;
+
+	public:
+	virtual ~GenericFuncDefAST() {}
+	GenericFuncDefAST(const FTag &tag, std::string name, const std::vector<std::string> &params, FuncTypeAST *type,
+			const std::string &text, const std::string &file, int line) :
+		DefAST(name, tag),
+		Params(params), FType(type), Text(text), File(file), Line(line), Pkg(0) {}
+
+	ExprAST *instanceCall(const std::vector<ExprAST*> &args, Context *ctx, const FTag &tag);
+	virtual TypeAST* typeAtDef();
+};
+
 
 #endif
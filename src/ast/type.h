@@ -29,6 +29,9 @@ class TypeAST {
 	virtual std::string typeDescStr() = 0;
 
 	virtual llvm::Value *castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx);
+
+	// type parameters of generic functions (see GenericFuncDefAST)
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
 };
 
 // PackageTypeAST - We need packages to be considered as types in some cases
@@ -46,22 +49,28 @@ class PackageTypeAST : public TypeAST {
 	virtual std::string typeDescStr();
 };
 
-// BaseTypeAST - Class for types like int or float
+// BaseTypeAST - Class for types like bool or float. Floats are 'float' (64 bits) and
+// f32 ; f16 and bf16 are only for storage, they are computed with as f32.
 enum BaseTypeE {
 	bt_void,
 	bt_bool,
 	bt_float,
+	bt_f32,
+	bt_f16,
+	bt_bf16,
 };
 class BaseTypeAST : public TypeAST {
 	friend class BinaryExprAST;
 	friend class IntExprAST;
 	friend class IntTypeAST;
 	friend class CastExprAST;
+	friend class ConstFold;
 
 	BaseTypeE BaseType;
 	BaseTypeAST(BaseTypeE basetype) : BaseType(basetype) {}
 	public:
 	static BaseTypeAST* Get(BaseTypeE basetype);
+	static BaseTypeAST *isFloat(TypeAST *t, bool storage = false);
 
 	virtual llvm::Type *getTy();
 
@@ -72,11 +81,17 @@ class BaseTypeAST : public TypeAST {
 #define VOIDTYPE (BaseTypeAST::Get(bt_void))
 #define BOOLTYPE (BaseTypeAST::Get(bt_bool))
 #define FLOATTYPE (BaseTypeAST::Get(bt_float))
+#define F32TYPE (BaseTypeAST::Get(bt_f32))
 
 class IntTypeAST : public TypeAST {
 	friend class BaseTypeAST;
 	friend class BinaryExprAST;
 	friend class IntExprAST;
+	friend class ConstFold;
+	friend class VectorTypeAST;
+	friend class VectorOpExprAST;
+	friend class ParallelForAST;
+	friend class AtomicOpExprAST;
 
 	short Size;
 	bool Signed;
@@ -100,6 +115,8 @@ class FuncArgAST {
 	friend class Generator;
 	friend class CallExprAST;
 	friend class FuncExprAST;
+	friend class GenericFuncDefAST;
+	friend class FuncDefAST;
 
 	std::string Name;
 	TypeAST* ArgType;
@@ -113,6 +130,9 @@ class FuncTypeAST : public TypeAST {
 	friend class ExternAST;
 	friend class CallExprAST;
 	friend class FuncExprAST;
+	friend class SpawnExprAST;
+	friend class GenericFuncDefAST;
+	friend class FuncDefAST;
 
 	std::vector<FuncArgAST*> Args;
 	TypeAST* ReturnType;
@@ -121,9 +141,13 @@ class FuncTypeAST : public TypeAST {
 	public:
 	static FuncTypeAST *Get(const std::vector<FuncArgAST*> &args, TypeAST* retType);
 
+	bool returnsByPointer();
+
 	virtual llvm::Type *getTy();
 
 	virtual std::string typeDescStr();
+
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
 };
 
 // RefTypeAST - Class for reference types
@@ -134,6 +158,14 @@ class RefTypeAST : public TypeAST {
 	friend class ExprAST;
 	friend class BinaryExprAST;
 	friend class CallExprAST;
+	friend class DotMemberExprAST;
+	friend class IndexExprAST;
+	friend class SliceExprAST;
+	friend class VectorOpExprAST;
+	friend class ParallelForAST;
+	friend class SpawnExprAST;
+	friend class AtomicOpExprAST;
+	friend class ChanOpExprAST;
 
 	TypeAST* VType;
 
@@ -141,12 +173,213 @@ class RefTypeAST : public TypeAST {
 
 	public:
 	static RefTypeAST *Get(TypeAST *type);
+	static TypeAST *valueType(TypeAST *t);		// t without the references that can be dereferenced
 
 	virtual bool canDeref();
 
 	virtual llvm::Type *getTy();
 
 	virtual std::string typeDescStr();
+
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
+};
+
+// ArrayTypeAST - Class for fixed-size arrays, like [16]float. Arrays of records can be
+// stored field by field, like 'soa [64]Point' : one array of x, one array of y, so that
+// loops over a field only load that field. They are used the same way.
+class ArrayTypeAST : public TypeAST {
+	friend class ExprAST;
+	friend class ArrayExprAST;
+	friend class IndexExprAST;
+	friend class SliceExprAST;
+	friend class DotMemberExprAST;
+	friend class CastExprAST;
+	friend class VectorTypeAST;
+	friend class BinaryExprAST;
+	friend class DerefExprAST;
+	friend class Parser;
+
+	TypeAST *ElemType;
+	INT Length;
+	bool SoA;		// 'soa [N]T' : each field of the records of T in its own array
+
+	ArrayTypeAST(TypeAST *elem, INT length, bool soa) : ElemType(elem), Length(length), SoA(soa) {}
+	public:
+	static ArrayTypeAST *Get(TypeAST *elem, INT length, bool soa = false);
+
+	virtual llvm::Type *getTy();
+
+	virtual std::string typeDescStr();
+
+	virtual llvm::Value *castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx);
+
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
+};
+
+// SliceTypeAST - Class for slices, like []float : a pointer to contiguous elements and a length
+class SliceTypeAST : public TypeAST {
+	friend class ExprAST;
+	friend class IndexExprAST;
+	friend class SliceExprAST;
+	friend class DotMemberExprAST;
+	friend class CastExprAST;
+	friend class VectorTypeAST;
+	friend class VectorOpExprAST;
+
+	TypeAST *ElemType;
+
+	SliceTypeAST(TypeAST *elem) : ElemType(elem) {}
+	public:
+	static SliceTypeAST *Get(TypeAST *elem);
+
+	virtual llvm::Type *getTy();
+
+	virtual std::string typeDescStr();
+
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
+};
+
+// VectorTypeAST - Class for SIMD vectors, like f64x4 or s32ix8, mapped to LLVM vectors.
+// Vectors of bool are the masks given by comparisons.
+class VectorTypeAST : public TypeAST {
+	friend class ExprAST;
+	friend class UnaryExprAST;
+	friend class BinaryExprAST;
+	friend class IndexExprAST;
+	friend class DotMemberExprAST;
+	friend class CastExprAST;
+	friend class VectorOpExprAST;
+
+	TypeAST *ElemType;
+	unsigned Width;
+
+	VectorTypeAST(TypeAST *elem, unsigned width) : ElemType(elem), Width(width) {}
+	public:
+	static VectorTypeAST *Get(TypeAST *elem, unsigned width);
+
+	virtual llvm::Type *getTy();
+
+	virtual std::string typeDescStr();
+
+	virtual llvm::Value *castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx);
+};
+
+// TaskTypeAST - Class for handles of spawned tasks, like "task int" : 'join' gives the result
+class TaskTypeAST : public TypeAST {
+	friend class SpawnExprAST;
+	friend class JoinExprAST;
+
+	TypeAST *ResultType;
+
+	TaskTypeAST(TypeAST *result) : ResultType(result) {}
+	public:
+	static TaskTypeAST *Get(TypeAST *result);
+
+	virtual llvm::Type *getTy();
+
+	virtual std::string typeDescStr();
+
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
+};
+
+// AtomicTypeAST - Class for atomic integers and references, like "atomic int" :
+// they are only accessed with the methods of AtomicOpExprAST, like "c.fetch_add(1)"
+class AtomicTypeAST : public TypeAST {
+	friend class ExprAST;
+	friend class CastExprAST;
+	friend class AtomicOpExprAST;
+
+	TypeAST *ValType;
+
+	AtomicTypeAST(TypeAST *val) : ValType(val) {}
+	public:
+	static AtomicTypeAST *Get(TypeAST *val);
+
+	virtual llvm::Type *getTy();
+
+	virtual std::string typeDescStr();
+
+	virtual llvm::Value *castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx);
+
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
+};
+
+// ChanTypeAST - Class for channels, like "chan int" : bounded queues between threads (see runtime/chan.cpp)
+class ChanTypeAST : public TypeAST {
+	friend class ChanOpExprAST;
+
+	TypeAST *ElemType;
+
+	ChanTypeAST(TypeAST *elem) : ElemType(elem) {}
+	public:
+	static ChanTypeAST *Get(TypeAST *elem);
+
+	virtual llvm::Type *getTy();
+
+	virtual std::string typeDescStr();
+
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
+};
+
+// StructTypeAST - Class for records, like "struct { x : float, y : float }". Records are
+// values : assigning or passing one copies it. 'type Point = struct { ... }' only gives
+// a name to the type, two records with the same fields are of the same type.
+class StructTypeAST : public TypeAST {
+	friend class StructExprAST;
+	friend class DotMemberExprAST;
+	friend class ArrayTypeAST;
+
+	std::vector<std::pair<std::string, TypeAST*> > Fields;
+
+	StructTypeAST(const std::vector<std::pair<std::string, TypeAST*> > &fields) : Fields(fields) {}
+	public:
+	static StructTypeAST *Get(const std::vector<std::pair<std::string, TypeAST*> > &fields);
+	static bool byPointer(TypeAST *t);
+
+	int fieldIndex(const std::string &name);
+
+	virtual llvm::Type *getTy();
+
+	virtual std::string typeDescStr();
+
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
+};
+
+// GenTypeAST - Class for generators, like "gen int" : what calling a 'gen func' gives,
+// the values it yields are taken with 'next' or a 'for' loop
+class GenTypeAST : public TypeAST {
+	friend class Generator;
+	friend class GenOpExprAST;
+	friend class ForInAST;
+
+	TypeAST *YieldType;
+
+	GenTypeAST(TypeAST *yield) : YieldType(yield) {}
+	public:
+	static GenTypeAST *Get(TypeAST *yield);
+
+	virtual llvm::Type *getTy();
+
+	virtual std::string typeDescStr();
+
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
+};
+
+// TypeParamAST - Class for the type parameters of generic functions, like T in
+// "func max[T] : (a : T, b : T) -> T". They only appear in the prototype of the generic :
+// its instances are parsed again with actual types in their place (see Package::instantiate).
+class TypeParamAST : public TypeAST {
+	std::string Name;
+
+	TypeParamAST(const std::string &name) : Name(name) {}
+	public:
+	static TypeParamAST *Get(const std::string &name);
+
+	virtual llvm::Type *getTy();
+
+	virtual std::string typeDescStr();
+
+	virtual bool bindParams(TypeAST *t, std::map<std::string, TypeAST*> &params);
 };
 
 #endif
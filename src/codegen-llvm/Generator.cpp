@@ -1,68 +1,111 @@
+#include <algorithm>
+#include <sstream>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
 #include "Generator.h"
 #include "../util.h"
 #include "../error.h"
 
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Support/InstIterator.h>
+#include <llvm/IntrinsicInst.h>
+
 using namespace llvm;
 using namespace std;
 
 Generator::Generator() :
 	TheModule(new Module("PIF", getGlobalContext())),
 	Builder(getGlobalContext()),
-	FPM(TheModule)
+	FPM(TheModule),
+	IsolateGlobals(false),
+	FastMath(false),
+	GenFrame(0),
+	GenResume(0),
+	GenStates(0),
+	RetSlot(0)
 	{
 		
 	InitializeNativeTarget();
 	ExecEng = EngineBuilder(TheModule).create();
+	ExecEng->DisableLazyCompilation(true);		// compiled code may be run from several threads
 
 	FPM.add(new TargetData(*ExecEng->getTargetData()));
 	FPM.add(createBasicAliasAnalysisPass());
+	FPM.add(createLowerExpectIntrinsicPass());
 	FPM.add(createPromoteMemoryToRegisterPass());
+	FPM.add(createScalarReplAggregatesPass());		// records, and environments of closures on the stack
 	FPM.add(createInstructionCombiningPass());
 	FPM.add(createReassociatePass());
 	FPM.add(createGVNPass());
 	FPM.add(createCFGSimplificationPass());
+	// loop passes : they remove bounds checks that the loop condition makes useless
+	FPM.add(createLoopRotatePass());
+	FPM.add(createIndVarSimplifyPass());
+	FPM.add(createLoopUnrollPass());
+	FPM.add(createCorrelatedValuePropagationPass());
+	FPM.add(createLICMPass());
+	FPM.add(createInstructionCombiningPass());
+	FPM.add(createCFGSimplificationPass());
 	FPM.doInitialization();
 }
 
+// Declare functions of a package. This is done before folding, so that
+// const functions can be built and run at compile time (see buildConsts).
+void Generator::declare(Package *pkg) {
+	// Setup package symbol table : functions first, so that their addresses are known
+	// when setting up global variables (which can be initialized with them, see build)
+	for (map<string, Symbol*>::iterator it = pkg->Symbols.begin(); it != pkg->Symbols.end(); it++) {
+		DefAST *d = it->second->Def;
+
+		if (dynamic_cast<FuncDefAST*>(d) != 0) {
+			declareFunction(pkg, it->second);
+		} else if (ExternFuncDefAST *ed = dynamic_cast<ExternFuncDefAST*>(d)) {
+			DBGP(cerr << "setup: " << it->first << " : " << it->second->SType->typeDescStr() << endl)
+
+			it->second->llvmVal = ed->Val->Codegen();
+		}
+	}
+}
+
 void Generator::build(Package *pkg) {
 	string prefix = pkg->SymbolPrefix;
 
-	// Setup package symbol table
 	for (map<string, Symbol*>::iterator it = pkg->Symbols.begin(); it != pkg->Symbols.end(); it++) {
-
-		DBGP(cerr << "setup: " << it->first << " : " << it->second->SType->typeDescStr() << endl)
-
 		DefAST *d = it->second->Def;
 
 		if (VarDefAST *vd = dynamic_cast<VarDefAST*>(d)) {
-
+			DBGP(cerr << "setup: " << it->first << " : " << it->second->SType->typeDescStr() << endl)
 			DBGC(cerr << " -> " << (vd->Var ? "var" : "const" ) << " = "; vd->Val->prettyprint(cerr))
 
-			GlobalVariable *pos = new GlobalVariable(*TheModule, vd->VType->getTy(), false, GlobalValue::ExternalLinkage, UndefValue::get(vd->VType->getTy()), prefix + d->Name);
+			// Values known at compile time go directly in the data section,
+			// the others are computed by _init
+			Type *t = vd->VType->getTy();
+			Constant *init = vd->Val->constCodegen();
+			GlobalVariable *pos = new GlobalVariable(*TheModule, t, (init != 0 && !vd->Var), GlobalValue::ExternalLinkage,
+				(init != 0 ? init : UndefValue::get(t)), prefix + d->Name);
 			it->second->llvmVal = pos;
-		} else if (FuncDefAST *fd = dynamic_cast<FuncDefAST*>(d)) {
+			if (vd->Align != 0) pos->setAlignment(vd->Align);
 
-			DBGC(cerr << " -> func = "; fd->Val->prettyprint(cerr))
-
-			string sym_name = prefix + fd->Name;
-			FunctionType *ft = dyn_cast<FunctionType>(fd->Val->FType->getTy());
-			if (ft == 0) {
-				d->Tag.Throw(" Error: function does not have function type.");
+			// The JIT cannot allocate native TLS on all targets : thread-local globals use the
+			// per-thread copies of the runtime (see globalAddr), which start as a copy of the
+			// global, so the initial value must be in the data section.
+			if (vd->ThreadLocal) {
+				if (init == 0) vd->Tag.Throw("A threadlocal variable must be initialized with a value known at compile time.");
+				ThreadLocals.insert(pos);
 			}
-			Function *f = Function::Create(ft, Function::ExternalLinkage, sym_name, TheModule);
 
-			if (f->getName() != sym_name) {
-				d->Tag.Throw(" Error: Redefinition of function " + fd->Name);
+			if (vd->Lazy && init == 0) {
+				Type *i32 = Type::getInt32Ty(getGlobalContext());
+				it->second->LazyGuard = new GlobalVariable(*TheModule, i32, false, GlobalValue::ExternalLinkage,
+					ConstantInt::get(i32, 0), prefix + d->Name + ".guard");
+				FunctionType *ft = FunctionType::get(Type::getVoidTy(getGlobalContext()), vector<Type*>(), false);
+				it->second->LazyInit = Function::Create(ft, Function::ExternalLinkage, prefix + d->Name + ".lazyinit", TheModule);
 			}
-
-			// set names for arguments
-			unsigned i = 0;
-			for (Function::arg_iterator ai = f->arg_begin(); i != fd->Val->FType->Args.size(); i++, ai++) {
-				ai->setName(fd->Val->FType->Args[i]->Name);
-			}
-			it->second->llvmVal = f;
-		} else if (ExternFuncDefAST *ed = dynamic_cast<ExternFuncDefAST*>(d)) {
-			it->second->llvmVal = ed->Val->Codegen();
 		}
 	}
 
@@ -70,76 +113,896 @@ void Generator::build(Package *pkg) {
 
 	// Generate code for functions
 	for (map<string, Symbol*>::iterator it = pkg->Symbols.begin(); it != pkg->Symbols.end(); it++) {
-		DefAST *d = it->second->Def;
-		if (FuncDefAST *fd = dynamic_cast<FuncDefAST*>(d)) {
-			string sym_name = pkg->SymbolPrefix + fd->Name;
-			Function *f = TheModule->getFunction(sym_name);
-			if (f != it->second->llvmVal) {
-				d->Tag.Throw(" Internal error n°RN#45556, sorry.");
+		if (dynamic_cast<FuncDefAST*>(it->second->Def) != 0) {
+			buildFunction(pkg, it->second);
+		}
+	}
+
+	// Generate code computing lazy globals
+	for (unsigned i = 0; i < pkg->SymbolDefOrder.size(); i++) {
+		Symbol *s = pkg->SymbolDefOrder[i];
+		if (s->LazyInit == 0) continue;
+		VarDefAST *vd = dynamic_cast<VarDefAST*>(s->Def);
+
+		BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "entry", s->LazyInit);
+		Builder.SetInsertPoint(BB);
+		Value *v = vd->Val->Codegen();
+		Builder.CreateStore(v, globalAddr(s->llvmVal));
+		Builder.CreateRetVoid();
+
+		DBGC(s->LazyInit->dump())
+
+		if (verifyFunction(*s->LazyInit)) {
+			vd->Tag.Throw("Error in initialization of lazy '" + vd->Name + "'...");
+		}
+		FPM.run(*s->LazyInit);
+	}
+
+	if (pkg->InitFunction == 0) {
+		throw new InternalError("Internal error #1512351, sorry.");
+	}
+
+	specialize();
+}
+
+// Declare a function of a package (instances of generic functions are declared
+// on their own when the package is already built, see Package::instantiate)
+void Generator::declareFunction(Package *pkg, Symbol *sym) {
+	FuncDefAST *fd = dynamic_cast<FuncDefAST*>(sym->Def);
+	if (fd == 0) throw new InternalError("Declaring something that is not a function.");
+
+	DBGP(cerr << "setup: " << fd->Name << " : " << sym->SType->typeDescStr() << endl)
+	DBGC(cerr << " -> func = "; fd->Val->prettyprint(cerr))
+
+	string sym_name = pkg->SymbolPrefix + fd->Name;
+	FunctionType *ft = dyn_cast<FunctionType>(fd->Val->FType->getTy());
+	if (ft == 0) {
+		fd->Tag.Throw(" Error: function does not have function type.");
+	}
+	Function *f = Function::Create(ft, Function::ExternalLinkage, sym_name, TheModule);
+
+	if (f->getName() != sym_name) {
+		fd->Tag.Throw(" Error: Redefinition of function " + fd->Name);
+	}
+
+	// set names for arguments
+	Function::arg_iterator ai = f->arg_begin();
+	if (fd->Val->FType->returnsByPointer()) (ai++)->setName("result");
+	for (unsigned i = 0; i != fd->Val->FType->Args.size(); i++, ai++) {
+		ai->setName(fd->Val->FType->Args[i]->Name);
+	}
+	sym->llvmVal = f;
+}
+
+// Generate code for a function of a package
+void Generator::buildFunction(Package *pkg, Symbol *sym) {
+	FuncDefAST *fd = dynamic_cast<FuncDefAST*>(sym->Def);
+	if (fd == 0) throw new InternalError("Building something that is not a function.");
+
+	string sym_name = pkg->SymbolPrefix + fd->Name;
+	Function *f = TheModule->getFunction(sym_name);
+	if (f != sym->llvmVal) {
+		fd->Tag.Throw(" Internal error n°RN#45556, sorry.");
+	}
+	if (!f->empty()) return;		// already built (const functions are built early)
+	if (fd->Val->YieldType != 0) {
+		if (Gens.count(f) == 0) buildGenerator(pkg, sym);
+		return;
+	}
+
+	// the body of a memo function is a function of its own, that the function
+	// of the symbol calls when the result is not cached (see buildMemo)
+	Function *memo = 0;
+	if (fd->Memo) {
+		memo = f;
+		f = Function::Create(memo->getFunctionType(), Function::InternalLinkage, sym_name + ".body", TheModule);
+		Function::arg_iterator bi = f->arg_begin();
+		for (Function::arg_iterator ai = memo->arg_begin(); ai != memo->arg_end(); ai++, bi++) {
+			bi->setName(ai->getName());
+		}
+	}
+
+	Context *fctx = fd->Val->Ctx;
+
+	BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "entry", f);
+	Builder.SetInsertPoint(BB);
+
+	// large records are returned in memory given by the caller, and passed by pointer
+	// to a copy, that the callee may modify (see Generator::emitCall)
+	Function::arg_iterator ai = f->arg_begin();
+	RetSlot = 0;
+	if (fd->Val->FType->returnsByPointer()) RetSlot = ai++;
+	for (unsigned i = 0; i != fd->Val->FType->Args.size(); i++, ai++) {
+		auto s = fctx->NamedValues.back()->find(fd->Val->FType->Args[i]->Name);
+		if (s == fctx->NamedValues.back()->end()) {
+			throw new InternalError("Function argument name mismatch.");
+		} else if (StructTypeAST::byPointer(fd->Val->FType->Args[i]->ArgType)) {
+			s->second->llvmVal = Builder.CreateLoad(ai, fd->Val->FType->Args[i]->Name);
+		} else {
+			s->second->llvmVal = ai;
+		}
+	}
+
+	if (fd->Name == "_init") {
+		pkg->InitFunction = f;
+		for (unsigned i = 0; i < pkg->SymbolDefOrder.size(); i++) {
+			Symbol *s = pkg->SymbolDefOrder[i];
+			VarDefAST *vd = dynamic_cast<VarDefAST*>(s->Def);
+			if (vd == 0 || s->LazyInit != 0) continue;
+			GlobalVariable *gv = dyn_cast<GlobalVariable>(s->llvmVal);
+			if (gv != 0 && !isa<UndefValue>(gv->getInitializer())) continue;	// static data
+			Value *v = vd->Val->Codegen();
+			Builder.CreateStore(v, globalAddr(s->llvmVal));
+		}
+	}
+
+	fd->Val->Code->Codegen();
+
+	RetSlot = 0;
+
+	BB = Builder.GetInsertBlock();
+	if (BB->getTerminator() == 0) {
+		if (fd->Val->FType->ReturnType == VOIDTYPE) {
+			Builder.CreateRetVoid();
+		} else {
+			fd->Val->Tag.Throw("Function '" + fd->Name + "' lacks a return statement.");
+		}
+	}
+
+	DBGC(f->dump())
+
+	if (verifyFunction(*f)) {
+		fd->Val->Tag.Throw("Error in function '" + fd->Name + "'...");
+	}
+	FPM.run(*f);
+
+	if (memo != 0) buildMemo(fd, memo, f);
+}
+
+// Memo functions ('memo func', see runtime/memo.cpp) : the function of the symbol
+// looks its arguments up in the cache of the function, and only calls the body
+// when they are not there, then caches the result. Recursive calls call the function
+// of the symbol, so they use the cache too. Arguments and results are integers,
+// floats or booleans (see FuncDefAST::typeCheck), cached as 64 bits words.
+// The cache is made by the first call. The function is pure, so all threads
+// share it, even when globals are isolated.
+
+static Value *memoWord(IRBuilder<> &builder, Value *v) {
+	LLVMContext &C = getGlobalContext();
+	Type *ity = INTTYPE->getTy();
+	if (v->getType()->isDoubleTy()) return builder.CreateBitCast(v, ity);
+	if (v->getType()->isFloatTy()) v = builder.CreateBitCast(v, Type::getInt32Ty(C));
+	if (v->getType() == ity) return v;
+	return builder.CreateZExt(v, ity);
+}
+
+static Value *memoValue(IRBuilder<> &builder, Value *w, Type *t) {
+	LLVMContext &C = getGlobalContext();
+	if (t->isDoubleTy()) return builder.CreateBitCast(w, t);
+	if (t->isFloatTy()) return builder.CreateBitCast(builder.CreateTrunc(w, Type::getInt32Ty(C)), t);
+	if (t == w->getType()) return w;
+	return builder.CreateTrunc(w, t);
+}
+
+void Generator::buildMemo(FuncDefAST *fd, Function *f, Function *body) {
+	LLVMContext &C = getGlobalContext();
+	Type *i8p = Type::getInt8PtrTy(C);
+	Type *i32 = Type::getInt32Ty(C);
+	Type *ity = INTTYPE->getTy();
+	Type *ityp = PointerType::get(ity, 0);
+	FuncTypeAST *ft = fd->Val->FType;
+	unsigned n = ft->Args.size();
+
+	GlobalVariable *cache = new GlobalVariable(*TheModule, i8p, false, GlobalValue::InternalLinkage,
+		ConstantPointerNull::get(cast<PointerType>(i8p)), f->getName().str() + ".memo");
+
+	BasicBlock *EntryBB = BasicBlock::Create(C, "entry", f);
+	BasicBlock *NewBB = BasicBlock::Create(C, "memonew", f);
+	BasicBlock *LookupBB = BasicBlock::Create(C, "memolookup", f);
+	BasicBlock *HitBB = BasicBlock::Create(C, "memohit", f);
+	BasicBlock *MissBB = BasicBlock::Create(C, "memomiss", f);
+
+	Builder.SetInsertPoint(EntryBB);
+	Value *key = Builder.CreateAlloca(ArrayType::get(ity, n), 0, "key");
+	key = Builder.CreateConstGEP2_32(key, 0, 0, "key");
+	Value *val = Builder.CreateAlloca(ity, 0, "val");
+	vector<Value*> args;
+	unsigned i = 0;
+	for (Function::arg_iterator ai = f->arg_begin(); ai != f->arg_end(); ai++, i++) {
+		args.push_back(ai);
+		Builder.CreateStore(memoWord(Builder, ai), Builder.CreateConstGEP1_32(key, i));
+	}
+	LoadInst *c0 = Builder.CreateLoad(cache, "memo");
+	c0->setAtomic(Acquire);
+	c0->setAlignment(8);
+	Builder.CreateCondBr(Builder.CreateIsNull(c0), NewBB, LookupBB);
+
+	// integer arguments that are small enough index a table instead of being hashed,
+	// unless the number of results kept is bounded : the table would keep more
+	Builder.SetInsertPoint(NewBB);
+	bool direct = (n == 1 && fd->MemoBound == 0 &&
+		(dynamic_cast<IntTypeAST*>(ft->Args[0]->ArgType) != 0 || ft->Args[0]->ArgType == BOOLTYPE));
+	Type *newTy[4] = { PointerType::get(i8p, 0), ity, ity, i32 };
+	Constant *newf = TheModule->getOrInsertFunction("pif_memo_cache", FunctionType::get(i8p, newTy, false));
+	Value *newArgs[4] = { cache, ConstantInt::get(ity, n), ConstantInt::get(ity, fd->MemoBound), ConstantInt::get(i32, direct) };
+	Value *c1 = Builder.CreateCall(newf, newArgs, "memo");
+	Builder.CreateBr(LookupBB);
+
+	Builder.SetInsertPoint(LookupBB);
+	PHINode *c = Builder.CreatePHI(i8p, 2, "memo");
+	c->addIncoming(c0, EntryBB);
+	c->addIncoming(c1, NewBB);
+	Type *getTy[3] = { i8p, ityp, ityp };
+	Constant *getf = TheModule->getOrInsertFunction("pif_memo_get", FunctionType::get(i32, getTy, false));
+	Value *hit = Builder.CreateCall3(getf, c, key, val, "hit");
+	Builder.CreateCondBr(Builder.CreateICmpNE(hit, ConstantInt::get(i32, 0)), HitBB, MissBB);
+
+	Builder.SetInsertPoint(HitBB);
+	Builder.CreateRet(memoValue(Builder, Builder.CreateLoad(val), f->getReturnType()));
+
+	Builder.SetInsertPoint(MissBB);
+	Value *r = Builder.CreateCall(body, args, "result");
+	Type *putTy[3] = { i8p, ityp, ity };
+	Constant *putf = TheModule->getOrInsertFunction("pif_memo_put",
+		FunctionType::get(Type::getVoidTy(C), putTy, false));
+	Builder.CreateCall3(putf, c, key, memoWord(Builder, r));
+	Builder.CreateRet(r);
+
+	DBGC(f->dump())
+
+	if (verifyFunction(*f)) {
+		fd->Val->Tag.Throw("Error in memo function '" + fd->Name + "'...");
+	}
+	FPM.run(*f);
+}
+
+// Generators. LLVM has no support for coroutines, so a 'gen func' is split here into :
+// - the function of its symbol, which only allocates a frame, stores the arguments
+//   in it and returns it (that is the 'gen T' value) ;
+// - a resume function 'i1 f.resume(i8* frame)', which runs the body until the next
+//   yield (and returns true, the value being in the frame) or until the end (false).
+// The frame is { resume function, state, last value, arguments..., variables... }.
+// The state tells where the body goes on : 0 at the start, k after the k-th yield,
+// -1 at the end. Values used across a yield cannot stay in registers : once the
+// body is generated, every value used outside of its block is demoted to a stack
+// slot, as the reg2mem pass does, then all stack slots are moved into the frame.
+
+StructType *Generator::genHeader(Type *yieldTy) {
+	LLVMContext &C = getGlobalContext();
+	Type *args[1] = { Type::getInt8PtrTy(C) };
+	Type *fields[3] = {
+		PointerType::get(FunctionType::get(Type::getInt1Ty(C), args, false), 0),
+		Type::getInt32Ty(C),
+		yieldTy
+	};
+	return StructType::get(C, fields);
+}
+
+static bool usedOutsideBlock(Instruction *inst) {
+	for (Value::use_iterator ui = inst->use_begin(); ui != inst->use_end(); ui++) {
+		Instruction *user = cast<Instruction>(*ui);
+		if (user->getParent() != inst->getParent() || isa<PHINode>(user)) return true;
+	}
+	return false;
+}
+
+void Generator::buildGenerator(Package *pkg, Symbol *sym) {
+	FuncDefAST *fd = dynamic_cast<FuncDefAST*>(sym->Def);
+	Function *f = dyn_cast<Function>(sym->llvmVal);
+	Context *fctx = fd->Val->Ctx;
+	LLVMContext &C = getGlobalContext();
+	Type *i8p = Type::getInt8PtrTy(C);
+
+	StructType *header = genHeader(fd->Val->YieldType->getTy());
+	Type *rargs[1] = { i8p };
+	Function *resume = Function::Create(FunctionType::get(Type::getInt1Ty(C), rargs, false),
+		Function::InternalLinkage, f->getName().str() + ".resume", TheModule);
+	GenInfo info = { resume, 0 };
+	Gens[f] = info;
+
+	vector<Type*> fields;
+	for (unsigned i = 0; i < header->getNumElements(); i++) fields.push_back(header->getElementType(i));
+	for (unsigned i = 0; i != fd->Val->FType->Args.size(); i++) fields.push_back(fd->Val->FType->Args[i]->ArgType->getTy());
+	StructType *argFrame = StructType::get(C, fields);
+
+	// a generator may be built while another is (see ForInAST::Codegen)
+	Value *prevFrame = GenFrame;
+	SwitchInst *prevResume = GenResume;
+	unsigned prevStates = GenStates;
+
+	BasicBlock *EntryBB = BasicBlock::Create(C, "entry", resume);
+	Builder.SetInsertPoint(EntryBB);
+	GenFrame = Builder.CreateBitCast(resume->arg_begin(), PointerType::get(argFrame, 0), "frame");
+	// arguments are read from the frame each time the generator is resumed
+	for (unsigned i = 0; i != fd->Val->FType->Args.size(); i++) {
+		auto s = fctx->NamedValues.back()->find(fd->Val->FType->Args[i]->Name);
+		if (s == fctx->NamedValues.back()->end()) {
+			throw new InternalError("Function argument name mismatch.");
+		}
+		s->second->llvmVal = Builder.CreateLoad(Builder.CreateStructGEP(GenFrame, 3 + i), fd->Val->FType->Args[i]->Name);
+	}
+	Value *state = Builder.CreateLoad(Builder.CreateStructGEP(GenFrame, 1), "state");
+	BasicBlock *StartBB = BasicBlock::Create(C, "start", resume);
+	BasicBlock *DoneBB = BasicBlock::Create(C, "done", resume);
+	GenResume = Builder.CreateSwitch(state, DoneBB);
+	GenResume->addCase(ConstantInt::get(Type::getInt32Ty(C), 0), StartBB);
+	GenStates = 0;
+
+	Builder.SetInsertPoint(DoneBB);
+	Builder.CreateRet(ConstantInt::getFalse(C));
+
+	Builder.SetInsertPoint(StartBB);
+	fd->Val->Code->Codegen();
+	if (Builder.GetInsertBlock()->getTerminator() == 0) genReturn();
+
+	GenFrame = prevFrame;
+	GenResume = prevResume;
+	GenStates = prevStates;
+
+	// Local variables are allocated where they are defined (see BlockAST) : all
+	// stack slots go to the entry block first. Instructions of the entry block are
+	// run at each resume, so they need no slot.
+	vector<Instruction*> moved, demoted;
+	vector<PHINode*> phis;
+	for (Function::iterator bb = resume->begin(); bb != resume->end(); bb++) {
+		if (&*bb == EntryBB) continue;
+		for (BasicBlock::iterator ii = bb->begin(); ii != bb->end(); ii++) {
+			if (AllocaInst *ai = dyn_cast<AllocaInst>(ii)) {
+				if (isa<ConstantInt>(ai->getArraySize())) moved.push_back(ai);
+			} else if (usedOutsideBlock(&*ii)) {
+				demoted.push_back(&*ii);
 			}
+			if (PHINode *phi = dyn_cast<PHINode>(ii)) phis.push_back(phi);
+		}
+	}
+	for (unsigned i = 0; i < moved.size(); i++) moved[i]->moveBefore(&EntryBB->front());
+	for (unsigned i = 0; i < demoted.size(); i++) DemoteRegToStack(*demoted[i], false);
+	for (unsigned i = 0; i < phis.size(); i++) DemotePHIToStack(phis[i]);
 
-			Context *fctx = fd->Val->Ctx;
+	vector<AllocaInst*> slots;
+	for (BasicBlock::iterator ii = EntryBB->begin(); ii != EntryBB->end(); ii++) {
+		if (AllocaInst *ai = dyn_cast<AllocaInst>(ii)) {
+			slots.push_back(ai);
+			fields.push_back(ai->getAllocatedType());
+		}
+	}
+	StructType *frameTy = StructType::get(C, fields);
+	IRBuilder<> tmp(EntryBB, EntryBB->begin());
+	Value *frame = tmp.CreateBitCast(resume->arg_begin(), PointerType::get(frameTy, 0), "fullframe");
+	unsigned first = argFrame->getNumElements();
+	for (unsigned i = 0; i < slots.size(); i++) {
+		slots[i]->replaceAllUsesWith(tmp.CreateStructGEP(frame, first + i, slots[i]->getName()));
+	}
+	for (unsigned i = 0; i < slots.size(); i++) slots[i]->eraseFromParent();
 
-			unsigned i = 0;
-			for (Function::arg_iterator ai = f->arg_begin(); i != fd->Val->FType->Args.size(); i++, ai++) {
-				auto s = fctx->NamedValues.back()->find(fd->Val->FType->Args[i]->Name);
-				if (s == fctx->NamedValues.back()->end()) {
-					throw new InternalError("Function argument name mismatch.");
-				} else {
-					s->second->llvmVal = ai;
-				}
+	Gens[f].Frame = frameTy;
+
+	DBGC(resume->dump())
+
+	if (verifyFunction(*resume)) {
+		fd->Val->Tag.Throw("Error in generator '" + fd->Name + "'...");
+	}
+	FPM.run(*resume);
+
+	// the function of the symbol
+	Builder.SetInsertPoint(BasicBlock::Create(C, "entry", f));
+	Type *nargs[1] = { INTTYPE->getTy() };
+	Constant *newFrame = TheModule->getOrInsertFunction("pif_frame_new", FunctionType::get(i8p, nargs, false));
+	Value *mem = Builder.CreateCall(newFrame,
+		ConstantInt::get(INTTYPE->getTy(), ExecEng->getTargetData()->getTypeAllocSize(frameTy)), "frame");
+	vector<Value*> args;
+	Function::arg_iterator ai = f->arg_begin();
+	for (unsigned i = 0; i != fd->Val->FType->Args.size(); i++, ai++) {
+		if (StructTypeAST::byPointer(fd->Val->FType->Args[i]->ArgType)) {
+			args.push_back(Builder.CreateLoad(ai));
+		} else {
+			args.push_back(ai);
+		}
+	}
+	genInit(f, mem, args);
+	Builder.CreateRet(mem);
+
+	DBGC(f->dump())
+
+	if (verifyFunction(*f)) {
+		fd->Val->Tag.Throw("Error in generator '" + fd->Name + "'...");
+	}
+	FPM.run(*f);
+}
+
+// Generator for a symbol of the package, built now if it is not yet.
+// Returns 0 when it cannot be known now (recursive generators, other packages).
+Generator::GenInfo *Generator::genInfo(Package *pkg, Symbol *sym) {
+	FuncDefAST *fd = dynamic_cast<FuncDefAST*>(sym->Def);
+	Function *f = dyn_cast_or_null<Function>(sym->llvmVal);
+	if (fd == 0 || f == 0 || fd->Val->YieldType == 0) return 0;
+
+	if (Gens.count(f) == 0) {
+		if (pkg->Symbols.count(fd->Name) == 0 || pkg->Symbols[fd->Name] != sym) return 0;
+		BasicBlock *CallerBB = Builder.GetInsertBlock();
+		buildGenerator(pkg, sym);
+		Builder.SetInsertPoint(CallerBB);
+	}
+	if (Gens[f].Frame == 0) return 0;
+	return &Gens[f];
+}
+
+// Set up a frame for generator function f, called with args
+void Generator::genInit(Function *f, Value *frame, const vector<Value*> &args) {
+	GenInfo &g = Gens[f];
+	Type *i32 = Type::getInt32Ty(getGlobalContext());
+	Value *p = Builder.CreateBitCast(frame, PointerType::get(g.Frame, 0));
+	Builder.CreateStore(g.Resume, Builder.CreateStructGEP(p, 0));
+	Builder.CreateStore(ConstantInt::get(i32, 0), Builder.CreateStructGEP(p, 1));
+	for (unsigned i = 0; i < args.size(); i++) {
+		Builder.CreateStore(args[i], Builder.CreateStructGEP(p, 3 + i));
+	}
+}
+
+void Generator::genYield(Value *v) {
+	LLVMContext &C = getGlobalContext();
+	Builder.CreateStore(v, Builder.CreateStructGEP(GenFrame, 2));
+	GenStates++;
+	Builder.CreateStore(ConstantInt::get(Type::getInt32Ty(C), GenStates), Builder.CreateStructGEP(GenFrame, 1));
+	Builder.CreateRet(ConstantInt::getTrue(C));
+
+	BasicBlock *ResumeBB = BasicBlock::Create(C, "resume", Builder.GetInsertBlock()->getParent());
+	GenResume->addCase(ConstantInt::get(Type::getInt32Ty(C), GenStates), ResumeBB);
+	Builder.SetInsertPoint(ResumeBB);
+}
+
+Value *Generator::genReturn() {
+	LLVMContext &C = getGlobalContext();
+	Builder.CreateStore(ConstantInt::get(Type::getInt32Ty(C), -1, true), Builder.CreateStructGEP(GenFrame, 1));
+	return Builder.CreateRet(ConstantInt::getFalse(C));
+}
+
+// Specialization on function arguments. A call like math.integrate(math.sin, 0, pi, n),
+// where an argument is a known function that the callee calls, is replaced by a call
+// to a copy of the callee in which that argument is the constant. The calls in the
+// copy are direct : math functions are lowered (see mathCall) and small PIF functions
+// are inlined. Only callees of at most SPEC_MAX_SIZE instructions are copied, at most
+// SPEC_MAX_COPIES times each. Functions that the JIT has already compiled (const
+// functions, run at compile time) are not changed, so that their code matches their IR.
+// Closures that capture variables are not constants, they are handled first (see closures).
+
+#define SPEC_MAX_SIZE 400
+#define SPEC_MAX_COPIES 8
+#define SPEC_INLINE_SIZE 40
+
+static unsigned instrCount(Function *f) {
+	unsigned n = 0;
+	for (Function::iterator bb = f->begin(); bb != f->end(); bb++) n += bb->size();
+	return n;
+}
+
+static bool callsItself(Function *f) {
+	for (inst_iterator i = inst_begin(f); i != inst_end(f); i++) {
+		CallInst *ci = dyn_cast<CallInst>(&*i);
+		if (ci != 0 && ci->getCalledFunction() == f) return true;
+	}
+	return false;
+}
+
+// Is this argument called, or passed on to a PIF function (that may be specialized too) ?
+static bool isCalled(Argument *a) {
+	for (Value::use_iterator ui = a->use_begin(); ui != a->use_end(); ui++) {
+		CallInst *ci = dyn_cast<CallInst>(*ui);
+		if (ci == 0) continue;
+		if (ci->getCalledValue() == a) return true;
+		if (ci->getCalledFunction() != 0 && !ci->getCalledFunction()->isDeclaration()) return true;
+	}
+	return false;
+}
+
+// Specialize the calls in all functions built since the last time, and in the copies
+// that this makes
+void Generator::specialize() {
+	for (Module::iterator f = TheModule->begin(); f != TheModule->end(); f++) {
+		if (f->isDeclaration() || SpecScanned.count(f) != 0) continue;
+		SpecScanned.insert(f);
+		if (ExecEng->getPointerToGlobalIfAvailable(f) != 0) continue;
+		SpecWork.push_back(f);
+	}
+	while (!SpecWork.empty()) {
+		Function *f = SpecWork.back();
+		SpecWork.pop_back();
+		closures(f);
+		specializeCalls(f);
+	}
+}
+
+void Generator::specializeCalls(Function *f) {
+	vector<CallInst*> calls;
+	for (inst_iterator i = inst_begin(f); i != inst_end(f); i++) {
+		CallInst *ci = dyn_cast<CallInst>(&*i);
+		if (ci != 0 && ci->getCalledFunction() != 0 && !ci->getCalledFunction()->isDeclaration()) calls.push_back(ci);
+	}
+
+	for (unsigned c = 0; c < calls.size(); c++) {
+		CallInst *ci = calls[c];
+		// one constant argument at a time : the copy may be specialized on the next one
+		while (1) {
+			Function *spec = 0;
+			unsigned idx = 0;
+			for (; idx < ci->getNumArgOperands(); idx++) {
+				Function *g = dyn_cast<Function>(ci->getArgOperand(idx));
+				if (g != 0) spec = specialization(ci->getCalledFunction(), idx, g);
+				if (spec != 0) break;
 			}
+			if (spec == 0) break;
 
-			BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "entry", f);
-			Builder.SetInsertPoint(BB);
-
-			if (fd->Name == "_init") {
-				pkg->InitFunction = f;
-				for (unsigned i = 0; i < pkg->SymbolDefOrder.size(); i++) {
-					Symbol *s = pkg->SymbolDefOrder[i];
-					VarDefAST *vd = dynamic_cast<VarDefAST*>(s->Def);
-					if (vd == 0) continue;
-					Value *v = vd->Val->Codegen();
-					Builder.CreateStore(v, s->llvmVal);
-				}
+			vector<Value*> args;
+			for (unsigned i = 0; i < ci->getNumArgOperands(); i++) {
+				if (i != idx) args.push_back(ci->getArgOperand(i));
+			}
+			CallInst *nci = CallInst::Create(spec, args, "", ci);
+			nci->takeName(ci);
+			ci->replaceAllUsesWith(nci);
+			ci->eraseFromParent();
+			ci = nci;
+		}
+	}
+}
+
+// Copy of f where argument number idx is g, or 0 when that is not worth it
+Function *Generator::specialization(Function *f, unsigned idx, Function *g) {
+	SpecKey key(f, make_pair(idx, g));
+	if (Specs.count(key) != 0) return Specs[key];
+
+	Function *spec = 0;
+	Function::arg_iterator ai = f->arg_begin();
+	for (unsigned i = 0; i < idx; i++) ai++;
+	Argument *a = ai;
+	if (!f->isVarArg() && Gens.count(f) == 0 && SpecCount[f] < SPEC_MAX_COPIES &&
+			instrCount(f) <= SPEC_MAX_SIZE && isCalled(a)) {
+		ValueToValueMapTy vmap;
+		vmap[a] = g;
+		spec = CloneFunction(f, vmap, false);		// without the argument
+		spec->setName(f->getName() + "." + g->getName());
+		spec->setLinkage(GlobalValue::InternalLinkage);
+		TheModule->getFunctionList().push_back(spec);
+		SpecCount[f]++;
+	}
+	Specs[key] = spec;
+
+	if (spec != 0) {
+		directCalls(spec, g);
+		FPM.run(*spec);
+		SpecScanned.insert(spec);
+		SpecWork.push_back(spec);
+	}
+	return spec;
+}
+
+// Calls to g in f, that were indirect before f was specialized on g
+void Generator::directCalls(Function *f, Function *g) {
+	vector<CallInst*> calls;
+	for (inst_iterator i = inst_begin(f); i != inst_end(f); i++) {
+		CallInst *ci = dyn_cast<CallInst>(&*i);
+		if (ci != 0 && ci->getCalledValue() == g) calls.push_back(ci);
+	}
+
+	bool inlined = (!g->isDeclaration() && g != f && Gens.count(g) == 0 &&
+		instrCount(g) <= SPEC_INLINE_SIZE && !callsItself(g));
+	for (unsigned i = 0; i < calls.size(); i++) {
+		CallInst *ci = calls[i];
+		if (g->isDeclaration()) {
+			vector<Value*> args(ci->op_begin(), ci->op_begin() + ci->getNumArgOperands());
+			Builder.SetInsertPoint(ci);
+			if (Value *v = mathCall(g, args)) {
+				ci->replaceAllUsesWith(v);
+				ci->eraseFromParent();
+			}
+		} else if (inlined) {
+			InlineFunctionInfo info;
+			InlineFunction(ci, info);
+		}
+	}
+}
+
+// Escape analysis of closures (see FuncExprAST::Codegen). A closure made in f is a
+// trampoline, in a block from the runtime with the environment. Calls through it
+// become direct calls to its lambda with the environment, and calls that pass it to
+// a PIF function go to a copy of that function that takes the environment instead
+// (see closureSpecialization) ; small lambdas are then inlined. When that covers all
+// its uses, the closure does not escape : its environment moves to the stack and the
+// trampoline disappears. Otherwise, it stays as it is, and its block is never freed.
+void Generator::closures(Function *f) {
+	vector<CallInst*> blocks;
+	for (inst_iterator i = inst_begin(f); i != inst_end(f); i++) {
+		CallInst *ci = dyn_cast<CallInst>(&*i);
+		if (ci != 0 && ci->getCalledFunction() != 0 && ci->getCalledFunction()->getName() == "pif_closure_new") {
+			blocks.push_back(ci);
+		}
+	}
+
+	bool changed = false;
+	for (unsigned b = 0; b < blocks.size(); b++) {
+		CallInst *block = blocks[b];
+		IntrinsicInst *init = 0, *adjust = 0;
+		CallInst *code = 0;
+		GetElementPtrInst *env = 0;
+		bool other = false;
+		for (Value::use_iterator ui = block->use_begin(); ui != block->use_end(); ui++) {
+			IntrinsicInst *ii = dyn_cast<IntrinsicInst>(*ui);
+			CallInst *ci = dyn_cast<CallInst>(*ui);
+			if (ii != 0 && ii->getIntrinsicID() == Intrinsic::init_trampoline && ii->getArgOperand(0) == block) {
+				init = ii;
+			} else if (ii == 0 && ci != 0 && ci->getCalledFunction() != 0 && ci->getCalledFunction()->getName() == "pif_closure_code") {
+				other = other || (code != 0);
+				code = ci;
+			} else if (GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(*ui)) {
+				other = other || (env != 0);
+				env = gep;
+			} else {
+				other = true;
+			}
+		}
+		// the executable address of the block, only used as a trampoline
+		if (code != 0) {
+			for (Value::use_iterator ui = code->use_begin(); ui != code->use_end(); ui++) {
+				IntrinsicInst *ii = dyn_cast<IntrinsicInst>(*ui);
+				if (ii != 0 && ii->getIntrinsicID() == Intrinsic::adjust_trampoline) adjust = ii;
+				else other = true;
+			}
+		}
+		if (init == 0 || env == 0 || other || init->getArgOperand(2)->stripPointerCasts() != env) continue;
+		Function *lam = dyn_cast<Function>(init->getArgOperand(1)->stripPointerCasts());
+		if (lam == 0) continue;
+
+		// the closure, as function pointers (none left when instcombine has already
+		// made all calls through the trampoline direct)
+		vector<Instruction*> ptrs;
+		if (adjust != 0) ptrs.push_back(adjust);
+		for (unsigned i = 0; i < ptrs.size(); i++) {
+			for (Value::use_iterator ui = ptrs[i]->use_begin(); ui != ptrs[i]->use_end(); ui++) {
+				if (BitCastInst *bc = dyn_cast<BitCastInst>(*ui)) ptrs.push_back(bc);
 			}
+		}
 
-			fd->Val->Code->Codegen();
+		bool escapes = false;
+		for (unsigned i = 0; i < ptrs.size(); i++) {
+			vector<User*> users(ptrs[i]->use_begin(), ptrs[i]->use_end());
+			for (unsigned u = 0; u < users.size(); u++) {
+				if (isa<BitCastInst>(users[u])) continue;
+				CallInst *ci = dyn_cast<CallInst>(users[u]);
+				unsigned idx = 0, count = 0;
+				for (unsigned j = 0; ci != 0 && j < ci->getNumArgOperands(); j++) {
+					if (ci->getArgOperand(j) == ptrs[i]) {
+						if (count++ == 0) idx = j;
+					}
+				}
+				if (ci == 0 || count > 1 || (count == 1 && ci->getCalledValue() == ptrs[i])) {
+					escapes = true;
+					continue;
+				}
 
-			BB = Builder.GetInsertBlock();
-			if (BB->getTerminator() == 0) {
-				if (f->getReturnType() == Type::getVoidTy(getGlobalContext())) {
-					Builder.CreateRetVoid();
+				vector<Value*> args;
+				CallInst *nci = 0;
+				if (ci->getCalledValue() == ptrs[i]) {
+					args.push_back(env);
+					for (unsigned j = 0; j < ci->getNumArgOperands(); j++) args.push_back(ci->getArgOperand(j));
+					nci = CallInst::Create(lam, args, "", ci);
 				} else {
-					fd->Val->Tag.Throw("Function '" + it->first + "' lacks a return statement.");
+					Function *callee = ci->getCalledFunction();
+					Function *spec = (callee != 0 && !callee->isDeclaration() ? closureSpecialization(callee, idx, lam) : 0);
+					if (spec == 0) {
+						escapes = true;
+						continue;
+					}
+					for (unsigned j = 0; j < ci->getNumArgOperands(); j++) args.push_back(j == idx ? env : ci->getArgOperand(j));
+					nci = CallInst::Create(spec, args, "", ci);
 				}
+				nci->takeName(ci);
+				ci->replaceAllUsesWith(nci);
+				ci->eraseFromParent();
+				changed = true;
 			}
+		}
 
-			DBGC(f->dump())
-
-			if (verifyFunction(*f)) {
-				fd->Val->Tag.Throw("Error in function '" + it->first + "'...");
+		if (!escapes) {
+			// the environment, on the stack (typed like the lambda reads it, when that is known)
+			Type *envTy = 0;
+			for (Value::use_iterator ui = env->use_begin(); ui != env->use_end(); ui++) {
+				if (BitCastInst *bc = dyn_cast<BitCastInst>(*ui)) envTy = cast<PointerType>(bc->getType())->getElementType();
 			}
-			FPM.run(*f);
+			if (envTy == 0) {
+				uint64_t size = cast<ConstantInt>(block->getArgOperand(0))->getZExtValue();
+				envTy = ArrayType::get(Type::getInt8Ty(getGlobalContext()), size);
+			}
+			IRBuilder<> tmp(&f->getEntryBlock(), f->getEntryBlock().begin());
+			AllocaInst *a = tmp.CreateAlloca(envTy, 0, "env");
+			a->setAlignment(CLOSURE_ENV);
+			env->replaceAllUsesWith(new BitCastInst(a, env->getType(), "env", env));
+
+			init->eraseFromParent();
+			for (unsigned i = ptrs.size(); i-- > 0; ) ptrs[i]->eraseFromParent();
+			if (code != 0) code->eraseFromParent();
+			env->eraseFromParent();
+			block->eraseFromParent();
 		}
+		directCalls(f, lam);
+		changed = true;
 	}
 
-	if (pkg->InitFunction == 0) {
-		throw new InternalError("Internal error #1512351, sorry.");
+	if (changed) FPM.run(*f);
+}
+
+// Copy of f that takes the environment of lam in place of argument number idx, a
+// closure of lam. Calls through the argument call lam directly, recursive calls
+// that pass it on call the copy. Returns 0 when f does anything else with it, or
+// when f is too large or has too many copies (the same budget as specialization).
+Function *Generator::closureSpecialization(Function *f, unsigned idx, Function *lam) {
+	SpecKey key(f, make_pair(idx, lam));
+	if (ClosureSpecs.count(key) != 0) return ClosureSpecs[key];
+	ClosureSpecs[key] = 0;
+
+	Function::arg_iterator ai = f->arg_begin();
+	for (unsigned i = 0; i < idx; i++) ai++;
+	Argument *a = ai;
+	if (f->isVarArg() || Gens.count(f) != 0 || SpecCount[f] >= SPEC_MAX_COPIES ||
+			instrCount(f) > SPEC_MAX_SIZE || a->use_empty()) return 0;
+	for (Value::use_iterator ui = a->use_begin(); ui != a->use_end(); ui++) {
+		CallInst *ci = dyn_cast<CallInst>(*ui);
+		if (ci == 0) return 0;
+		for (unsigned j = 0; j < ci->getNumArgOperands(); j++) {
+			if (ci->getArgOperand(j) == a && !(ci->getCalledFunction() == f && j == idx)) return 0;
+		}
 	}
+
+	// in the copy, the argument is first a marker, that the calls are found by
+	FunctionType *ft = f->getFunctionType();
+	vector<Type*> params(ft->param_begin(), ft->param_end());
+	params[idx] = Type::getInt8PtrTy(getGlobalContext());
+	Function *spec = Function::Create(FunctionType::get(ft->getReturnType(), params, false), GlobalValue::InternalLinkage,
+		f->getName() + "." + lam->getName(), TheModule);
+	Constant *marker = ConstantExpr::getBitCast(lam, a->getType());
+	ValueToValueMapTy vmap;
+	Argument *envArg = 0;
+	Function::arg_iterator si = spec->arg_begin();
+	for (Function::arg_iterator fi = f->arg_begin(); fi != f->arg_end(); fi++, si++) {
+		Argument *fa = fi, *sa = si;
+		sa->setName(fa->getName());
+		if (fa == a) {
+			envArg = sa;
+			sa->setName("env");
+			vmap[fa] = marker;
+		} else {
+			vmap[fa] = sa;
+		}
+	}
+	SmallVector<ReturnInst*, 4> returns;
+	CloneFunctionInto(spec, f, vmap, false, returns);
+	spec->setLinkage(GlobalValue::InternalLinkage);
+	SpecCount[f]++;
+	ClosureSpecs[key] = spec;
+
+	vector<CallInst*> calls;
+	for (inst_iterator i = inst_begin(spec); i != inst_end(spec); i++) {
+		CallInst *ci = dyn_cast<CallInst>(&*i);
+		if (ci == 0) continue;
+		if (ci->getCalledValue() == marker || (ci->getCalledFunction() == f && ci->getArgOperand(idx) == marker)) {
+			calls.push_back(ci);
+		}
+	}
+	for (unsigned c = 0; c < calls.size(); c++) {
+		CallInst *ci = calls[c];
+		vector<Value*> args;
+		CallInst *nci = 0;
+		if (ci->getCalledValue() == marker) {
+			args.push_back(envArg);
+			for (unsigned j = 0; j < ci->getNumArgOperands(); j++) args.push_back(ci->getArgOperand(j));
+			nci = CallInst::Create(lam, args, "", ci);
+		} else {
+			for (unsigned j = 0; j < ci->getNumArgOperands(); j++) args.push_back(j == idx ? envArg : ci->getArgOperand(j));
+			nci = CallInst::Create(spec, args, "", ci);
+		}
+		nci->takeName(ci);
+		ci->replaceAllUsesWith(nci);
+		ci->eraseFromParent();
+	}
+
+	directCalls(spec, lam);
+	FPM.run(*spec);
+	SpecScanned.insert(spec);
+	SpecWork.push_back(spec);
+	return spec;
 }
 
-void Generator::init(Package *package) {
-	if (package->Complete == false) {
-		throw new InternalError("Internal error #1513542, sorry.");
+// Build the const functions of a package before the rest of the package, so that
+// they can be run at compile time when folding the package (see typecheck/fold.cpp).
+// Const functions can only call other const functions, so they are all built at once.
+void Generator::buildConsts(Package *pkg) {
+	if (pkg->ConstsBuilt) return;
+	pkg->ConstsBuilt = true;
+
+	for (unsigned i = 0; i < pkg->SymbolDefOrder.size(); i++) {
+		Symbol *s = pkg->SymbolDefOrder[i];
+		if (s->Def->Const && dynamic_cast<FuncDefAST*>(s->Def) != 0) s->Def->fold();
+	}
+	for (unsigned i = 0; i < pkg->SymbolDefOrder.size(); i++) {
+		Symbol *s = pkg->SymbolDefOrder[i];
+		if (s->Def->Const && dynamic_cast<FuncDefAST*>(s->Def) != 0) buildFunction(pkg, s);
+	}
+}
+
+#define EVAL_TIMEOUT_MS 2000
+
+// Run a function at compile time. It runs in a child process, so that a const
+// function that fails (division by zero, bounds check, recursion too deep) or that
+// does not return within EVAL_TIMEOUT_MS cannot bring the compiler down : the result
+// is false then, with the reason in 'why'.
+bool Generator::evalCall(Function *f, const vector<GenericValue> &args, GenericValue &result, string &why) {
+	struct Result {
+		uint64_t Int;
+		float Float;
+		double Double;
+	} r;
+
+	ExecEng->getPointerToFunction(f);		// compiled once here, rather than in every child
+	int fds[2];
+	if (pipe(fds) != 0) {
+		why = "no pipe to the process running it";
+		return false;
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		why = "no process to run it";
+		return false;
 	}
-	if (package->InitFunction == 0) return;
+	if (pid == 0) {
+		close(fds[0]);
+		GenericValue g = ExecEng->runFunction(f, args);
+		r.Int = g.IntVal.getZExtValue();
+		r.Float = g.FloatVal;
+		r.Double = g.DoubleVal;
+		_exit(write(fds[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+	}
+
+	close(fds[1]);
+	struct pollfd p = { fds[0], POLLIN, 0 };
+	int ready;
+	do {
+		ready = poll(&p, 1, EVAL_TIMEOUT_MS);
+	} while (ready < 0 && errno == EINTR);
+	ssize_t n = (ready > 0 ? read(fds[0], &r, sizeof(r)) : -1);
+	close(fds[0]);
+	if (ready <= 0) kill(pid, SIGKILL);
+	int status = 0;
+	waitpid(pid, &status, 0);
 
-	CallsInMain.push_back(package->InitFunction);
+	if (ready <= 0) {
+		stringstream out;
+		out << "it did not return within " << EVAL_TIMEOUT_MS << " ms";
+		why = out.str();
+		return false;
+	}
+	if (n != sizeof(r)) {
+		why = (WIFSIGNALED(status) ? string("it failed (") + strsignal(WTERMSIG(status)) + ")" : string("it failed"));
+		return false;
+	}
+	Type *rt = f->getReturnType();
+	result.IntVal = APInt(rt->isIntegerTy() ? cast<IntegerType>(rt)->getBitWidth() : 64, r.Int);
+	result.FloatVal = r.Float;
+	result.DoubleVal = r.Double;
+	return true;
 }
 
-// === Helper function for main ===
-void Generator::main(Package *package) {
+// Packages must be initialized after everything they import
+void Generator::initOrder(Package *package, vector<Package*> &order) {
+	if (find(order.begin(), order.end(), package) != order.end()) return;
+	for (map<string, Package*>::iterator it = package->Imports.begin(); it != package->Imports.end(); it++) {
+		initOrder(it->second, order);
+	}
+	order.push_back(package);
+}
+
+// Build the entry point of a program : initialize all packages it depends on, then call _main.
+// Integer results are widened to INT so that callers only have to know about INT, FLOAT and void.
+Function *Generator::entry(Package *package) {
 	if (package->Complete == false) {
 		throw new InternalError("Internal error #2652462, sorry.");
 	}
@@ -152,44 +1015,302 @@ void Generator::main(Package *package) {
 		throw new PIFError("invalid _main function in '" + package->Name + "'.");
 	}
 
-	CallsInMain.push_back(f);
+	string entry_name = "_entry." + package->Name;
+	if (Function *e = TheModule->getFunction(entry_name)) return e;
+
+	Type *retT = f->getReturnType();
+	if (retT->isIntegerTy()) retT = INTTYPE->getTy();
+	if (retT->isFloatTy()) retT = FLOATTYPE->getTy();
 
 	vector<Type*> _args;
-	FunctionType *main_ft = FunctionType::get(f->getReturnType(), _args, false);
-	Function *main_f = Function::Create(main_ft, Function::ExternalLinkage, "main", TheModule);
-	if (main_f->getName() != "main") {
-		throw new InternalError("Something is probably wrong with main function, sorry.");
-	}
-	
-	Value *retval;
-	BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "entry", main_f);
+	FunctionType *entry_ft = FunctionType::get(retT, _args, false);
+	Function *entry_f = Function::Create(entry_ft, Function::ExternalLinkage, entry_name, TheModule);
+
+	BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "entry", entry_f);
 	Builder.SetInsertPoint(BB);
+
+	vector<Package*> order;
+	initOrder(package, order);
 	std::vector<Value*> _args_v;
-	for (unsigned i = 0; i < CallsInMain.size(); i++) {
-		if (CallsInMain[i]->getReturnType() == Type::getVoidTy(getGlobalContext())) {
-			retval = 0;
-			Builder.CreateCall(CallsInMain[i], _args_v);
-		} else {
-			retval = Builder.CreateCall(CallsInMain[i], _args_v);
-		}
+	for (unsigned i = 0; i < order.size(); i++) {
+		Function *init = order[i]->InitFunction;
+		if (init == 0) continue;
+		// nothing to do when everything is statically initialized (_init is just 'ret void')
+		if (init->size() == 1 && init->front().size() == 1) continue;
+		Builder.CreateCall(init, _args_v);
 	}
-	if (retval != 0) {
-		Builder.CreateRet(retval);
-	} else {
+
+	if (f->getReturnType() == Type::getVoidTy(getGlobalContext())) {
+		Builder.CreateCall(f, _args_v);
 		Builder.CreateRetVoid();
+	} else {
+		Value *retval = Builder.CreateCall(f, _args_v, "mainret");
+		if (retval->getType()->isFloatTy()) {
+			retval = Builder.CreateFPExt(retval, retT, "mainretext");
+		} else if (retval->getType() != retT) {
+			retval = Builder.CreateIntCast(retval, retT, (cast<IntegerType>(retval->getType())->getBitWidth() > 1), "mainretext");
+		}
+		Builder.CreateRet(retval);
 	}
 
-	DBGC(main_f->dump())
+	DBGC(entry_f->dump())
 
-	if (verifyFunction(*main_f)) {
-		throw new InternalError("Incorrect main function...");
+	if (verifyFunction(*entry_f)) {
+		throw new InternalError("Incorrect entry function for '" + package->Name + "'...");
 	}
-	FPM.run(*main_f);
+	FPM.run(*entry_f);
+
+	return entry_f;
+}
+
+// === Helper function for main ===
+void Generator::main(Package *package) {
+	Function *entry_f = entry(package);
 
 	// Call that function
-	void *FPtr = ExecEng->getPointerToFunction(main_f);
+	void *FPtr = ExecEng->getPointerToFunction(entry_f);
 	void (*FP)() = (void (*)())(intptr_t)FPtr;
 	FP();
+}
+
+// Address of a package global. When globals are isolated, and always for threadlocal
+// globals, each thread works on its own copy of the global, obtained from the
+// runtime (see runtime/tls.cpp) by the number given to the global here.
+Value *Generator::globalAddr(Value *v) {
+	GlobalVariable *gv = dyn_cast<GlobalVariable>(v);
+	if (gv == 0 || (!IsolateGlobals && ThreadLocals.count(gv) == 0)) return v;
+
+	Type *i8p = Type::getInt8PtrTy(getGlobalContext());
+	Type *ity = INTTYPE->getTy();
+	vector<Type*> argsTy;
+	argsTy.push_back(ity);
+	argsTy.push_back(i8p);
+	argsTy.push_back(ity);
+	Constant *tlsf = TheModule->getOrInsertFunction("pif_tls_addr", FunctionType::get(i8p, argsTy, false));
+	if (Function *f = dyn_cast<Function>(tlsf)) {
+		// always the same address for a thread, but the first call copies the master copy :
+		// calls can only be merged and moved out of loops where memory is not written
+		f->setOnlyReadsMemory();
+		f->setDoesNotThrow();
+	}
+
+	if (CopyIds.count(gv) == 0) {
+		INT id = CopyIds.size();
+		CopyIds[gv] = id;
+	}
+	Type *gty = gv->getType()->getElementType();
+	Value *args[3] = {
+		ConstantInt::get(ity, CopyIds[gv]),
+		ConstantExpr::getBitCast(gv, i8p),
+		ConstantInt::get(ity, ExecEng->getTargetData()->getTypeAllocSize(gty)),
+	};
+	Value *p = Builder.CreateCall(tlsf, args, "tlsaddr");
+	return Builder.CreateBitCast(p, gv->getType(), gv->getName() + ".tls");
+}
+
+// Address of a lazy global, computing its value first if that was not done yet.
+// The fast path is a load and a branch that is expected to be taken ; the slow
+// path calls the runtime, that makes sure the value is computed exactly once.
+Value *Generator::lazyAddr(Symbol *s) {
+	LLVMContext &C = getGlobalContext();
+	Function *fun = Builder.GetInsertBlock()->getParent();
+	BasicBlock *InitBB = BasicBlock::Create(C, "lazyinit", fun);
+	BasicBlock *ContBB = BasicBlock::Create(C, "lazycont", fun);
+
+	Value *guard = globalAddr(s->LazyGuard);
+	LoadInst *state = Builder.CreateLoad(guard, "lazystate");
+	state->setAtomic(Acquire);
+	state->setAlignment(4);
+	Value *ok = Builder.CreateICmpEQ(state, ConstantInt::get(Type::getInt32Ty(C), 1), "lazyok");
+	Function *expect = Intrinsic::getDeclaration(TheModule, Intrinsic::expect, Type::getInt1Ty(C));
+	ok = Builder.CreateCall2(expect, ok, ConstantInt::getTrue(C), "lazyok");
+	Builder.CreateCondBr(ok, ContBB, InitBB);
+
+	Builder.SetInsertPoint(InitBB);
+	Type *argsTy[2] = { Type::getInt32PtrTy(C), s->LazyInit->getType() };
+	Constant *initf = TheModule->getOrInsertFunction("pif_lazy_init",
+		FunctionType::get(Type::getVoidTy(C), argsTy, false));
+	Builder.CreateCall2(initf, guard, s->LazyInit);
+	Builder.CreateBr(ContBB);
+
+	Builder.SetInsertPoint(ContBB);
+	return globalAddr(s->llvmVal);
+}
+
+// Allocate a temporary in the entry block of the current function, so that it
+// is allocated only once even when used in a loop (and mem2reg can promote it)
+AllocaInst *Generator::entryAlloca(Type *t, const string &name) {
+	Function *fun = Builder.GetInsertBlock()->getParent();
+	IRBuilder<> tmp(&fun->getEntryBlock(), fun->getEntryBlock().begin());
+	return tmp.CreateAlloca(t, 0, name);
+}
+
+// Call a PIF function of type ft. Records too large for registers are passed by
+// pointer to a copy, and returned in memory given by the caller as a hidden first
+// argument : dest when it is given, a temporary otherwise. When dest is given, the
+// result is stored there and 0 is returned.
+Value *Generator::emitCall(Value *callee, FuncTypeAST *ft, const vector<Value*> &args, Value *dest) {
+	vector<Value*> argsV;
+	Value *slot = 0;
+	if (ft->returnsByPointer()) {
+		slot = (dest != 0 ? dest : entryAlloca(ft->ReturnType->getTy(), "result"));
+		argsV.push_back(slot);
+	}
+	for (unsigned i = 0; i < args.size(); i++) {
+		if (StructTypeAST::byPointer(ft->Args[i]->ArgType)) {
+			AllocaInst *copy = entryAlloca(args[i]->getType(), ft->Args[i]->Name);
+			Builder.CreateStore(args[i], copy);
+			argsV.push_back(copy);
+		} else {
+			argsV.push_back(args[i]);
+		}
+	}
+
+	if (Function *fn = dyn_cast<Function>(callee)) {
+		if (Value *v = mathCall(fn, argsV)) {
+			if (dest == 0) return v;
+			Builder.CreateStore(v, dest);
+			return 0;
+		}
+	}
+
+	if (slot != 0) {
+		Builder.CreateCall(callee, argsV);
+		if (dest != 0) return 0;
+		return Builder.CreateLoad(slot, "calltmp");
+	}
+	if (ft->ReturnType == VOIDTYPE) {
+		Builder.CreateCall(callee, argsV);
+		return 0;
+	}
+	Value *v = Builder.CreateCall(callee, argsV, "calltmp");
+	if (dest == 0) return v;
+	Builder.CreateStore(v, dest);
+	return 0;
+}
+
+// Functions of the C math library, bound with 'extern' (see package pif.math). They
+// have no side effect that PIF can see (errno is never read), so they are declared
+// readnone : LLVM folds their calls with constant arguments and hoists them out of
+// loops. The simplest ones are not even called (see mathCall).
+static const char *mathFunctions[] = {
+	"sqrt", "sin", "cos", "tan", "exp", "log", "pow", "floor", "ceil", "fabs", "fma", "fmin", "fmax", 0
+};
+
+bool Generator::isMathFunction(Function *f) {
+	string name = f->getName().str();
+	FunctionType *ft = f->getFunctionType();
+	Type *t = ft->getReturnType();
+	if (!t->isDoubleTy() && !t->isFloatTy()) return false;
+	for (unsigned i = 0; i < ft->getNumParams(); i++) {
+		if (ft->getParamType(i) != t) return false;
+	}
+	if (t->isFloatTy()) {		// sqrtf, sinf...
+		if (name.empty() || name[name.size() - 1] != 'f') return false;
+		name = name.substr(0, name.size() - 1);
+	}
+	for (unsigned i = 0; mathFunctions[i] != 0; i++) {
+		if (name == mathFunctions[i]) return true;
+	}
+	return false;
+}
+
+// A direct call to a math function, as instructions or intrinsics when there is a
+// single instruction for it. Returns 0 for those that stay calls.
+Value *Generator::mathCall(Function *f, const vector<Value*> &args) {
+	if (!f->isDeclaration() || !isMathFunction(f)) return 0;
+	string name = f->getName().str();
+	Type *t = f->getReturnType();
+	if (t->isFloatTy()) name = name.substr(0, name.size() - 1);
+
+	Type *types[1] = { t };
+	if (name == "sqrt" && args.size() == 1) {
+		return Builder.CreateCall(Intrinsic::getDeclaration(TheModule, Intrinsic::sqrt, types), args[0], "sqrttmp");
+	}
+	if (name == "fma" && args.size() == 3) {
+		return Builder.CreateCall3(Intrinsic::getDeclaration(TheModule, Intrinsic::fma, types), args[0], args[1], args[2], "fmatmp");
+	}
+	if (name == "fabs" && args.size() == 1) {
+		// clear the sign bit
+		Type *it = IntegerType::get(getGlobalContext(), t->getPrimitiveSizeInBits());
+		Value *bits = Builder.CreateBitCast(args[0], it, "bits");
+		bits = Builder.CreateAnd(bits, ConstantInt::get(getGlobalContext(), APInt::getSignedMaxValue(it->getPrimitiveSizeInBits())));
+		return Builder.CreateBitCast(bits, t, "fabstmp");
+	}
+	if ((name == "fmin" || name == "fmax") && args.size() == 2) {
+		// a NaN argument gives the other one, like in C
+		Value *keepA = (name == "fmin" ? Builder.CreateFCmpOLT(args[0], args[1], "cmptmp") : Builder.CreateFCmpOGT(args[0], args[1], "cmptmp"));
+		keepA = Builder.CreateOr(keepA, Builder.CreateFCmpUNO(args[1], args[1], "isnan"));
+		return Builder.CreateSelect(keepA, args[0], args[1], name + "tmp");
+	}
+	return 0;
+}
+
+// Check that 0 <= idx < len (idx <= len when inclusive, for slice bounds).
+// When both are known at compile time, the check is done now. Otherwise it is a
+// single unsigned comparison with the length, that the loop passes remove when
+// the loop condition already proves the index is in range.
+void Generator::boundsCheck(Value *idx, Value *len, bool inclusive, const FTag &tag) {
+	LLVMContext &C = getGlobalContext();
+
+	ConstantInt *ci = dyn_cast<ConstantInt>(idx), *cl = dyn_cast<ConstantInt>(len);
+	if (ci != 0 && cl != 0) {
+		INT i = ci->getSExtValue(), l = cl->getSExtValue();
+		if (i < 0 || i > l || (i == l && !inclusive)) {
+			stringstream o;
+			o << "Error: index " << i << " out of bounds (length " << l << ").";
+			tag.Throw(o.str());
+		}
+		return;
+	}
+	if (inductionInBounds(idx, len, inclusive)) return;
+
+	Function *fun = Builder.GetInsertBlock()->getParent();
+	BasicBlock *FailBB = BasicBlock::Create(C, "outofbounds", fun);
+	BasicBlock *ContBB = BasicBlock::Create(C, "inbounds", fun);
+
+	Value *ok = (inclusive ? Builder.CreateICmpULE(idx, len, "boundsok") : Builder.CreateICmpULT(idx, len, "boundsok"));
+	Function *expect = Intrinsic::getDeclaration(TheModule, Intrinsic::expect, Type::getInt1Ty(C));
+	ok = Builder.CreateCall2(expect, ok, ConstantInt::getTrue(C), "boundsok");
+	Builder.CreateCondBr(ok, ContBB, FailBB);
+
+	Builder.SetInsertPoint(FailBB);
+	Type *ity = INTTYPE->getTy();
+	Type *argsTy[2] = { ity, ity };
+	Constant *failf = TheModule->getOrInsertFunction("pif_bounds_fail",
+		FunctionType::get(Type::getVoidTy(C), argsTy, false));
+	if (Function *f = dyn_cast<Function>(failf)) f->setDoesNotReturn();
+	Builder.CreateCall2(failf, idx, len);
+	Builder.CreateUnreachable();
+
+	Builder.SetInsertPoint(ContBB);
+}
+
+// The same value, also when it is read again from the same aggregate : each access
+// to a slice extracts its length anew.
+static bool sameValue(Value *a, Value *b) {
+	if (a == b) return true;
+	ExtractValueInst *ea = dyn_cast<ExtractValueInst>(a), *eb = dyn_cast<ExtractValueInst>(b);
+	return ea != 0 && eb != 0 && ea->getAggregateOperand() == eb->getAggregateOperand()
+		&& ea->getIndices() == eb->getIndices();
+}
+
+// An induction variable of a counted loop is in bounds when its whole range is :
+// either the loop goes up to the length itself, or both are known constants.
+// Only loops with a constant step have a range (see ForAST::Codegen).
+bool Generator::inductionInBounds(Value *idx, Value *len, bool inclusive) {
+	if (Inductions.count(idx) == 0) return false;
+	InductionRange &r = Inductions[idx];
+
+	// values taken : [From, To) going up, (To, From] going down
+	Value *lo = (r.Down ? r.To : r.From), *hi = (r.Down ? r.From : r.To);
+	ConstantInt *clo = dyn_cast<ConstantInt>(lo), *chi = dyn_cast<ConstantInt>(hi), *cl = dyn_cast<ConstantInt>(len);
+	if (clo == 0) return false;
+	INT min = clo->getSExtValue() + (r.Down ? 1 : 0);
+	if (min < 0) return false;
 
-	CallsInMain.clear();
+	if (!r.Down && sameValue(hi, len)) return true;
+	if (chi == 0 || cl == 0) return false;
+	INT max = chi->getSExtValue() - (r.Down ? 0 : 1);
+	return max < cl->getSExtValue() || (inclusive && max == cl->getSExtValue());
 }
@@ -8,13 +8,19 @@
 #include <llvm/Target/TargetData.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/JIT.h>
 #include <llvm/LLVMContext.h>
+#include <llvm/Intrinsics.h>
 #include <llvm/Analysis/Verifier.h>
 #include <llvm/Analysis/Passes.h>
 #include <llvm/Support/TargetSelect.h>
 
 #include <vector>
+#include <map>
+#include <set>
+
+#define CLOSURE_ENV 64		// offset of the environment in the block of a closure (see FuncExprAST::Codegen)
 
 class Generator {
 	public:
@@ -24,13 +30,82 @@ class Generator {
 
 	llvm::ExecutionEngine *ExecEng;
 
-	std::vector<llvm::Function*> CallsInMain;
+	bool IsolateGlobals;		// give every thread its own copy of package globals (batch mode)
+	bool FastMath;				// -ffast-math : fast math in all packages (see BinaryExprAST::Codegen)
+	std::set<llvm::GlobalVariable*> ThreadLocals;		// globals with a copy per thread anyway
+	std::map<llvm::GlobalVariable*, INT> CopyIds;		// globals with per-thread copies, numbered for the runtime
+
+	// Induction variables of the counted loops being generated, with their range,
+	// so that bounds checks they make useless are not generated at all
+	struct InductionRange {
+		llvm::Value *From, *To;
+		bool Down;
+	};
+	std::map<llvm::Value*, InductionRange> Inductions;
+
+	// Generators (see buildGenerator) : resume function and frame type of every
+	// 'gen func', by the function of its symbol
+	struct GenInfo {
+		llvm::Function *Resume;
+		llvm::StructType *Frame;		// 0 while the generator is being built
+	};
+	std::map<llvm::Function*, GenInfo> Gens;
+	// generator being built : its frame, and where it resumes after each yield
+	llvm::Value *GenFrame;
+	llvm::SwitchInst *GenResume;
+	unsigned GenStates;
+	// where the function being built returns its result, when it is a large record
+	llvm::Value *RetSlot;
+
+	// Copies of functions specialized on a constant function argument (see specialize) :
+	// by function, argument number and argument
+	typedef std::pair<llvm::Function*, std::pair<unsigned, llvm::Function*> > SpecKey;
+	std::map<SpecKey, llvm::Function*> Specs;
+	std::map<llvm::Function*, unsigned> SpecCount;
+	std::set<llvm::Function*> SpecScanned;
+	std::vector<llvm::Function*> SpecWork;
+	// copies of functions that take the environment of a lambda in place of a closure
+	// of it (see closureSpecialization), by function, argument number and lambda
+	std::map<SpecKey, llvm::Function*> ClosureSpecs;
 
 	Generator();
 
+	void declare(Package *package);
 	void build(Package *package);
-	void init(Package *package);
+	void declareFunction(Package *package, Symbol *sym);
+	void buildFunction(Package *package, Symbol *sym);
+	void buildConsts(Package *package);
+	void specialize();
+	bool evalCall(llvm::Function *f, const std::vector<llvm::GenericValue> &args, llvm::GenericValue &result, std::string &why);
+
+	llvm::Function *entry(Package *package);
 	void main(Package *package);
+
+	llvm::Value *globalAddr(llvm::Value *v);
+	llvm::Value *lazyAddr(Symbol *s);
+
+	llvm::AllocaInst *entryAlloca(llvm::Type *t, const std::string &name);
+	llvm::Value *emitCall(llvm::Value *callee, FuncTypeAST *ft, const std::vector<llvm::Value*> &args, llvm::Value *dest = 0);
+	static bool isMathFunction(llvm::Function *f);
+	llvm::Value *mathCall(llvm::Function *f, const std::vector<llvm::Value*> &args);
+	void boundsCheck(llvm::Value *idx, llvm::Value *len, bool inclusive, const FTag &tag);
+
+	static llvm::StructType *genHeader(llvm::Type *yieldTy);
+	GenInfo *genInfo(Package *package, Symbol *sym);
+	void genInit(llvm::Function *f, llvm::Value *frame, const std::vector<llvm::Value*> &args);
+	void genYield(llvm::Value *v);
+	llvm::Value *genReturn();
+
+	private:
+	void buildGenerator(Package *package, Symbol *sym);
+	void buildMemo(FuncDefAST *fd, llvm::Function *f, llvm::Function *body);
+	void specializeCalls(llvm::Function *f);
+	llvm::Function *specialization(llvm::Function *f, unsigned idx, llvm::Function *g);
+	void directCalls(llvm::Function *f, llvm::Function *g);
+	void closures(llvm::Function *f);
+	llvm::Function *closureSpecialization(llvm::Function *f, unsigned idx, llvm::Function *lam);
+	bool inductionInBounds(llvm::Value *idx, llvm::Value *len, bool inclusive);
+	void initOrder(Package *package, std::vector<Package*> &order);
 };
 
 
@@ -8,24 +8,33 @@ using namespace std;
 #define CHECK_VOID(v) if (v == 0) throw new InternalError("null (void) value somewhere bad (statement used as expression)");
 
 Value *BoolExprAST::Codegen() {
-	return ConstantInt::get(getGlobalContext(), APInt(1, (Val ? 1 : 0), false));
+	return constCodegen();
 }
 
 Value *IntExprAST::Codegen() {
-	return ConstantInt::get(getGlobalContext(), APInt(INTSIZE, Val, IType->Signed));
+	return constCodegen();
 }
 
 Value *FloatExprAST::Codegen() {
-	return ConstantFP::get(getGlobalContext(), APFloat(Val));
+	return constCodegen();
 }
 
 Value *VarExprAST::Codegen() {
 	if (Sym == 0) throw new InternalError("Type checking didn't go here, that's bad.");
-	if (IsGlobalConst) return Ctx->Gen->Builder.CreateLoad(Sym->llvmVal, "tmpload");
-	return Sym->llvmVal;
+	Value *v = (Sym->LazyInit != 0 ? Ctx->Gen->lazyAddr(Sym) : Ctx->Gen->globalAddr(Sym->llvmVal));
+	if (IsGlobalConst) return Ctx->Gen->Builder.CreateLoad(v, "tmpload");
+	return v;
+}
+
+// Address of a global constant, for using it in place instead of loading all of it
+Value *VarExprAST::constAddr() {
+	if (Sym == 0 || !IsGlobalConst) return 0;
+	return (Sym->LazyInit != 0 ? Ctx->Gen->lazyAddr(Sym) : Ctx->Gen->globalAddr(Sym->llvmVal));
 }
 
 Value *DerefExprAST::Codegen() {
+	IndexExprAST *ie = dynamic_cast<IndexExprAST*>(Val);
+	if (ie != 0 && ie->inSoA()) return ie->soaLoad();
 	Value *v = Val->Codegen();
 	CHECK_VOID(v)
 	return Ctx->Gen->Builder.CreateLoad(v, "tmpderef");
@@ -33,9 +42,11 @@ Value *DerefExprAST::Codegen() {
 
 Value *UnaryExprAST::Codegen() {
 	Value *v = Expr->Codegen();
+	TypeAST *elemType = Expr->type(Ctx);
+	if (VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(elemType)) elemType = vt->ElemType;
 
 	if (Op == "-") {
-		if (Expr->type(Ctx) == FLOATTYPE) {
+		if (BaseTypeAST::isFloat(elemType) != 0) {
 			return Ctx->Gen->Builder.CreateFNeg(v, "negtmp");
 		} else {
 			return Ctx->Gen->Builder.CreateNeg(v, "negtmp");
@@ -47,10 +58,45 @@ Value *UnaryExprAST::Codegen() {
 	}
 }
 
+// Fast math : float operations rewritten as if they were exact, with no NaN nor
+// infinity. LLVM 3.0 has no fast-math flags on instructions, so this is done here :
+// - a division by a constant is a multiplication by its inverse ;
+// - constants in chains of + or * are combined : (x + 1) + 2 is x + 3, and x - c is x + -c ;
+// - x - x and x * 0 are 0.
+// Returns 0 when nothing can be done.
+static Value *fastFloatOp(IRBuilder<> &builder, const string &op, Value *L, Value *R) {
+	if ((op == "+" || op == "*") && isa<Constant>(L) && !isa<Constant>(R)) swap(L, R);
+	Constant *c = dyn_cast<Constant>(R);
+
+	if (op == "/" && c != 0 && !c->isNullValue()) {
+		return builder.CreateFMul(L, ConstantExpr::getFDiv(ConstantFP::get(R->getType(), 1.0), c), "divtmp");
+	}
+	if (op == "-" && L == R) return Constant::getNullValue(L->getType());
+	if (op == "-" && c != 0) return fastFloatOp(builder, "+", L, ConstantExpr::getFNeg(c));
+	if (op == "*" && c != 0 && c->isNullValue()) return c;
+	if ((op == "+" || op == "*") && c != 0) {
+		Instruction::BinaryOps opc = (op == "+" ? Instruction::FAdd : Instruction::FMul);
+		BinaryOperator *lb = dyn_cast<BinaryOperator>(L);
+		if (lb != 0 && lb->getOpcode() == opc && isa<Constant>(lb->getOperand(1))) {
+			Constant *both = ConstantExpr::get(opc, cast<Constant>(lb->getOperand(1)), c);
+			return builder.CreateBinOp(opc, lb->getOperand(0), both, (op == "+" ? "addtmp" : "multmp"));
+		}
+		return builder.CreateBinOp(opc, L, c, (op == "+" ? "addtmp" : "multmp"));
+	}
+	return 0;
+}
+
 Value *BinaryExprAST::Codegen() {
 	IRBuilder<> &builder = Ctx->Gen->Builder;
 
 	if (Op == "=") {
+		IndexExprAST *ie = dynamic_cast<IndexExprAST*>(LHS);
+		if (ie != 0 && ie->inSoA()) {
+			Value *R = RHS->Codegen();
+			CHECK_VOID(R)
+			ie->soaStore(R);
+			return R;
+		}
 		Value *L = LHS->Codegen();
 		Value *R = RHS->Codegen();
 		CHECK_VOID(L)
@@ -64,14 +110,20 @@ Value *BinaryExprAST::Codegen() {
 		CHECK_VOID(L)
 		CHECK_VOID(R)
 
-		IntTypeAST* li = dynamic_cast<IntTypeAST*>(LHS->type(Ctx)); 
-		IntTypeAST* ri = dynamic_cast<IntTypeAST*>(RHS->type(Ctx)); 
-		BaseTypeAST *lf = dynamic_cast<BaseTypeAST*>(LHS->type(Ctx));
-		lf = (lf != 0 && lf->BaseType == bt_float ? lf : 0);
-		BaseTypeAST *rf = dynamic_cast<BaseTypeAST*>(RHS->type(Ctx));
-		rf = (rf != 0 && rf->BaseType == bt_float ? rf : 0);
+		// vectors : same instructions, on all lanes
+		TypeAST *lt = LHS->type(Ctx), *rt = RHS->type(Ctx);
+		if (VectorTypeAST *lv = dynamic_cast<VectorTypeAST*>(lt)) lt = lv->ElemType;
+		if (VectorTypeAST *rv = dynamic_cast<VectorTypeAST*>(rt)) rt = rv->ElemType;
+
+		IntTypeAST* li = dynamic_cast<IntTypeAST*>(lt); 
+		IntTypeAST* ri = dynamic_cast<IntTypeAST*>(rt); 
+		BaseTypeAST *lf = BaseTypeAST::isFloat(lt);
+		BaseTypeAST *rf = BaseTypeAST::isFloat(rt);
 
 		if (lf != 0 && rf != 0) {
+			if (Ctx->Gen->FastMath || (Ctx->More != 0 && Ctx->More->FastMath)) {
+				if (Value *v = fastFloatOp(builder, Op, L, R)) return v;
+			}
 			if (Op == "+") {
 				return builder.CreateFAdd(L, R, "addtmp");
 			} else if (Op == "-") {
@@ -158,12 +210,31 @@ Value *BinaryExprAST::Codegen() {
 Value *DotMemberExprAST::Codegen() {
 	if (Member == "") {
 		return Obj->Codegen();
+	} else if (Field >= 0) {
+		IndexExprAST *ie = dynamic_cast<IndexExprAST*>(Obj);
+		if (ie != 0 && ie->inSoA()) return ie->soaFieldAddr(Field);
+		Value *rec = Obj->Codegen();
+		CHECK_VOID(rec)
+		if (dynamic_cast<RefTypeAST*>(Obj->type(Ctx)) != 0) {
+			return Ctx->Gen->Builder.CreateStructGEP(rec, Field, Member + "ptr");
+		}
+		return Ctx->Gen->Builder.CreateExtractValue(rec, Field, Member);
+	} else if (Member == "len") {
+		TypeAST *t = Obj->type(Ctx);
+		if (RefTypeAST *rt = dynamic_cast<RefTypeAST*>(t)) t = rt->VType;
+		// the length of an array (or the width of a vector) is part of its type
+		if (ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(t)) return ConstantInt::get(INTTYPE->getTy(), at->Length);
+		if (VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(t)) return ConstantInt::get(INTTYPE->getTy(), vt->Width);
+		Value *s = Obj->Codegen();
+		CHECK_VOID(s)
+		return Ctx->Gen->Builder.CreateExtractValue(s, 1, "len");
 	} else {
 		throw new InternalError("'.' action not implemented.");
 	}
 }
 
 Value *CastExprAST::Codegen() {
+	if (Constant *c = constCodegen()) return c;
 	Value *v = Expr->Codegen();
 
 	if (!NeedCast) {
@@ -175,9 +246,196 @@ Value *CastExprAST::Codegen() {
 	}
 }
 
-Value *CallExprAST::Codegen() {
+Value *StructExprAST::Codegen() {
+	if (Constant *c = constCodegen()) return c;
+
+	Value *v = UndefValue::get(EType->getTy());
+	for (unsigned i = 0; i < Vals.size(); i++) {
+		Value *e = Vals[i]->Codegen();
+		CHECK_VOID(e)
+		v = Ctx->Gen->Builder.CreateInsertValue(v, e, i, "recordtmp");
+	}
+	return v;
+}
+
+Value *ArrayExprAST::Codegen() {
+	if (Constant *c = constCodegen()) return c;
+
+	Value *v = UndefValue::get(EType->getTy());
+	for (unsigned i = 0; i < Elems.size(); i++) {
+		Value *e = Elems[i]->Codegen();
+		CHECK_VOID(e)
+		v = Ctx->Gen->Builder.CreateInsertValue(v, e, i, "arraytmp");
+	}
+	return v;
+}
+
+// Record i of a soa array at arr : its fields, at the same index of each field array
+static Value *soaGather(IRBuilder<> &builder, Value *arr, Value *idx, Type *recTy) {
+	Type *ity = INTTYPE->getTy(), *i32 = Type::getInt32Ty(getGlobalContext());
+	Value *r = UndefValue::get(recTy);
+	for (unsigned f = 0; f < cast<StructType>(recTy)->getNumElements(); f++) {
+		Value *gep[3] = { ConstantInt::get(ity, 0), ConstantInt::get(i32, f), idx };
+		Value *v = builder.CreateLoad(builder.CreateInBoundsGEP(arr, gep, "fieldptr"), "field");
+		r = builder.CreateInsertValue(r, v, f, "elem");
+	}
+	return r;
+}
+
+bool IndexExprAST::inSoA() {
+	RefTypeAST *rt = dynamic_cast<RefTypeAST*>(Obj->type(Ctx));
+	ArrayTypeAST *at = (rt != 0 ? dynamic_cast<ArrayTypeAST*>(rt->VType) : 0);
+	return (at != 0 && at->SoA);
+}
+
+// Address of the soa array and checked index
+Value *IndexExprAST::soaIndex(Value *&arr) {
+	ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(dynamic_cast<RefTypeAST*>(Obj->type(Ctx))->VType);
+	arr = Obj->Codegen();
+	Value *idx = Idx->Codegen();
+	CHECK_VOID(arr)
+	CHECK_VOID(idx)
+	Ctx->Gen->boundsCheck(idx, ConstantInt::get(INTTYPE->getTy(), at->Length), false, Tag);
+	return idx;
+}
+
+Value *IndexExprAST::soaFieldAddr(unsigned field) {
+	Value *arr;
+	Value *idx = soaIndex(arr);
+	Value *gep[3] = { ConstantInt::get(INTTYPE->getTy(), 0), ConstantInt::get(Type::getInt32Ty(getGlobalContext()), field), idx };
+	return Ctx->Gen->Builder.CreateInBoundsGEP(arr, gep, "fieldptr");
+}
+
+Value *IndexExprAST::soaLoad() {
+	Value *arr;
+	Value *idx = soaIndex(arr);
+	return soaGather(Ctx->Gen->Builder, arr, idx, dynamic_cast<RefTypeAST*>(EType)->VType->getTy());
+}
+
+void IndexExprAST::soaStore(Value *v) {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	Value *arr;
+	Value *idx = soaIndex(arr);
+	for (unsigned f = 0; f < cast<StructType>(v->getType())->getNumElements(); f++) {
+		Value *gep[3] = { ConstantInt::get(INTTYPE->getTy(), 0), ConstantInt::get(Type::getInt32Ty(getGlobalContext()), f), idx };
+		builder.CreateStore(builder.CreateExtractValue(v, f, "field"), builder.CreateInBoundsGEP(arr, gep, "fieldptr"));
+	}
+}
+
+Value *IndexExprAST::Codegen() {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	Type *ity = INTTYPE->getTy();
+	TypeAST *t = Obj->type(Ctx);
+
+	if (RefTypeAST *rt = dynamic_cast<RefTypeAST*>(t)) {
+		// array or vector in memory : address of the element
+		INT len;
+		if (ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(rt->VType)) {
+			if (at->SoA) Tag.Throw("The records of a soa array have no address, only their fields do.");
+			len = at->Length;
+		} else if (VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(rt->VType)) {
+			len = vt->Width;
+		} else {
+			throw new InternalError("Indexing a reference to something that is not an array.");
+		}
+		Value *arr = Obj->Codegen();
+		Value *idx = Idx->Codegen();
+		CHECK_VOID(arr)
+		CHECK_VOID(idx)
+		Ctx->Gen->boundsCheck(idx, ConstantInt::get(ity, len), false, Tag);
+		Value *gep[2] = { ConstantInt::get(ity, 0), idx };
+		return builder.CreateInBoundsGEP(arr, gep, "elemptr");
+	} else if (VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(t)) {
+		// vector value : lane
+		Value *v = Obj->Codegen();
+		Value *idx = Idx->Codegen();
+		CHECK_VOID(v)
+		CHECK_VOID(idx)
+		Ctx->Gen->boundsCheck(idx, ConstantInt::get(ity, vt->Width), false, Tag);
+		return builder.CreateExtractElement(v, idx, "lane");
+	} else if (ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(t)) {
+		// array value : value of the element
+		Value *arr = 0;
+		if (VarExprAST *v = dynamic_cast<VarExprAST*>(Obj)) arr = v->constAddr();
+		Value *val = (arr == 0 ? Obj->Codegen() : 0);
+		Value *idx = Idx->Codegen();
+		CHECK_VOID(idx)
+		Ctx->Gen->boundsCheck(idx, ConstantInt::get(ity, at->Length), false, Tag);
+		if (arr == 0) {
+			CHECK_VOID(val)
+			if (ConstantInt *ci = dyn_cast<ConstantInt>(idx)) {
+				unsigned i = ci->getZExtValue();
+				if (!at->SoA) return builder.CreateExtractValue(val, i, "elem");
+				Value *r = UndefValue::get(at->ElemType->getTy());
+				for (unsigned f = 0; f < cast<StructType>(val->getType())->getNumElements(); f++) {
+					unsigned fi[2] = { f, i };
+					r = builder.CreateInsertValue(r, builder.CreateExtractValue(val, fi, "field"), f, "elem");
+				}
+				return r;
+			}
+			arr = Ctx->Gen->entryAlloca(val->getType(), "arraytmp");
+			builder.CreateStore(val, arr);
+		}
+		if (at->SoA) return soaGather(builder, arr, idx, at->ElemType->getTy());
+		Value *gep[2] = { ConstantInt::get(ity, 0), idx };
+		return builder.CreateLoad(builder.CreateInBoundsGEP(arr, gep, "elemptr"), "elem");
+	} else if (dynamic_cast<SliceTypeAST*>(t) != 0) {
+		// slice : address of the element
+		Value *s = Obj->Codegen();
+		Value *idx = Idx->Codegen();
+		CHECK_VOID(s)
+		CHECK_VOID(idx)
+		Ctx->Gen->boundsCheck(idx, builder.CreateExtractValue(s, 1, "len"), false, Tag);
+		return builder.CreateInBoundsGEP(builder.CreateExtractValue(s, 0, "ptr"), idx, "elemptr");
+	}
+	throw new InternalError("Indexing something that is not an array or a slice.");
+}
+
+Value *SliceExprAST::Codegen() {
 	IRBuilder<> &builder = Ctx->Gen->Builder;
+	Type *ity = INTTYPE->getTy();
+	TypeAST *t = Obj->type(Ctx);
+
+	Value *o = Obj->Codegen();
+	CHECK_VOID(o)
+	Value *ptr, *len;
+	if (RefTypeAST *rt = dynamic_cast<RefTypeAST*>(t)) {
+		ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(rt->VType);
+		if (at == 0) throw new InternalError("Slicing a reference to something that is not an array.");
+		Value *gep[2] = { ConstantInt::get(ity, 0), ConstantInt::get(ity, 0) };
+		ptr = builder.CreateInBoundsGEP(o, gep, "arrayptr");
+		len = ConstantInt::get(ity, at->Length);
+	} else {
+		ptr = builder.CreateExtractValue(o, 0, "ptr");
+		len = builder.CreateExtractValue(o, 1, "len");
+	}
+
+	Value *lo = (Lo != 0 ? Lo->Codegen() : ConstantInt::get(ity, 0));
+	Value *hi = (Hi != 0 ? Hi->Codegen() : len);
+	CHECK_VOID(lo)
+	CHECK_VOID(hi)
+	if (Hi != 0) Ctx->Gen->boundsCheck(hi, len, true, Tag);
+	if (Lo != 0) Ctx->Gen->boundsCheck(lo, hi, true, Tag);
+
+	Value *s = UndefValue::get(EType->getTy());
+	s = builder.CreateInsertValue(s, (Lo != 0 ? builder.CreateInBoundsGEP(ptr, lo, "sliceptr") : ptr), 0, "slicetmp");
+	return builder.CreateInsertValue(s, (Lo != 0 ? builder.CreateSub(hi, lo, "slicelen") : hi), 1, "slice");
+}
+
+Value *CallExprAST::Codegen() {
+	if (Subst != 0) return Subst->Codegen();
+	return codegenCall(0);
+}
 
+// Copy elision : a large record returned by the call is written directly at dest
+// (see Generator::emitCall). Returns false when the result is not such a record.
+bool CallExprAST::codegenInto(Value *dest) {
+	if (Subst != 0 || !StructTypeAST::byPointer(type(Ctx))) return false;
+	codegenCall(dest);
+	return true;
+}
+
+Value *CallExprAST::codegenCall(Value *dest) {
 	FuncTypeAST *funcType = 0; 
 	if (RefTypeAST *reft = dynamic_cast<RefTypeAST*>(Callee->type(Ctx))) {
 		funcType = dynamic_cast<FuncTypeAST*>(reft->VType);
@@ -210,20 +468,379 @@ Value *CallExprAST::Codegen() {
 		CHECK_VOID(ArgsV.back())
 	}
 
-	if (CalleeFT->getReturnType() == Type::getVoidTy(getGlobalContext())) {
-		return builder.CreateCall(calleev, ArgsV);
+	return Ctx->Gen->emitCall(calleev, funcType, ArgsV, dest);
+}
+
+Value *SpawnExprAST::Codegen() {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	Type *i8p = Type::getInt8PtrTy(C);
+	CallExprAST *call = dynamic_cast<CallExprAST*>(Call);
+	FuncTypeAST *funcType = dynamic_cast<FuncTypeAST*>(dynamic_cast<RefTypeAST*>(call->Callee->type(Ctx))->VType);
+	bool isVoid = (funcType->ReturnType == VOIDTYPE);
+
+	vector<Value*> vals;
+	vector<Type*> types;
+	if (!isVoid) types.push_back(funcType->ReturnType->getTy());
+	Value *calleev = call->Callee->Codegen();
+	CHECK_VOID(calleev)
+	vals.push_back(calleev);
+	for (unsigned i = 0; i < call->Args.size(); i++) {
+		Value *av = call->Args[i]->Codegen();
+		CHECK_VOID(av)
+		vals.push_back(av);
+	}
+	for (unsigned i = 0; i < vals.size(); i++) {
+		types.push_back(vals[i]->getType());
+	}
+	StructType *dataTy = StructType::get(C, types);
+	unsigned first = (isVoid ? 0 : 1);
+
+	// thunk
+	BasicBlock *CallerBB = builder.GetInsertBlock();
+	Type *thunkArgs[1] = { i8p };
+	Function *thunk = Function::Create(FunctionType::get(Type::getVoidTy(C), thunkArgs, false), Function::InternalLinkage,
+		CallerBB->getParent()->getName() + ".spawn", Ctx->Gen->TheModule);
+	builder.SetInsertPoint(BasicBlock::Create(C, "entry", thunk));
+	Value *data = builder.CreateBitCast(thunk->arg_begin(), PointerType::get(dataTy, 0), "data");
+	Value *f = builder.CreateLoad(builder.CreateStructGEP(data, first), "callee");
+	vector<Value*> args;
+	for (unsigned i = 1; i < vals.size(); i++) {
+		args.push_back(builder.CreateLoad(builder.CreateStructGEP(data, first + i), "arg"));
+	}
+	Ctx->Gen->emitCall(f, funcType, args, (isVoid ? 0 : builder.CreateStructGEP(data, 0)));
+	builder.CreateRetVoid();
+	if (verifyFunction(*thunk)) Tag.Throw("Error in spawned call...");
+	Ctx->Gen->FPM.run(*thunk);
+	builder.SetInsertPoint(CallerBB);
+
+	// task record
+	Type *ity = INTTYPE->getTy();
+	Type *newArgs[2] = { i8p, ity };
+	Constant *newf = Ctx->Gen->TheModule->getOrInsertFunction("pif_task_new", FunctionType::get(i8p, newArgs, false));
+	Value *rec = builder.CreateCall2(newf, builder.CreateBitCast(thunk, i8p, "thunk"),
+		ConstantInt::get(ity, Ctx->Gen->ExecEng->getTargetData()->getTypeAllocSize(dataTy)), "task");
+	Value *recData = builder.CreateBitCast(rec, PointerType::get(dataTy, 0), "data");
+	for (unsigned i = 0; i < vals.size(); i++) {
+		builder.CreateStore(vals[i], builder.CreateStructGEP(recData, first + i));
+	}
+
+	// in batch mode, globals are per thread, so the call is made right away on this thread
+	if (Ctx->Gen->IsolateGlobals) {
+		builder.CreateCall(thunk, rec);
+	} else {
+		Type *spawnArgs[1] = { i8p };
+		builder.CreateCall(Ctx->Gen->TheModule->getOrInsertFunction("pif_task_spawn",
+			FunctionType::get(Type::getVoidTy(C), spawnArgs, false)), rec);
+	}
+	return rec;
+}
+
+Value *JoinExprAST::Codegen() {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	Type *i8p = Type::getInt8PtrTy(C);
+	Type *taskArgs[1] = { i8p };
+	FunctionType *taskFT = FunctionType::get(Type::getVoidTy(C), taskArgs, false);
+
+	Value *h = Handle->Codegen();
+	CHECK_VOID(h)
+
+	if (!Ctx->Gen->IsolateGlobals) {
+		builder.CreateCall(Ctx->Gen->TheModule->getOrInsertFunction("pif_task_join", taskFT), h);
+	}
+	Value *r = 0;
+	TypeAST *rt = dynamic_cast<TaskTypeAST*>(Handle->type(Ctx))->ResultType;
+	if (rt != VOIDTYPE) {
+		r = builder.CreateLoad(builder.CreateBitCast(h, PointerType::get(rt->getTy(), 0)), "joined");
 	}
-	return builder.CreateCall(calleev, ArgsV, "calltmp");
+	builder.CreateCall(Ctx->Gen->TheModule->getOrInsertFunction("pif_task_free", taskFT), h);
+	return r;
+}
+
+static AtomicOrdering atomicOrdering(const string &order) {
+	if (order == "relaxed") return Monotonic;
+	if (order == "acquire") return Acquire;
+	if (order == "release") return Release;
+	if (order == "acq_rel") return AcquireRelease;
+	return SequentiallyConsistent;
+}
+
+// Atomic references are accessed as integers of the size of a pointer,
+// as cmpxchg and atomicrmw only work on integers.
+Value *AtomicOpExprAST::Codegen() {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	TargetData *td = Ctx->Gen->ExecEng->getTargetData();
+	AtomicTypeAST *at = dynamic_cast<AtomicTypeAST*>(dynamic_cast<RefTypeAST*>(Ref->type(Ctx))->VType);
+	Type *vty = at->ValType->getTy();
+	bool isRef = vty->isPointerTy();
+	Type *ity = (isRef ? td->getIntPtrType(getGlobalContext()) : vty);
+	AtomicOrdering order = atomicOrdering(Order);
+
+	Value *addr = Ref->Codegen();
+	CHECK_VOID(addr)
+	if (isRef) addr = builder.CreateBitCast(addr, PointerType::get(ity, 0), "atomicaddr");
+	vector<Value*> args;
+	for (unsigned i = 0; i < Args.size(); i++) {
+		Value *v = Args[i]->Codegen();
+		CHECK_VOID(v)
+		args.push_back(isRef ? builder.CreatePtrToInt(v, ity, "atomicval") : v);
+	}
+
+	Value *r;
+	if (Op == "load") {
+		LoadInst *l = builder.CreateLoad(addr, "atomicload");
+		l->setAtomic(order);
+		l->setAlignment(td->getTypeAllocSize(ity));
+		r = l;
+	} else if (Op == "store") {
+		StoreInst *s = builder.CreateStore(args[0], addr);
+		s->setAtomic(order);
+		s->setAlignment(td->getTypeAllocSize(ity));
+		return 0;
+	} else if (Op == "compare_exchange") {
+		r = builder.CreateAtomicCmpXchg(addr, args[0], args[1], order);
+	} else {
+		IntTypeAST *it = dynamic_cast<IntTypeAST*>(at->ValType);
+		AtomicRMWInst::BinOp op = AtomicRMWInst::Xchg;
+		if (Op == "fetch_add") op = AtomicRMWInst::Add;
+		if (Op == "fetch_sub") op = AtomicRMWInst::Sub;
+		if (Op == "fetch_and") op = AtomicRMWInst::And;
+		if (Op == "fetch_or") op = AtomicRMWInst::Or;
+		if (Op == "fetch_xor") op = AtomicRMWInst::Xor;
+		if (Op == "fetch_min") op = (it->Signed ? AtomicRMWInst::Min : AtomicRMWInst::UMin);
+		if (Op == "fetch_max") op = (it->Signed ? AtomicRMWInst::Max : AtomicRMWInst::UMax);
+		r = builder.CreateAtomicRMW(op, addr, args[0], order);
+	}
+	if (isRef) r = builder.CreateIntToPtr(r, vty, "atomicref");
+	return r;
+}
+
+Value *NewChanExprAST::Codegen() {
+	Type *i8p = Type::getInt8PtrTy(getGlobalContext());
+	Type *ity = INTTYPE->getTy();
+	Value *cap = Capacity->Codegen();
+	CHECK_VOID(cap)
+	Type *args[2] = { ity, ity };
+	Constant *newf = Ctx->Gen->TheModule->getOrInsertFunction("pif_chan_new", FunctionType::get(i8p, args, false));
+	Value *size = ConstantInt::get(ity, Ctx->Gen->ExecEng->getTargetData()->getTypeAllocSize(ElemType->getTy()));
+	return Ctx->Gen->Builder.CreateCall2(newf, size, cap, "chan");
+}
+
+// Elements go through memory : the runtime copies them to and from the ring buffer
+Value *ChanOpExprAST::Codegen() {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	Type *i8p = Type::getInt8PtrTy(C);
+	TypeAST *et = dynamic_cast<ChanTypeAST*>(Chan->type(Ctx))->ElemType;
+
+	Value *ch = Chan->Codegen();
+	CHECK_VOID(ch)
+
+	Value *elem;
+	if (Op == "try_recv") {
+		elem = Args[0]->Codegen();
+	} else {
+		elem = Ctx->Gen->entryAlloca(et->getTy(), "chanelem");
+		if (Op != "recv") {
+			Value *v = Args[0]->Codegen();
+			CHECK_VOID(v)
+			builder.CreateStore(v, elem);
+		}
+	}
+	CHECK_VOID(elem)
+
+	bool isTry = (Op == "try_send" || Op == "try_recv");
+	Type *args[2] = { i8p, i8p };
+	Type *retTy = (isTry ? Type::getInt32Ty(C) : Type::getVoidTy(C));
+	Constant *f = Ctx->Gen->TheModule->getOrInsertFunction("pif_chan_" + Op, FunctionType::get(retTy, args, false));
+	Value *r = builder.CreateCall2(f, ch, builder.CreateBitCast(elem, i8p, "elemptr"));
+
+	if (isTry) return builder.CreateICmpNE(r, ConstantInt::get(Type::getInt32Ty(C), 0), "chanok");
+	if (Op == "recv") return builder.CreateLoad(elem, "recv");
+	return 0;
+}
+
+Value *GenOpExprAST::Codegen() {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	Type *i8p = Type::getInt8PtrTy(C);
+	TypeAST *yt = dynamic_cast<GenTypeAST*>(Gen->type(Ctx))->YieldType;
+
+	Value *g = Gen->Codegen();
+	CHECK_VOID(g)
+
+	if (Op == "free") {
+		Type *args[1] = { i8p };
+		Constant *f = Ctx->Gen->TheModule->getOrInsertFunction("pif_frame_free", FunctionType::get(Type::getVoidTy(C), args, false));
+		builder.CreateCall(f, g);
+		return 0;
+	}
+
+	Value *dest = Args[0]->Codegen();
+	CHECK_VOID(dest)
+	Value *header = builder.CreateBitCast(g, PointerType::get(Generator::genHeader(yt->getTy()), 0), "genheader");
+	Value *more = builder.CreateCall(builder.CreateLoad(builder.CreateStructGEP(header, 0), "resume"), g, "genmore");
+
+	Function *fun = builder.GetInsertBlock()->getParent();
+	BasicBlock *ValueBB = BasicBlock::Create(C, "genvalue", fun);
+	BasicBlock *MergeBB = BasicBlock::Create(C, "gencont", fun);
+	builder.CreateCondBr(more, ValueBB, MergeBB);
+	builder.SetInsertPoint(ValueBB);
+	builder.CreateStore(builder.CreateLoad(builder.CreateStructGEP(header, 2)), dest);
+	builder.CreateBr(MergeBB);
+	builder.SetInsertPoint(MergeBB);
+	return more;
+}
+
+Value *OrderingExprAST::Codegen() {
+	throw new InternalError("Memory ordering generated as a value.");
+}
+
+Value *FenceExprAST::Codegen() {
+	Ctx->Gen->Builder.CreateFence(atomicOrdering(Order));
+	return 0;
+}
+
+Value *VectorOpExprAST::Codegen() {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	Type *i32 = Type::getInt32Ty(getGlobalContext());
+	VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(Vec->type(Ctx));
+
+	Value *v = Vec->Codegen();
+	CHECK_VOID(v)
+
+	if (Op == "sum" || Op == "product" || Op == "min" || Op == "max" || Op == "any" || Op == "all") {
+		return reduce(v, vt->Width);
+	} else if (Op == "select") {
+		Value *a = Args[0]->Codegen();
+		Value *b = Args[1]->Codegen();
+		CHECK_VOID(a)
+		CHECK_VOID(b)
+		return builder.CreateSelect(v, a, b, "select");
+	} else if (Op == "insert") {
+		Value *idx = Args[0]->Codegen();
+		Value *x = Args[1]->Codegen();
+		CHECK_VOID(idx)
+		CHECK_VOID(x)
+		Ctx->Gen->boundsCheck(idx, ConstantInt::get(INTTYPE->getTy(), vt->Width), false, Tag);
+		return builder.CreateInsertElement(v, x, idx, "insert");
+	} else if (Op == "shuffle") {
+		unsigned first = (Args.size() > 0 && Args[0]->type(Ctx) == vt ? 1 : 0);
+		Value *w = (first == 1 ? Args[0]->Codegen() : UndefValue::get(v->getType()));
+		CHECK_VOID(w)
+		INT lanes = (first == 1 ? 2 : 1) * vt->Width;
+		vector<Constant*> mask;
+		for (unsigned i = first; i < Args.size(); i++) {
+			ConstantInt *c = dyn_cast_or_null<ConstantInt>(Args[i]->constCodegen());
+			if (c == 0) Args[i]->Tag.Throw("Lanes in 'shuffle' must be known at compile time.");
+			if (c->getSExtValue() < 0 || c->getSExtValue() >= lanes) Args[i]->Tag.Throw("No such lane in 'shuffle'.");
+			mask.push_back(ConstantInt::get(i32, c->getZExtValue()));
+		}
+		return builder.CreateShuffleVector(v, w, ConstantVector::get(mask), "shuffle");
+	} else if (Op == "store") {
+		Value *s = Args[0]->Codegen();
+		CHECK_VOID(s)
+		Ctx->Gen->boundsCheck(ConstantInt::get(INTTYPE->getTy(), vt->Width), builder.CreateExtractValue(s, 1, "len"), true, Tag);
+		Value *p = builder.CreateBitCast(builder.CreateExtractValue(s, 0, "ptr"), PointerType::get(v->getType(), 0), "vecptr");
+		StoreInst *st = builder.CreateStore(v, p);
+		st->setAlignment(Ctx->Gen->ExecEng->getTargetData()->getABITypeAlignment(vt->ElemType->getTy()));
+		return 0;
+	} else if (Op == "bits" || Op == "frombits") {
+		return builder.CreateBitCast(v, type(Ctx)->getTy(), Op);
+	}
+	throw new InternalError("Unknown vector operation '" + Op + "'.");
+}
+
+// Horizontal reduction : combine the two halves of the vector until there is only one lane left
+Value *VectorOpExprAST::reduce(Value *v, unsigned width) {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	Type *i32 = Type::getInt32Ty(getGlobalContext());
+	VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(Vec->type(Ctx));
+	IntTypeAST *it = dynamic_cast<IntTypeAST*>(vt->ElemType);
+	bool isFloat = (BaseTypeAST::isFloat(vt->ElemType) != 0);
+
+	while (width > 1) {
+		width /= 2;
+		vector<Constant*> lo, hi;
+		for (unsigned i = 0; i < width; i++) {
+			lo.push_back(ConstantInt::get(i32, i));
+			hi.push_back(ConstantInt::get(i32, width + i));
+		}
+		Value *undef = UndefValue::get(v->getType());
+		Value *a = builder.CreateShuffleVector(v, undef, ConstantVector::get(lo), "lo");
+		Value *b = builder.CreateShuffleVector(v, undef, ConstantVector::get(hi), "hi");
+
+		if (Op == "sum") {
+			v = (isFloat ? builder.CreateFAdd(a, b, "addtmp") : builder.CreateAdd(a, b, "addtmp"));
+		} else if (Op == "product") {
+			v = (isFloat ? builder.CreateFMul(a, b, "multmp") : builder.CreateMul(a, b, "multmp"));
+		} else if (Op == "min" || Op == "max") {
+			Value *lt;
+			if (isFloat) {
+				lt = builder.CreateFCmpOLT(a, b, "cmptmp");
+			} else {
+				lt = (it->Signed ? builder.CreateICmpSLT(a, b, "cmptmp") : builder.CreateICmpULT(a, b, "cmptmp"));
+			}
+			v = (Op == "min" ? builder.CreateSelect(lt, a, b, "mintmp") : builder.CreateSelect(lt, b, a, "maxtmp"));
+		} else if (Op == "any") {
+			v = builder.CreateOr(a, b, "ortmp");
+		} else if (Op == "all") {
+			v = builder.CreateAnd(a, b, "andtmp");
+		}
+	}
+	return builder.CreateExtractElement(v, ConstantInt::get(i32, 0), "reduce");
+}
+
+// Frames of generators created on the heap for a for-in loop (see ForInAST::Codegen)
+static void freeFrame(Context *ctx, Value *frame) {
+	Type *args[1] = { Type::getInt8PtrTy(getGlobalContext()) };
+	Constant *f = ctx->Gen->TheModule->getOrInsertFunction("pif_frame_free",
+		FunctionType::get(Type::getVoidTy(getGlobalContext()), args, false));
+	ctx->Gen->Builder.CreateCall(f, frame);
+}
+
+// Returning from the body of for-in loops leaves them : their frames are freed first
+static void freeLoopFrames(Context *ctx) {
+	vector<Value*> &frames = ctx->More->LoopFrames;
+	for (unsigned i = frames.size(); i > 0; i--) freeFrame(ctx, frames[i - 1]);
 }
 
 Value *ReturnAST::Codegen() {
-	if (Val == 0) return Ctx->Gen->Builder.CreateRetVoid();
+	if (Ctx->Gen->GenFrame != 0) {
+		freeLoopFrames(Ctx);
+		return Ctx->Gen->genReturn();
+	}
+	if (Val == 0) {
+		freeLoopFrames(Ctx);
+		return Ctx->Gen->Builder.CreateRetVoid();
+	}
+
+	if (Ctx->Gen->RetSlot != 0) {
+		// a large record goes to memory given by the caller, directly when it comes from a call
+		CallExprAST *call = dynamic_cast<CallExprAST*>(Val);
+		if (call == 0 || !call->codegenInto(Ctx->Gen->RetSlot)) {
+			Value *v = Val->Codegen();
+			CHECK_VOID(v)
+			Ctx->Gen->Builder.CreateStore(v, Ctx->Gen->RetSlot);
+		}
+		freeLoopFrames(Ctx);
+		return Ctx->Gen->Builder.CreateRetVoid();
+	}
 
 	Value *v = Val->Codegen();
 	CHECK_VOID(v)
+	freeLoopFrames(Ctx);
 	return Ctx->Gen->Builder.CreateRet(v);
 }
 
+Value *YieldAST::Codegen() {
+	Value *v = Val->Codegen();
+	CHECK_VOID(v)
+	Ctx->Gen->genYield(v);
+	return 0;
+}
+
 Value *IfThenElseAST::Codegen() {
 	IRBuilder<> &builder = Ctx->Gen->Builder;
 
@@ -309,9 +926,390 @@ Value *WhileAST::Codegen() {
 	return 0;
 }
 
+// The value for loops going down, or the one for loops going up
+static Value *byDirection(IRBuilder<> &builder, Value *down, Value *ifDown, Value *ifUp, const Twine &name) {
+	if (ConstantInt *cd = dyn_cast<ConstantInt>(down)) {
+		Value *v = (cd->isOne() ? ifDown : ifUp);
+		v->setName(name);
+		return v;
+	}
+	return builder.CreateSelect(down, ifDown, ifUp, name);
+}
+
+// Counted loops are generated in the canonical form LLVM's loop passes expect :
+// a guard, a single header with the induction phi, and a single latch holding
+// the exit test, so that the trip count can be computed from the bounds.
+Value *ForAST::Codegen() {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+
+	Value *from = From->Codegen();
+	Value *to = To->Codegen();
+	Value *step = (Step != 0 ? Step->Codegen() : ConstantInt::get(INTTYPE->getTy(), 1));
+	CHECK_VOID(from)
+	CHECK_VOID(to)
+	CHECK_VOID(step)
+
+	Value *down = downTest(step);
+
+	Function *fun = builder.GetInsertBlock()->getParent();
+	BasicBlock *PreBB = builder.GetInsertBlock();
+	BasicBlock *LoopBB = BasicBlock::Create(C, "for", fun);
+	BasicBlock *LatchBB = BasicBlock::Create(C, "fornext");
+	BasicBlock *MergeBB = BasicBlock::Create(C, "forcont");
+
+	Value *enter = byDirection(builder, down, builder.CreateICmpSGT(from, to), builder.CreateICmpSLT(from, to), "forenter");
+	builder.CreateCondBr(enter, LoopBB, MergeBB);
+
+	builder.SetInsertPoint(LoopBB);
+	PHINode *ind = builder.CreatePHI(from->getType(), 2, Var);
+	ind->addIncoming(from, PreBB);
+	Sym->llvmVal = ind;
+
+	// the range of the loop variable is only known when the direction is
+	if (ConstantInt *cd = dyn_cast<ConstantInt>(down)) {
+		Generator::InductionRange range = { from, to, cd->isOne() };
+		Ctx->Gen->Inductions[ind] = range;
+	}
+
+	BasicBlock *prevCont = Ctx->More->ContinueTo, *prevBreak = Ctx->More->BreakTo;
+	Ctx->More->ContinueTo = LatchBB;
+	Ctx->More->BreakTo = MergeBB;
+	Inside->Codegen();
+	Ctx->More->ContinueTo = prevCont;
+	Ctx->More->BreakTo = prevBreak;
+
+	Ctx->Gen->Inductions.erase(ind);
+
+	if (builder.GetInsertBlock()->getTerminator() == 0) builder.CreateBr(LatchBB);
+
+	fun->getBasicBlockList().push_back(LatchBB);
+	builder.SetInsertPoint(LatchBB);
+	Value *more = moreTest(ind, to, step, down);
+	Value *next = builder.CreateAdd(ind, step, "fornext");
+	BranchInst *br = builder.CreateCondBr(more, LoopBB, MergeBB);
+	ind->addIncoming(next, LatchBB);
+
+	// loop identifier, with the hints given in the source
+	vector<Value*> md;
+	MDNode *tmp = MDNode::getTemporary(C, ArrayRef<Value*>());
+	md.push_back(tmp);
+	if (Unroll != 0) {
+		Value *hint[2] = { MDString::get(C, "llvm.loop.unroll.count"), ConstantInt::get(Type::getInt32Ty(C), Unroll) };
+		md.push_back(MDNode::get(C, hint));
+	}
+	if (Vectorize != 0) {
+		Value *hint[2] = { MDString::get(C, "llvm.loop.vectorize.width"), ConstantInt::get(Type::getInt32Ty(C), Vectorize) };
+		md.push_back(MDNode::get(C, hint));
+	}
+	MDNode *loopID = MDNode::get(C, md);
+	loopID->replaceOperandWith(0, loopID);
+	MDNode::deleteTemporary(tmp);
+	br->setMetadata("llvm.loop", loopID);
+
+	fun->getBasicBlockList().push_back(MergeBB);
+	builder.SetInsertPoint(MergeBB);
+	return 0;
+}
+
+Value *ForInAST::Codegen() {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	Type *i8p = Type::getInt8PtrTy(C);
+	TypeAST *yt = dynamic_cast<GenTypeAST*>(Gen->type(Ctx))->YieldType;
+
+	// When looping on a call of a generator function, the loop is the only user
+	// of the generator : its frame is put on our stack and it is resumed directly.
+	CallExprAST *call = dynamic_cast<CallExprAST*>(Gen);
+	Symbol *callee = (call != 0 && call->Subst == 0 ? call->Callee->refSymbol() : 0);
+	FuncDefAST *fd = (callee != 0 ? dynamic_cast<FuncDefAST*>(callee->Def) : 0);
+	bool genCall = (fd != 0 && fd->Val->YieldType != 0);
+	Generator::GenInfo *direct = (genCall ? Ctx->Gen->genInfo(Ctx->Pkg, callee) : 0);
+
+	Value *g;
+	if (direct != 0) {
+		vector<Value*> args;
+		for (unsigned i = 0; i < call->Args.size(); i++) {
+			Value *v = call->Args[i]->Codegen();
+			CHECK_VOID(v)
+			args.push_back(v);
+		}
+		g = builder.CreateBitCast(Ctx->Gen->entryAlloca(direct->Frame, "genframe"), i8p, "gen");
+		Ctx->Gen->genInit(dyn_cast<Function>(callee->llvmVal), g, args);
+	} else {
+		g = Gen->Codegen();
+		CHECK_VOID(g)
+	}
+	Value *header = builder.CreateBitCast(g, PointerType::get(Generator::genHeader(yt->getTy()), 0), "genheader");
+
+	Function *fun = builder.GetInsertBlock()->getParent();
+	BasicBlock *LoopBB = BasicBlock::Create(C, "forin", fun);
+	BasicBlock *BodyBB = BasicBlock::Create(C, "forinbody");
+	BasicBlock *MergeBB = BasicBlock::Create(C, "forincont");
+	builder.CreateBr(LoopBB);
+
+	builder.SetInsertPoint(LoopBB);
+	Value *resume = (direct != 0 ? direct->Resume : builder.CreateLoad(builder.CreateStructGEP(header, 0), "resume"));
+	builder.CreateCondBr(builder.CreateCall(resume, g, "genmore"), BodyBB, MergeBB);
+
+	fun->getBasicBlockList().push_back(BodyBB);
+	builder.SetInsertPoint(BodyBB);
+	Sym->llvmVal = builder.CreateLoad(builder.CreateStructGEP(header, 2), Var);
+
+	BasicBlock *prevCont = Ctx->More->ContinueTo, *prevBreak = Ctx->More->BreakTo;
+	Ctx->More->ContinueTo = LoopBB;
+	Ctx->More->BreakTo = MergeBB;
+	// created on the heap just for the loop : freed when leaving it, by its end or a return
+	bool heapFrame = (genCall && direct == 0);
+	if (heapFrame) Ctx->More->LoopFrames.push_back(g);
+	Inside->Codegen();
+	if (heapFrame) Ctx->More->LoopFrames.pop_back();
+	Ctx->More->ContinueTo = prevCont;
+	Ctx->More->BreakTo = prevBreak;
+
+	if (builder.GetInsertBlock()->getTerminator() == 0) builder.CreateBr(LoopBB);
+
+	fun->getBasicBlockList().push_back(MergeBB);
+	builder.SetInsertPoint(MergeBB);
+	if (heapFrame) freeFrame(Ctx, g);
+	return 0;
+}
+
+// Whether the loop goes down : a constant when the step is known at compile time,
+// a test of its sign otherwise. A step of zero is an error, at runtime when it is
+// not known before (the loop would never end).
+Value *ForAST::downTest(Value *step) {
+	if (ConstantInt *cs = dyn_cast<ConstantInt>(step)) {
+		if (cs->isZero()) Tag.Throw("Step in 'for' loop cannot be zero.");
+		return ConstantInt::get(Type::getInt1Ty(getGlobalContext()), cs->isNegative());
+	}
+
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	Function *fun = builder.GetInsertBlock()->getParent();
+	BasicBlock *FailBB = BasicBlock::Create(C, "zerostep", fun);
+	BasicBlock *ContBB = BasicBlock::Create(C, "stepok", fun);
+	Value *ok = builder.CreateICmpNE(step, ConstantInt::get(step->getType(), 0), "stepok");
+	Function *expect = Intrinsic::getDeclaration(Ctx->Gen->TheModule, Intrinsic::expect, Type::getInt1Ty(C));
+	ok = builder.CreateCall2(expect, ok, ConstantInt::getTrue(C), "stepok");
+	builder.CreateCondBr(ok, ContBB, FailBB);
+
+	builder.SetInsertPoint(FailBB);
+	Constant *failf = Ctx->Gen->TheModule->getOrInsertFunction("pif_step_fail",
+		FunctionType::get(Type::getVoidTy(C), ArrayRef<Type*>(), false));
+	if (Function *f = dyn_cast<Function>(failf)) f->setDoesNotReturn();
+	builder.CreateCall(failf);
+	builder.CreateUnreachable();
+
+	builder.SetInsertPoint(ContBB);
+	return builder.CreateICmpSLT(step, ConstantInt::get(step->getType(), 0), "fordown");
+}
+
+// Whether there is an iteration after i, which is in the range : the distance from i to
+// the end, as an unsigned, is more than the step. Unlike i + step, it cannot overflow.
+Value *ForAST::moreTest(Value *i, Value *to, Value *step, Value *down) {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	Value *upMore = 0, *downMore = 0;
+	ConstantInt *cd = dyn_cast<ConstantInt>(down);
+	if (cd == 0 || !cd->isOne()) upMore = builder.CreateICmpUGT(builder.CreateSub(to, i, "fordist"), step);
+	if (cd == 0 || cd->isOne()) downMore = builder.CreateICmpUGT(builder.CreateSub(i, to, "fordist"), builder.CreateNeg(step));
+	return byDirection(builder, down, downMore, upMore, "formore");
+}
+
+// Partial results of reductions start at the neutral element of the operator
+static Constant *reductionIdentity(const string &op, Type *t, bool isSigned) {
+	if (t->isFloatingPointTy()) {
+		if (op == "+") return ConstantFP::get(t, 0);
+		if (op == "*") return ConstantFP::get(t, 1);
+		return ConstantFP::getInfinity(t, op == "max");
+	}
+	unsigned bits = t->getPrimitiveSizeInBits();
+	if (op == "+") return ConstantInt::get(t, 0);
+	if (op == "*") return ConstantInt::get(t, 1);
+	if (op == "min") return ConstantInt::get(getGlobalContext(), isSigned ? APInt::getSignedMaxValue(bits) : APInt::getMaxValue(bits));
+	return ConstantInt::get(getGlobalContext(), isSigned ? APInt::getSignedMinValue(bits) : APInt::getMinValue(bits));
+}
+
+static Value *reductionCombine(IRBuilder<> &builder, const string &op, Value *a, Value *b, bool isSigned) {
+	bool isFloat = a->getType()->isFloatingPointTy();
+	if (op == "+") return (isFloat ? builder.CreateFAdd(a, b, "addtmp") : builder.CreateAdd(a, b, "addtmp"));
+	if (op == "*") return (isFloat ? builder.CreateFMul(a, b, "multmp") : builder.CreateMul(a, b, "multmp"));
+	Value *lt;
+	if (isFloat) {
+		lt = builder.CreateFCmpOLT(a, b, "cmptmp");
+	} else {
+		lt = (isSigned ? builder.CreateICmpSLT(a, b, "cmptmp") : builder.CreateICmpULT(a, b, "cmptmp"));
+	}
+	return (op == "min" ? builder.CreateSelect(lt, a, b, "mintmp") : builder.CreateSelect(lt, b, a, "maxtmp"));
+}
+
+// Parallel loops : the body is outlined into a task function void(i8 *env, int lo, int hi)
+// running iterations lo to hi, and the runtime runs it on ranges of iterations.
+// Local variables visible in the loop are passed in env, by address for vars and
+// by value for lets. Reduction variables are replaced by a private copy in the task,
+// combined into the variable at the end of every range.
+Value *ParallelForAST::Codegen() {
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	Type *ity = INTTYPE->getTy();
+
+	Value *from = From->Codegen();
+	Value *to = To->Codegen();
+	Value *step = (Step != 0 ? Step->Codegen() : ConstantInt::get(ity, 1));
+	Value *grain = (Grain != 0 ? Grain->Codegen() : ConstantInt::get(ity, 0));
+	CHECK_VOID(from)
+	CHECK_VOID(to)
+	CHECK_VOID(step)
+	CHECK_VOID(grain)
+
+	Value *down = downTest(step);
+
+	// number of iterations (the distance is unsigned, it may not fit in an int ; the
+	// step is not zero, downTest checked it before the division)
+	Value *enter = byDirection(builder, down, builder.CreateICmpSGT(from, to), builder.CreateICmpSLT(from, to), "forenter");
+	Value *dist = byDirection(builder, down, builder.CreateSub(from, to), builder.CreateSub(to, from), "fordist");
+	Value *absStep = byDirection(builder, down, builder.CreateNeg(step), step, "forstep");
+	Value *count = builder.CreateAdd(builder.CreateUDiv(builder.CreateSub(dist, ConstantInt::get(ity, 1)), absStep),
+		ConstantInt::get(ity, 1), "forcount");
+	count = builder.CreateSelect(enter, count, ConstantInt::get(ity, 0), "forcount");
+
+	// environment : loop bounds not known at compile time, then local variables
+	Value *bounds[3] = { from, to, step };
+	vector<Value*> envVals;
+	vector<Type*> envTypes;
+	for (unsigned i = 0; i < 3; i++) {
+		if (isa<Constant>(bounds[i])) continue;
+		envVals.push_back(bounds[i]);
+		envTypes.push_back(bounds[i]->getType());
+	}
+	vector<Symbol*> captured;
+	for (unsigned i = 1; i + 1 < Ctx->NamedValues.size(); i++) {		// the last scope is the loop variable's
+		for (map<string, Symbol*>::iterator it = Ctx->NamedValues[i]->begin(); it != Ctx->NamedValues[i]->end(); it++) {
+			Value *v = it->second->llvmVal;
+			if (v == 0 || !(isa<Instruction>(v) || isa<Argument>(v))) continue;
+			captured.push_back(it->second);
+			envVals.push_back(v);
+			envTypes.push_back(v->getType());
+		}
+	}
+	StructType *envTy = StructType::get(C, envTypes);
+	AllocaInst *env = Ctx->Gen->entryAlloca(envTy, "parenv");
+	for (unsigned i = 0; i < envVals.size(); i++) {
+		builder.CreateStore(envVals[i], builder.CreateStructGEP(env, i));
+	}
+
+	// task function
+	Type *i8p = Type::getInt8PtrTy(C);
+	Type *argsTy[3] = { i8p, ity, ity };
+	BasicBlock *CallerBB = builder.GetInsertBlock();
+	Function *task = Function::Create(FunctionType::get(Type::getVoidTy(C), argsTy, false), Function::InternalLinkage,
+		CallerBB->getParent()->getName() + ".parfor", Ctx->Gen->TheModule);
+	Function::arg_iterator ai = task->arg_begin();
+	Value *envArg = ai++;
+	Value *lo = ai++;
+	Value *hi = ai;
+
+	BasicBlock *EntryBB = BasicBlock::Create(C, "entry", task);
+	builder.SetInsertPoint(EntryBB);
+	Value *envPtr = builder.CreateBitCast(envArg, PointerType::get(envTy, 0), "env");
+	unsigned field = 0;
+	for (unsigned i = 0; i < 3; i++) {
+		if (isa<Constant>(bounds[i])) continue;
+		bounds[i] = builder.CreateLoad(builder.CreateStructGEP(envPtr, field++), "bound");
+	}
+	// reduction variables are captured too : their address in the caller is where
+	// the partial results go, and what they are once the loop is generated
+	vector<Value*> redAddr;
+	for (unsigned i = 0; i < RedSyms.size(); i++) redAddr.push_back(RedSyms[i]->llvmVal);
+	vector<Value*> saved;
+	for (unsigned i = 0; i < captured.size(); i++) {
+		saved.push_back(captured[i]->llvmVal);
+		captured[i]->llvmVal = builder.CreateLoad(builder.CreateStructGEP(envPtr, field++), "captured");
+	}
+	vector<Value*> shared;
+	for (unsigned i = 0; i < RedSyms.size(); i++) {
+		TypeAST *t = dynamic_cast<RefTypeAST*>(RedSyms[i]->SType)->VType;
+		IntTypeAST *it = dynamic_cast<IntTypeAST*>(t);
+		shared.push_back(RedSyms[i]->llvmVal);
+		AllocaInst *priv = Ctx->Gen->entryAlloca(t->getTy(), Reductions[i].second);
+		builder.CreateStore(reductionIdentity(Reductions[i].first, t->getTy(), it != 0 && it->Signed), priv);
+		RedSyms[i]->llvmVal = priv;
+	}
+
+	BasicBlock *LoopBB = BasicBlock::Create(C, "parfor", task);
+	BasicBlock *LatchBB = BasicBlock::Create(C, "parfornext");
+	BasicBlock *ExitBB = BasicBlock::Create(C, "parforend");
+	builder.CreateCondBr(builder.CreateICmpSLT(lo, hi, "forenter"), LoopBB, ExitBB);
+
+	builder.SetInsertPoint(LoopBB);
+	PHINode *k = builder.CreatePHI(ity, 2, "iter");
+	k->addIncoming(lo, EntryBB);
+	Value *ind = builder.CreateNSWAdd(bounds[0], builder.CreateNSWMul(k, bounds[2]), Var);
+	Sym->llvmVal = ind;
+	if (ConstantInt *cd = dyn_cast<ConstantInt>(down)) {
+		Generator::InductionRange range = { bounds[0], bounds[1], cd->isOne() };
+		Ctx->Gen->Inductions[ind] = range;
+	}
+
+	// no break : other ranges may already be running
+	Ctx->More->ContinueTo = LatchBB;
+	Ctx->More->BreakTo = 0;
+	Inside->Codegen();
+	Ctx->More->ContinueTo = 0;
+
+	Ctx->Gen->Inductions.erase(ind);
+
+	if (builder.GetInsertBlock()->getTerminator() == 0) builder.CreateBr(LatchBB);
+
+	task->getBasicBlockList().push_back(LatchBB);
+	builder.SetInsertPoint(LatchBB);
+	Value *next = builder.CreateNSWAdd(k, ConstantInt::get(ity, 1), "iternext");
+	builder.CreateCondBr(builder.CreateICmpSLT(next, hi, "formore"), LoopBB, ExitBB);
+	k->addIncoming(next, LatchBB);
+
+	task->getBasicBlockList().push_back(ExitBB);
+	builder.SetInsertPoint(ExitBB);
+	if (!RedSyms.empty()) {
+		FunctionType *lockTy = FunctionType::get(Type::getVoidTy(C), false);
+		builder.CreateCall(Ctx->Gen->TheModule->getOrInsertFunction("pif_parallel_lock", lockTy));
+		for (unsigned i = 0; i < RedSyms.size(); i++) {
+			IntTypeAST *it = dynamic_cast<IntTypeAST*>(dynamic_cast<RefTypeAST*>(RedSyms[i]->SType)->VType);
+			Value *total = builder.CreateLoad(shared[i], "total");
+			Value *part = builder.CreateLoad(RedSyms[i]->llvmVal, "partial");
+			builder.CreateStore(reductionCombine(builder, Reductions[i].first, total, part, it != 0 && it->Signed), shared[i]);
+		}
+		builder.CreateCall(Ctx->Gen->TheModule->getOrInsertFunction("pif_parallel_unlock", lockTy));
+	}
+	builder.CreateRetVoid();
+
+	for (unsigned i = 0; i < captured.size(); i++) {
+		captured[i]->llvmVal = saved[i];
+	}
+	for (unsigned i = 0; i < RedSyms.size(); i++) {
+		RedSyms[i]->llvmVal = redAddr[i];
+	}
+
+	if (verifyFunction(*task)) Tag.Throw("Error in parallel loop...");
+	Ctx->Gen->FPM.run(*task);
+
+	// run it : in batch mode, globals are per thread, so the loop stays on the calling thread
+	builder.SetInsertPoint(CallerBB);
+	Value *envI8 = builder.CreateBitCast(env, i8p, "env");
+	if (Ctx->Gen->IsolateGlobals) {
+		builder.CreateCall3(task, envI8, ConstantInt::get(ity, 0), count);
+	} else {
+		Type *pforArgs[4] = { i8p, i8p, ity, ity };
+		Constant *pfor = Ctx->Gen->TheModule->getOrInsertFunction("pif_parallel_for",
+			FunctionType::get(Type::getVoidTy(C), pforArgs, false));
+		Value *args[4] = { builder.CreateBitCast(task, i8p, "task"), envI8, count, grain };
+		builder.CreateCall(pfor, args);
+	}
+	return 0;
+}
+
 Value *BreakContAST::Codegen() {
 	if (SType == bc_break) {
-		if (Ctx->More->BreakTo == 0) throw new InternalError("Nowhere to break to.");
+		if (Ctx->More->BreakTo == 0) Tag.Throw("Nowhere to break to (parallel loops cannot be left with 'break').");
 		Ctx->Gen->Builder.CreateBr(Ctx->More->BreakTo);
 	} else {
 		if (Ctx->More->ContinueTo == 0) throw new InternalError("Nowhere to break to.");
@@ -327,13 +1325,27 @@ Value *BlockAST::Codegen() {
 		}
 		if (DefAST *d = dynamic_cast<DefAST*>(Instructions[i])) {
 			if (VarDefAST *vd = dynamic_cast<VarDefAST*>(d)) {
-				Value* val = vd->Val->Codegen();
 				if (Ctx->NamedValues.back()->count(vd->Name) == 0) {
 					 throw new InternalError("Variable is declared, but not really.");
 				}
 				Symbol *s = Ctx->NamedValues.back()->find(vd->Name)->second;
+				AllocaInst *a = 0;
+				if (vd->Var && StructTypeAST::byPointer(vd->Val->type(Ctx))) {
+					// a large record returned by a call is written directly in the variable
+					if (CallExprAST *call = dynamic_cast<CallExprAST*>(vd->Val)) {
+						a = Ctx->Gen->Builder.CreateAlloca(vd->Val->type(Ctx)->getTy(), 0, vd->Name);
+						if (vd->Align != 0) a->setAlignment(vd->Align);
+						s->llvmVal = a;
+						if (call->codegenInto(a)) continue;
+					}
+				}
+				Value* val = vd->Val->Codegen();
 				if (vd->Var) {
-					s->llvmVal = Ctx->Gen->Builder.CreateAlloca(val->getType(), 0, vd->Name);
+					if (a == 0) {
+						a = Ctx->Gen->Builder.CreateAlloca(val->getType(), 0, vd->Name);
+						if (vd->Align != 0) a->setAlignment(vd->Align);
+						s->llvmVal = a;
+					}
 					Ctx->Gen->Builder.CreateStore(val, s->llvmVal);
 				} else {
 					s->llvmVal = val;
@@ -351,10 +1363,193 @@ Value *BlockAST::Codegen() {
 }
 
 
+// Constants : values that are known without running any code (used for static initialization)
+
+Constant *ExprAST::constCodegen() {
+	return 0;
+}
+
+Constant *BoolExprAST::constCodegen() {
+	return ConstantInt::get(getGlobalContext(), APInt(1, (Val ? 1 : 0), false));
+}
+
+Constant *IntExprAST::constCodegen() {
+	return ConstantInt::get(getGlobalContext(), APInt(IType->Size, Val, IType->Signed));
+}
+
+Constant *FloatExprAST::constCodegen() {
+	return ConstantFP::get(FType->getTy(), Val);
+}
+
+Constant *StructExprAST::constCodegen() {
+	vector<Constant*> vals;
+	for (unsigned i = 0; i < Vals.size(); i++) {
+		Constant *c = Vals[i]->constCodegen();
+		if (c == 0) return 0;
+		vals.push_back(c);
+	}
+	return ConstantStruct::get(cast<StructType>(EType->getTy()), vals);
+}
+
+Constant *ArrayExprAST::constCodegen() {
+	vector<Constant*> elems;
+	for (unsigned i = 0; i < Elems.size(); i++) {
+		Constant *c = Elems[i]->constCodegen();
+		if (c == 0) return 0;
+		elems.push_back(c);
+	}
+	return ConstantArray::get(cast<ArrayType>(EType->getTy()), elems);
+}
+
+Constant *CastExprAST::constCodegen() {
+	// arrays, vectors, atomics and f16/bf16 made of constants
+	if (!NeedCast || (dynamic_cast<ArrayTypeAST*>(FType) == 0 && dynamic_cast<VectorTypeAST*>(FType) == 0 &&
+			dynamic_cast<AtomicTypeAST*>(FType) == 0 && BaseTypeAST::isFloat(FType, true) == 0)) return 0;
+	Constant *c = Expr->constCodegen();
+	if (c == 0) return 0;
+	return dyn_cast_or_null<Constant>(FType->castCodegen(c, Expr->type(Ctx), Ctx));
+}
+
+Constant *VarExprAST::constCodegen() {
+	// functions are constants, their address is known
+	if (Sym == 0 || IsGlobalConst) return 0;
+	if (dynamic_cast<FuncDefAST*>(Sym->Def) != 0 || dynamic_cast<ExternFuncDefAST*>(Sym->Def) != 0) {
+		return dyn_cast_or_null<Constant>(Sym->llvmVal);
+	}
+	return 0;
+}
+
+
 // Functions AST
 
+// Lambdas. The function of a lambda is built once, the first time it is met. The
+// variables of enclosing functions that it uses are copied into an environment
+// when the lambda is evaluated, so that the closure may outlive them (assigning
+// one in the lambda changes the lambda's copy). The function takes the environment
+// as a 'nest' argument, and the value of the lambda is a trampoline that passes it :
+// a plain function pointer, that can be given wherever a function is expected.
+// Environments are allocated by the runtime, with the trampoline, and moved to the
+// stack when the closure does not escape (see Generator::closures). A lambda that
+// captures nothing is just its function, a constant.
+Function *FuncExprAST::lambdaFunction() {
+	if (Fn != 0) return Fn;
+
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	Type *i8p = Type::getInt8PtrTy(C);
+
+	// values known at compile time are used as they are
+	vector<Type*> envTypes;
+	for (unsigned i = 0; i < Captures.size(); i++) {
+		Value *v = Captures[i]->llvmVal;
+		if (v == 0 || !(isa<Instruction>(v) || isa<Argument>(v))) continue;
+		VarDefAST *vd = dynamic_cast<VarDefAST*>(Captures[i]->Def);
+		Env.push_back(Captures[i]);
+		envTypes.push_back(vd != 0 && vd->Var ? cast<PointerType>(v->getType())->getElementType() : v->getType());
+	}
+
+	FunctionType *ft = cast<FunctionType>(FType->getTy());
+	string name = "lambda";
+	if (BasicBlock *BB = builder.GetInsertBlock()) name = BB->getParent()->getName().str() + ".lambda";
+	if (Env.empty()) {
+		Fn = Function::Create(ft, Function::InternalLinkage, name, Ctx->Gen->TheModule);
+	} else {
+		EnvTy = StructType::get(C, envTypes);
+		vector<Type*> params;
+		params.push_back(i8p);
+		params.insert(params.end(), ft->param_begin(), ft->param_end());
+		Fn = Function::Create(FunctionType::get(ft->getReturnType(), params, false), Function::InternalLinkage,
+			name, Ctx->Gen->TheModule);
+		Fn->addAttribute(1, Attribute::Nest);
+	}
+
+	// the function is built apart from the one being built
+	IRBuilder<>::InsertPoint ip = builder.saveIP();
+	Value *retSlot = Ctx->Gen->RetSlot;
+	Value *genFrame = Ctx->Gen->GenFrame;
+	Ctx->Gen->GenFrame = 0;
+
+	builder.SetInsertPoint(BasicBlock::Create(C, "entry", Fn));
+	Function::arg_iterator ai = Fn->arg_begin();
+	vector<Value*> saved;
+	if (!Env.empty()) {
+		Value *envPtr = builder.CreateBitCast(ai++, PointerType::get(EnvTy, 0), "env");
+		for (unsigned i = 0; i < Env.size(); i++) {
+			saved.push_back(Env[i]->llvmVal);
+			VarDefAST *vd = dynamic_cast<VarDefAST*>(Env[i]->Def);
+			Value *field = builder.CreateStructGEP(envPtr, i, "captured");
+			Env[i]->llvmVal = (vd != 0 && vd->Var ? field : builder.CreateLoad(field, "captured"));
+		}
+	}
+	Ctx->Gen->RetSlot = 0;
+	if (FType->returnsByPointer()) Ctx->Gen->RetSlot = ai++;
+	for (unsigned i = 0; i != FType->Args.size(); i++, ai++) {
+		ai->setName(FType->Args[i]->Name);
+		Symbol *s = Ctx->NamedValues.back()->find(FType->Args[i]->Name)->second;
+		if (StructTypeAST::byPointer(FType->Args[i]->ArgType)) {
+			s->llvmVal = builder.CreateLoad(ai, FType->Args[i]->Name);
+		} else {
+			s->llvmVal = ai;
+		}
+	}
+
+	Code->Codegen();
+
+	if (builder.GetInsertBlock()->getTerminator() == 0) {
+		if (FType->ReturnType != VOIDTYPE) Tag.Throw("Lambda lacks a return statement.");
+		builder.CreateRetVoid();
+	}
+
+	for (unsigned i = 0; i < Env.size(); i++) {
+		Env[i]->llvmVal = saved[i];
+	}
+	Ctx->Gen->RetSlot = retSlot;
+	Ctx->Gen->GenFrame = genFrame;
+	builder.restoreIP(ip);
+
+	if (verifyFunction(*Fn)) Tag.Throw("Error in lambda...");
+	Ctx->Gen->FPM.run(*Fn);
+	return Fn;
+}
+
 Value *FuncExprAST::Codegen() {
-	throw new InternalError("Lambda functions not implemented.");
+	Function *fn = lambdaFunction();
+	if (Env.empty()) return fn;
+
+	IRBuilder<> &builder = Ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	Module *mod = Ctx->Gen->TheModule;
+	Type *i8p = Type::getInt8PtrTy(C);
+	Type *ity = INTTYPE->getTy();
+
+	Type *args[1] = { ity };
+	Constant *newf = mod->getOrInsertFunction("pif_closure_new", FunctionType::get(i8p, args, false));
+	Value *block = builder.CreateCall(newf,
+		ConstantInt::get(ity, Ctx->Gen->ExecEng->getTargetData()->getTypeAllocSize(EnvTy)), "closure");
+	Value *env = builder.CreateConstGEP1_32(block, CLOSURE_ENV, "env");
+	Value *envPtr = builder.CreateBitCast(env, PointerType::get(EnvTy, 0));
+	for (unsigned i = 0; i < Env.size(); i++) {
+		VarDefAST *vd = dynamic_cast<VarDefAST*>(Env[i]->Def);
+		Value *v = Env[i]->llvmVal;
+		if (vd != 0 && vd->Var) v = builder.CreateLoad(v, vd->Name);
+		builder.CreateStore(v, builder.CreateStructGEP(envPtr, i));
+	}
+
+	// the trampoline is written in the block, and called at the block's executable address
+	builder.CreateCall3(Intrinsic::getDeclaration(mod, Intrinsic::init_trampoline),
+		block, ConstantExpr::getBitCast(fn, i8p), env);
+	Type *codeArgs[1] = { i8p };
+	Constant *codef = mod->getOrInsertFunction("pif_closure_code", FunctionType::get(i8p, codeArgs, false));
+	if (Function *f = dyn_cast<Function>(codef)) f->setOnlyReadsMemory();
+	Value *code = builder.CreateCall(codef, block, "code");
+	Value *tramp = builder.CreateCall(Intrinsic::getDeclaration(mod, Intrinsic::adjust_trampoline), code, "trampoline");
+	return builder.CreateBitCast(tramp, PointerType::get(FType->getTy(), 0), "lambda");
+}
+
+// Lambdas are constants when they capture nothing
+Constant *FuncExprAST::constCodegen() {
+	if (!Lambda || !Captures.empty()) return 0;
+	return lambdaFunction();
 }
 
 Value *ExternAST::Codegen() {
@@ -376,6 +1571,10 @@ Value *ExternAST::Codegen() {
 				throw new PIFError("Redefinition of extern function '" + Symbol + "' with different argument count.");
 			}
 		}
+		if (Generator::isMathFunction(f)) {
+			f->setDoesNotAccessMemory();
+			f->setDoesNotThrow();
+		}
 		return f;
 	}
 	throw new InternalError("Extern symbols that are not functions are not supported yet.");
@@ -1,6 +1,7 @@
 #include "../ast/stmt.h"
 #include "Generator.h"
 #include "../Package.h"
+#include "../error.h"
 
 using namespace llvm;
 using namespace std;
@@ -55,6 +56,80 @@ FuncTypeAST *FuncTypeAST::Get(const std::vector<FuncArgAST*> &args, TypeAST* ret
 	return funcTypes[id];
 }
 
+map<pair<pair<TypeAST*, INT>, bool>, ArrayTypeAST*> arrayTypes;
+ArrayTypeAST *ArrayTypeAST::Get(TypeAST *elem, INT length, bool soa) {
+	pair<pair<TypeAST*, INT>, bool> id(make_pair(elem, length), soa);
+	if (arrayTypes.count(id) == 0) {
+		arrayTypes[id] = new ArrayTypeAST(elem, length, soa);
+	}
+	return arrayTypes[id];
+}
+
+map<TypeAST*, SliceTypeAST*> sliceTypes;
+SliceTypeAST *SliceTypeAST::Get(TypeAST *elem) {
+	if (sliceTypes.count(elem) == 0) {
+		sliceTypes[elem] = new SliceTypeAST(elem);
+	}
+	return sliceTypes[elem];
+}
+
+map<TypeAST*, AtomicTypeAST*> atomicTypes;
+AtomicTypeAST *AtomicTypeAST::Get(TypeAST *val) {
+	if (atomicTypes.count(val) == 0) {
+		atomicTypes[val] = new AtomicTypeAST(val);
+	}
+	return atomicTypes[val];
+}
+
+map<TypeAST*, ChanTypeAST*> chanTypes;
+ChanTypeAST *ChanTypeAST::Get(TypeAST *elem) {
+	if (chanTypes.count(elem) == 0) {
+		chanTypes[elem] = new ChanTypeAST(elem);
+	}
+	return chanTypes[elem];
+}
+
+map<TypeAST*, TaskTypeAST*> taskTypes;
+TaskTypeAST *TaskTypeAST::Get(TypeAST *result) {
+	if (taskTypes.count(result) == 0) {
+		taskTypes[result] = new TaskTypeAST(result);
+	}
+	return taskTypes[result];
+}
+
+map<vector<pair<string, TypeAST*> >, StructTypeAST*> structTypes;
+StructTypeAST *StructTypeAST::Get(const vector<pair<string, TypeAST*> > &fields) {
+	if (structTypes.count(fields) == 0) {
+		structTypes[fields] = new StructTypeAST(fields);
+	}
+	return structTypes[fields];
+}
+
+map<TypeAST*, GenTypeAST*> genTypes;
+GenTypeAST *GenTypeAST::Get(TypeAST *yield) {
+	if (genTypes.count(yield) == 0) {
+		genTypes[yield] = new GenTypeAST(yield);
+	}
+	return genTypes[yield];
+}
+
+map<pair<TypeAST*, unsigned>, VectorTypeAST*> vectorTypes;
+VectorTypeAST *VectorTypeAST::Get(TypeAST *elem, unsigned width) {
+	pair<TypeAST*, unsigned> id(elem, width);
+	if (vectorTypes.count(id) == 0) {
+		vectorTypes[id] = new VectorTypeAST(elem, width);
+	}
+	return vectorTypes[id];
+}
+
+map<string, TypeParamAST*> typeParams;
+TypeParamAST *TypeParamAST::Get(const string &name) {
+	if (typeParams.count(name) == 0) {
+		typeParams[name] = new TypeParamAST(name);
+	}
+	return typeParams[name];
+}
+
 // Get LLVM type from TypeAST 
 
 Type *PackageTypeAST::getTy() {
@@ -65,6 +140,8 @@ Type *PackageTypeAST::getTy() {
 Type *BaseTypeAST::getTy() {
 	if (BaseType == bt_bool) return Type::getInt1Ty(getGlobalContext());
 	if (BaseType == bt_float) return Type::getDoubleTy(getGlobalContext());
+	if (BaseType == bt_f32) return Type::getFloatTy(getGlobalContext());
+	if (BaseType == bt_f16 || BaseType == bt_bf16) return Type::getInt16Ty(getGlobalContext());		// bits of the value
 	return Type::getVoidTy(getGlobalContext());
 }
 
@@ -73,18 +150,101 @@ Type *IntTypeAST::getTy() {
 	return Type::getIntNTy(getGlobalContext(), Size);
 }
 
+// Records too large for registers are passed as the address of a copy, and returned
+// in memory given by the caller as a hidden first argument (see Generator::emitCall)
 Type *FuncTypeAST::getTy() {
 	vector<Type*> ArgsTy;
+	bool sret = returnsByPointer();
+	if (sret) ArgsTy.push_back(PointerType::get(ReturnType->getTy(), 0));
 	for (unsigned i = 0; i < Args.size(); i++) {
-		ArgsTy.push_back(Args[i]->ArgType->getTy());
+		Type *t = Args[i]->ArgType->getTy();
+		ArgsTy.push_back(StructTypeAST::byPointer(Args[i]->ArgType) ? PointerType::get(t, 0) : t);
 	}
-	return FunctionType::get(ReturnType->getTy(), ArgsTy, false);
+	return FunctionType::get(sret ? Type::getVoidTy(getGlobalContext()) : ReturnType->getTy(), ArgsTy, false);
+}
+
+bool FuncTypeAST::returnsByPointer() {
+	return StructTypeAST::byPointer(ReturnType);
 }
 
 Type *RefTypeAST::getTy() {
 	return PointerType::get(VType->getTy(), 0);
 }
 
+Type *ArrayTypeAST::getTy() {
+	if (SoA) {
+		// a record of arrays
+		StructType *st = cast<StructType>(ElemType->getTy());
+		vector<Type*> columns;
+		for (unsigned i = 0; i < st->getNumElements(); i++) {
+			columns.push_back(ArrayType::get(st->getElementType(i), Length));
+		}
+		return StructType::get(getGlobalContext(), columns);
+	}
+	return ArrayType::get(ElemType->getTy(), Length);
+}
+
+Type *VectorTypeAST::getTy() {
+	return VectorType::get(ElemType->getTy(), Width);
+}
+
+Type *AtomicTypeAST::getTy() {
+	// same representation, only the instructions used to access it are different
+	return ValType->getTy();
+}
+
+Type *ChanTypeAST::getTy() {
+	// the channel is allocated by the runtime, see runtime/chan.cpp
+	return Type::getInt8PtrTy(getGlobalContext());
+}
+
+Type *TaskTypeAST::getTy() {
+	// address of the data of the task record, see runtime/sched.cpp
+	return Type::getInt8PtrTy(getGlobalContext());
+}
+
+Type *StructTypeAST::getTy() {
+	vector<Type*> fields;
+	for (unsigned i = 0; i < Fields.size(); i++) {
+		fields.push_back(Fields[i].second->getTy());
+	}
+	return StructType::get(getGlobalContext(), fields);
+}
+
+// Size of the data of a type, without padding
+static uint64_t dataSize(Type *t) {
+	if (t->isPointerTy()) return sizeof(void*);
+	if (StructType *st = dyn_cast<StructType>(t)) {
+		uint64_t s = 0;
+		for (unsigned i = 0; i < st->getNumElements(); i++) s += dataSize(st->getElementType(i));
+		return s;
+	}
+	if (ArrayType *at = dyn_cast<ArrayType>(t)) return at->getNumElements() * dataSize(at->getElementType());
+	return (t->getPrimitiveSizeInBits() + 7) / 8;
+}
+
+// Records that do not fit in two registers are passed in memory
+bool StructTypeAST::byPointer(TypeAST *t) {
+	StructTypeAST *st = dynamic_cast<StructTypeAST*>(t);
+	return (st != 0 && dataSize(st->getTy()) > 2 * sizeof(void*));
+}
+
+Type *GenTypeAST::getTy() {
+	// address of the frame of the generator, see Generator::buildGenerator
+	return Type::getInt8PtrTy(getGlobalContext());
+}
+
+Type *TypeParamAST::getTy() {
+	// only instances of generic functions are generated
+	throw new PIFError("Generic functions can only be called, their type parameter '" + Name + "' has no llvm type.");
+}
+
+Type *SliceTypeAST::getTy() {
+	// { pointer to first element, length }
+	Type *fields[2] = { PointerType::get(ElemType->getTy(), 0), INTTYPE->getTy() };
+	return StructType::get(getGlobalContext(), fields);
+}
+
 
 // Cast operations
 
@@ -95,24 +255,74 @@ Value *TypeAST::castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx) {
 	return 0;
 }
 
+// f16 and bf16 values are kept as their bits (i16), and converted from and to f32.
+// f16 uses the conversion intrinsics. bf16 is the upper half of an f32, rounded to
+// nearest even. Constants are converted now.
+static Value *halfToF32(Context *ctx, Value *v, BaseTypeE bt) {
+	IRBuilder<> &builder = ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	if (ConstantInt *ci = dyn_cast<ConstantInt>(v)) {
+		APFloat f(bt == bt_f16 ? ci->getValue() : APInt(32, ci->getZExtValue() << 16));
+		bool lost;
+		f.convert(APFloat::IEEEsingle, APFloat::rmNearestTiesToEven, &lost);
+		return ConstantFP::get(C, f);
+	}
+	if (bt == bt_f16) {
+		return builder.CreateCall(Intrinsic::getDeclaration(ctx->Gen->TheModule, Intrinsic::convert_from_fp16), v, "f16tof32");
+	}
+	Value *bits = builder.CreateShl(builder.CreateZExt(v, Type::getInt32Ty(C)), 16, "bf16bits");
+	return builder.CreateBitCast(bits, Type::getFloatTy(C), "bf16tof32");
+}
+
+static Value *f32ToHalf(Context *ctx, Value *v, BaseTypeE bt) {
+	IRBuilder<> &builder = ctx->Gen->Builder;
+	LLVMContext &C = getGlobalContext();
+	if (ConstantFP *cf = dyn_cast<ConstantFP>(v)) {
+		APFloat f = cf->getValueAPF();
+		bool lost;
+		if (bt == bt_f16) {
+			f.convert(APFloat::IEEEhalf, APFloat::rmNearestTiesToEven, &lost);
+			return ConstantInt::get(C, f.bitcastToAPInt());
+		}
+		uint32_t bits = f.bitcastToAPInt().getZExtValue();
+		return ConstantInt::get(Type::getInt16Ty(C), (bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+	}
+	if (bt == bt_f16) {
+		return builder.CreateCall(Intrinsic::getDeclaration(ctx->Gen->TheModule, Intrinsic::convert_to_fp16), v, "f32tof16");
+	}
+	Type *i32 = Type::getInt32Ty(C);
+	Value *bits = builder.CreateBitCast(v, i32, "f32bits");
+	Value *odd = builder.CreateAnd(builder.CreateLShr(bits, 16), ConstantInt::get(i32, 1), "odd");
+	Value *rounded = builder.CreateAdd(bits, builder.CreateAdd(odd, ConstantInt::get(i32, 0x7FFF)), "rounded");
+	return builder.CreateTrunc(builder.CreateLShr(rounded, 16), Type::getInt16Ty(C), "f32tobf16");
+}
+
 Value *BaseTypeAST::castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx) {
-	if (BaseType != bt_float) return 0;
+	if (isFloat(this, true) == 0) return 0;
+	IRBuilder<> &builder = ctx->Gen->Builder;
 
 	IntTypeAST *fromi = dynamic_cast<IntTypeAST*>(origType);
-	if (fromi == 0) return 0;
+	BaseTypeAST *fromf = isFloat(origType, true);
+	if (fromi == 0 && fromf == 0) return 0;
 
-	if (fromi->Signed) {
-		return ctx->Gen->Builder.CreateSIToFP(v, this->getTy(), "sitofptmp");
-	} else {
-		return ctx->Gen->Builder.CreateUIToFP(v, this->getTy(), "uitofptmp");
+	// f16 and bf16 go through f32
+	if (fromf != 0 && isFloat(fromf) == 0) v = halfToF32(ctx, v, fromf->BaseType);
+	Type *t = (isFloat(this) != 0 ? this->getTy() : Type::getFloatTy(getGlobalContext()));
+
+	if (fromi != 0) {
+		v = (fromi->Signed ? builder.CreateSIToFP(v, t, "sitofptmp") : builder.CreateUIToFP(v, t, "uitofptmp"));
+	} else if (v->getType() != t) {
+		v = builder.CreateFPCast(v, t, "fptofptmp");
 	}
+	if (isFloat(this) == 0) v = f32ToHalf(ctx, v, BaseType);
+	return v;
 }
 
 Value *IntTypeAST::castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx) {
 	if (dynamic_cast<IntTypeAST*>(origType) != 0) {
 		return ctx->Gen->Builder.CreateIntCast(v, this->getTy(), Signed, "itoitmp");
-	} else if (BaseTypeAST *frombt = dynamic_cast<BaseTypeAST*>(origType)) {
-		if (frombt->BaseType != bt_float) return 0;
+	} else if (BaseTypeAST *frombt = BaseTypeAST::isFloat(origType, true)) {
+		if (BaseTypeAST::isFloat(frombt) == 0) v = halfToF32(ctx, v, frombt->BaseType);
 		if (Signed) {
 			return ctx->Gen->Builder.CreateFPToSI(v, this->getTy(), "fptositmp");
 		} else {
@@ -122,3 +332,189 @@ Value *IntTypeAST::castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx)
 		return 0;
 	}
 }
+
+// Copy the records of array src to array dst (both in memory), one of them being soa
+static void copyLayout(Context *ctx, Value *src, bool srcSoA, Value *dst, unsigned fields, INT length) {
+	IRBuilder<> &builder = ctx->Gen->Builder;
+	Type *ity = INTTYPE->getTy();
+	Type *i32 = Type::getInt32Ty(getGlobalContext());
+
+	Function *fun = builder.GetInsertBlock()->getParent();
+	BasicBlock *PrevBB = builder.GetInsertBlock();
+	BasicBlock *LoopBB = BasicBlock::Create(getGlobalContext(), "layout", fun);
+	BasicBlock *AfterBB = BasicBlock::Create(getGlobalContext(), "layoutcont", fun);
+	builder.CreateBr(LoopBB);
+
+	builder.SetInsertPoint(LoopBB);
+	PHINode *i = builder.CreatePHI(ity, 2, "i");
+	i->addIncoming(ConstantInt::get(ity, 0), PrevBB);
+	for (unsigned f = 0; f < fields; f++) {
+		Value *aos[3] = { ConstantInt::get(ity, 0), i, ConstantInt::get(i32, f) };
+		Value *soa[3] = { ConstantInt::get(ity, 0), ConstantInt::get(i32, f), i };
+		Value *from = builder.CreateInBoundsGEP(src, (srcSoA ? soa : aos), "fieldptr");
+		Value *to = builder.CreateInBoundsGEP(dst, (srcSoA ? aos : soa), "fieldptr");
+		builder.CreateStore(builder.CreateLoad(from, "field"), to);
+	}
+	Value *next = builder.CreateAdd(i, ConstantInt::get(ity, 1), "inext");
+	i->addIncoming(next, LoopBB);
+	builder.CreateCondBr(builder.CreateICmpULT(next, ConstantInt::get(ity, length)), LoopBB, AfterBB);
+
+	builder.SetInsertPoint(AfterBB);
+}
+
+// Fill an array with copies of a value, or change the layout of an array of records
+Value *ArrayTypeAST::castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx) {
+	if (ArrayTypeAST *from = dynamic_cast<ArrayTypeAST*>(origType)) {
+		if (from->ElemType != ElemType || from->Length != Length || from->SoA == SoA) return 0;
+		unsigned fields = cast<StructType>(ElemType->getTy())->getNumElements();
+		if (Constant *c = dyn_cast<Constant>(v)) {
+			vector<Constant*> elems;
+			for (INT i = 0; i < (SoA ? (INT)fields : Length); i++) {
+				vector<Constant*> parts;
+				for (INT j = 0; j < (SoA ? Length : (INT)fields); j++) {
+					unsigned idx[2] = { (unsigned)j, (unsigned)i };
+					parts.push_back(ConstantExpr::getExtractValue(c, idx));
+				}
+				elems.push_back(SoA ? (Constant*)ConstantArray::get(ArrayType::get(parts[0]->getType(), Length), parts)
+					: ConstantStruct::get(cast<StructType>(ElemType->getTy()), parts));
+			}
+			if (SoA) return ConstantStruct::get(cast<StructType>(getTy()), elems);
+			return ConstantArray::get(cast<ArrayType>(getTy()), elems);
+		}
+		IRBuilder<> &builder = ctx->Gen->Builder;
+		Value *src = ctx->Gen->entryAlloca(v->getType(), "layouttmp");
+		Value *dst = ctx->Gen->entryAlloca(getTy(), "layouttmp");
+		builder.CreateStore(v, src);
+		copyLayout(ctx, src, from->SoA, dst, fields, Length);
+		return builder.CreateLoad(dst, "relaid");
+	}
+
+	if (origType != ElemType) return 0;
+
+	if (SoA) {
+		// fill each field array with the value of the field
+		StructTypeAST *st = dynamic_cast<StructTypeAST*>(ElemType);
+		vector<Value*> columns;
+		bool isConst = true;
+		for (unsigned i = 0; i < st->Fields.size(); i++) {
+			TypeAST *ft = st->Fields[i].second;
+			Value *f;
+			if (Constant *c = dyn_cast<Constant>(v)) {
+				unsigned idx[1] = { i };
+				f = ConstantExpr::getExtractValue(c, idx);
+			} else {
+				f = ctx->Gen->Builder.CreateExtractValue(v, i, st->Fields[i].first);
+			}
+			columns.push_back(ArrayTypeAST::Get(ft, Length)->castCodegen(f, ft, ctx));
+			if (!isa<Constant>(columns.back())) isConst = false;
+		}
+		if (isConst) {
+			vector<Constant*> consts;
+			for (unsigned i = 0; i < columns.size(); i++) consts.push_back(cast<Constant>(columns[i]));
+			return ConstantStruct::get(cast<StructType>(getTy()), consts);
+		}
+		Value *r = UndefValue::get(getTy());
+		for (unsigned i = 0; i < columns.size(); i++) {
+			r = ctx->Gen->Builder.CreateInsertValue(r, columns[i], i, "filled");
+		}
+		return r;
+	}
+
+	ArrayType *at = cast<ArrayType>(getTy());
+	if (Constant *c = dyn_cast<Constant>(v)) {
+		if (c->isNullValue()) return ConstantAggregateZero::get(at);
+		vector<Constant*> elems(Length, c);
+		return ConstantArray::get(at, elems);
+	}
+
+	// not a constant : fill a temporary with a loop
+	IRBuilder<> &builder = ctx->Gen->Builder;
+	Type *ity = INTTYPE->getTy();
+	Value *mem = ctx->Gen->entryAlloca(at, "filltmp");
+
+	Function *fun = builder.GetInsertBlock()->getParent();
+	BasicBlock *PrevBB = builder.GetInsertBlock();
+	BasicBlock *LoopBB = BasicBlock::Create(getGlobalContext(), "fill", fun);
+	BasicBlock *AfterBB = BasicBlock::Create(getGlobalContext(), "fillcont", fun);
+	builder.CreateBr(LoopBB);
+
+	builder.SetInsertPoint(LoopBB);
+	PHINode *i = builder.CreatePHI(ity, 2, "i");
+	i->addIncoming(ConstantInt::get(ity, 0), PrevBB);
+	Value *idx[2] = { ConstantInt::get(ity, 0), i };
+	builder.CreateStore(v, builder.CreateInBoundsGEP(mem, idx, "fillptr"));
+	Value *next = builder.CreateAdd(i, ConstantInt::get(ity, 1), "inext");
+	i->addIncoming(next, LoopBB);
+	builder.CreateCondBr(builder.CreateICmpULT(next, ConstantInt::get(ity, Length)), LoopBB, AfterBB);
+
+	builder.SetInsertPoint(AfterBB);
+	return builder.CreateLoad(mem, "filled");
+}
+
+// Vectors : broadcast of a scalar, lanes of an array, first elements of a slice,
+// or conversion of the elements of another vector
+Value *VectorTypeAST::castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx) {
+	IRBuilder<> &builder = ctx->Gen->Builder;
+	Type *i32 = Type::getInt32Ty(getGlobalContext());
+	VectorType *vty = cast<VectorType>(getTy());
+
+	if (origType == ElemType) {
+		if (Constant *c = dyn_cast<Constant>(v)) {
+			vector<Constant*> lanes(Width, c);
+			return ConstantVector::get(lanes);
+		}
+		Value *one = builder.CreateInsertElement(UndefValue::get(vty), v, ConstantInt::get(i32, 0), "splat");
+		return builder.CreateShuffleVector(one, UndefValue::get(vty),
+			ConstantAggregateZero::get(VectorType::get(i32, Width)), "splat");
+	}
+
+	if (ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(origType)) {
+		if (at->ElemType != ElemType || at->Length != Width) return 0;
+		if (Constant *c = dyn_cast<Constant>(v)) {
+			vector<Constant*> lanes;
+			for (unsigned i = 0; i < Width; i++) {
+				unsigned idx[1] = { i };
+				lanes.push_back(ConstantExpr::getExtractValue(c, idx));
+			}
+			return ConstantVector::get(lanes);
+		}
+		Value *r = UndefValue::get(vty);
+		for (unsigned i = 0; i < Width; i++) {
+			Value *e = builder.CreateExtractValue(v, i, "lane");
+			r = builder.CreateInsertElement(r, e, ConstantInt::get(i32, i), "vectmp");
+		}
+		return r;
+	}
+
+	if (SliceTypeAST *st = dynamic_cast<SliceTypeAST*>(origType)) {
+		if (st->ElemType != ElemType) return 0;
+		ctx->Gen->boundsCheck(ConstantInt::get(INTTYPE->getTy(), Width), builder.CreateExtractValue(v, 1, "len"), true, FTag());
+		Value *p = builder.CreateBitCast(builder.CreateExtractValue(v, 0, "ptr"), PointerType::get(vty, 0), "vecptr");
+		LoadInst *l = builder.CreateLoad(p, "vecload");
+		l->setAlignment(ctx->Gen->ExecEng->getTargetData()->getABITypeAlignment(ElemType->getTy()));
+		return l;
+	}
+
+	if (VectorTypeAST *fv = dynamic_cast<VectorTypeAST*>(origType)) {
+		if (fv->Width != Width) return 0;
+		IntTypeAST *fi = dynamic_cast<IntTypeAST*>(fv->ElemType), *ti = dynamic_cast<IntTypeAST*>(ElemType);
+		if (fi != 0 && ti != 0) {
+			return builder.CreateIntCast(v, vty, fi->Signed, "itoitmp");
+		} else if (fi != 0 && BaseTypeAST::isFloat(ElemType) != 0) {
+			if (fi->Signed) return builder.CreateSIToFP(v, vty, "sitofptmp");
+			return builder.CreateUIToFP(v, vty, "uitofptmp");
+		} else if (BaseTypeAST::isFloat(fv->ElemType) != 0 && ti != 0) {
+			if (ti->Signed) return builder.CreateFPToSI(v, vty, "fptositmp");
+			return builder.CreateFPToUI(v, vty, "fptouitmp");
+		} else if (BaseTypeAST::isFloat(fv->ElemType) != 0 && BaseTypeAST::isFloat(ElemType) != 0) {
+			return builder.CreateFPCast(v, vty, "fptofptmp");
+		}
+	}
+	return 0;
+}
+
+// Atomics : made from a plain value of their type
+Value *AtomicTypeAST::castCodegen(llvm::Value *v, TypeAST *origType, Context *ctx) {
+	if (origType == ValType) return v;
+	return 0;
+}
@@ -16,19 +16,39 @@ void FTag::Throw(string m, PIFError *p) const {
 	throw new LangError(*this, m, p);
 }
 
+void FTag::Warn(string m) const {
+	cerr << str() << " Warning: " << m << endl;
+}
+
 //
 
 
-Lexer::Lexer(std::string file, std::istream &in) : File(file), In(in) {
+Lexer::Lexer(std::string file, std::istream &in, int line) : File(file), In(in) {
 	LastChar = ' ';
-	Line = 1;
-	gettok();
+	Line = line;
+	Record = 0;
 
 	MultiCharOps.insert("==");
 	MultiCharOps.insert("!=");
 	MultiCharOps.insert(">=");
 	MultiCharOps.insert("<=");
 	MultiCharOps.insert("->");
+	MultiCharOps.insert("..");
+
+	gettok();
+}
+
+int Lexer::next() {
+	int c = In.get();
+	if (Record != 0 && c != EOF) *Record += (char)c;
+	return c;
+}
+
+// Keep the text read from now on, starting with the character after the current token
+// (see Parser::ParseGenericDefinition). Lexing it again from line() gives the same tokens.
+void Lexer::record(std::string *text) {
+	Record = text;
+	if (Record != 0 && LastChar != EOF) *Record += (char)LastChar;
 }
 
 Token Lexer::gettok() {
@@ -36,12 +56,12 @@ Token Lexer::gettok() {
 
 	while (isspace(LastChar)) {
 		if (LastChar == '\n') Line++;
-		LastChar = In.get();
+		LastChar = next();
 	}
 	
 	if (isalpha(LastChar) || LastChar == '_') {
 		tokStr = LastChar;
-		while (isalnum(LastChar = In.get()) || LastChar == '_')
+		while (isalnum(LastChar = next()) || LastChar == '_')
 			tokStr += LastChar;
 
 		tok = tok_identifier;
@@ -58,28 +78,45 @@ Token Lexer::gettok() {
 		if (tokStr == "func") tok = tok_func;
 
 		if (tokStr == "return") tok = tok_return;
+		if (tokStr == "yield") tok = tok_yield;
 		if (tokStr == "if") tok = tok_if;
 		if (tokStr == "then") tok = tok_then;
 		if (tokStr == "else") tok = tok_else;
 		if (tokStr == "while") tok = tok_while;
 		if (tokStr == "until") tok = tok_until;
 		if (tokStr == "do") tok = tok_do;
+		if (tokStr == "for") tok = tok_for;
+		if (tokStr == "parallel") tok = tok_parallel;
+		if (tokStr == "spawn") tok = tok_spawn;
+		if (tokStr == "join") tok = tok_join;
+		if (tokStr == "fence") tok = tok_fence;
+		if (tokStr == "chan") tok = tok_chan;
+		if (tokStr == "relaxed" || tokStr == "acquire" || tokStr == "release" ||
+			tokStr == "acq_rel" || tokStr == "seq_cst") tok = tok_ordering;
 		if (tokStr == "break") tok = tok_break;
 		if (tokStr == "continue") tok = tok_continue;
-	} else if (isdigit(LastChar) || LastChar == '.') {
+	} else if (isdigit(LastChar) || (LastChar == '.' && isdigit(In.peek()))) {
 		tokStr = "";
 		bool is_float = false;
 		do {
 			tokStr += LastChar;
 			if (LastChar == '.') is_float = true;
-			LastChar = In.get();
-		} while (isdigit(LastChar) || LastChar == '.');
+			LastChar = next();
+		} while (isdigit(LastChar) || (LastChar == '.' && !is_float && In.peek() != '.'));	// '0..n' is a range
+		if ((LastChar == 'e' || LastChar == 'E') && (isdigit(In.peek()) || In.peek() == '-' || In.peek() == '+')) {
+			// exponent : 1.5e-10
+			is_float = true;
+			do {
+				tokStr += LastChar;
+				LastChar = next();
+			} while (isdigit(LastChar) || ((LastChar == '-' || LastChar == '+') && tolower(tokStr[tokStr.size() - 1]) == 'e'));
+		}
 		tokFloat = atof(tokStr.c_str());
 		tokInt = atol(tokStr.c_str());
 		tok = (is_float ? tok_float : tok_int);
 	} else if (LastChar == '#') {
 		do {
-			LastChar = In.get();
+			LastChar = next();
 		} while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
 
 		if (LastChar != EOF) gettok();
@@ -89,7 +126,7 @@ Token Lexer::gettok() {
 		tok = tok_operator;
 		tokStr = LastChar;
 		while (1) {
-			LastChar = In.get();
+			LastChar = next();
 			std::string NewStr = tokStr;
 			NewStr += LastChar;
 			if (MultiCharOps.count(NewStr) > 0) {
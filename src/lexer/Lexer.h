@@ -28,12 +28,20 @@ enum Token {
 	tok_func,
 	
 	tok_return,
+	tok_yield,
 	tok_if,
 	tok_then,
 	tok_else,
 	tok_while,
 	tok_until,
 	tok_do,
+	tok_for,
+	tok_parallel,
+	tok_spawn,
+	tok_join,
+	tok_fence,
+	tok_chan,
+	tok_ordering,		// memory orderings : relaxed, acquire, release, acq_rel, seq_cst
 	tok_break,
 	tok_continue,
 };
@@ -54,6 +62,7 @@ class FTag {			// Identifies a position in a file
 
 	void Throw(std::string message) const;
 	void Throw(std::string message, PIFError *p) const;
+	void Warn(std::string message) const;
 };
 
 class Lexer {
@@ -66,10 +75,17 @@ class Lexer {
 	int LastChar;
 	int Line;
 
+	std::string *Record;		// when not 0, the characters read are appended there
+
+	int next();
+
 	public:
-	Lexer(std::string file, std::istream &in);
+	Lexer(std::string file, std::istream &in, int line = 1);
 
 	Token gettok();
+	void record(std::string *text);
+	std::string file() { return File; }
+	int line() { return Line; }
 
 	std::string tokStr;
 	FLOAT tokFloat;
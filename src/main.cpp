@@ -5,8 +5,10 @@
 #include <stdlib.h>
 
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetOptions.h>
 
 #include "codegen-llvm/Generator.h"
+#include "Batch.h"
 
 #include "util.h"
 #include "error.h"
@@ -28,15 +30,38 @@ extern "C" void print_nl() {
 	cout << endl;
 }
 
+// checks of test programs (see packages/test) : the exit status tells whether one failed
+static int checksFailed = 0;
+extern "C" void check_failed(INT n) {
+	cout << endl << "CHECK " << n << " FAILED" << endl;
+	checksFailed++;
+}
+
 int main(int argc, char *argv[]) {
 	cout << endl << "PIF compiler version 0.1 - adnab.fr.nf 2012" << endl << endl;
 
 	ArgParser args(argc, argv);
 	args.addStr("-d", DEFAULT_DEBUG);
+	args.addBool("-batch");
+	args.addStr("-j", "1");
+	args.addBool("-ffast-math");
 
 	DEBUGLevel = atoi(args.getStr("-d").c_str());
+	int jobs = atoi(args.getStr("-j").c_str());
+	if (jobs < 1) {
+		cerr << "-j expects a number of threads, at least 1." << endl;
+		return 1;
+	}
 
 	Generator *gen = new Generator();
+	gen->IsolateGlobals = (args.getBool("-batch") && jobs > 1);
+	if (args.getBool("-ffast-math")) {
+		// the front end rewrites float operations, the back end may too
+		gen->FastMath = true;
+		llvm::UnsafeFPMath = true;
+		llvm::NoInfsFPMath = true;
+		llvm::NoNaNsFPMath = true;
+	}
 	Package *pkg = new Package(gen, "_");		// Interpreter context
 
 	const vector<string> &pkgs = args.getParams();
@@ -45,7 +70,19 @@ int main(int argc, char *argv[]) {
 		cout << "Options:" << endl;
 		cout << "    -d <debug_level>\tVerbosity level for debug information (default: " << DEFAULT_DEBUG << ")" << endl;
 		cout << "\t\t\tSee source in config.h for detailed info about debug level." << endl;
+		cout << "    -batch\t\tCompile all packages first (sharing common dependencies), then run them" << endl;
+		cout << "\t\t\tand report results and timings for each of them." << endl;
+		cout << "    -j <threads>\tIn batch mode, number of programs to run concurrently (default: 1)." << endl;
+		cout << "    -ffast-math\t\tLet float operations be reordered and simplified as if they were exact," << endl;
+		cout << "\t\t\tin all packages (see 'fastmath func' and 'fastmath package')." << endl;
 		cout << endl;
+	} else if (args.getBool("-batch")) {
+		Batch batch(gen, pkg);
+		for (unsigned i = 0; i < pkgs.size(); i++) {
+			batch.add(pkgs[i]);
+		}
+		batch.run(jobs);
+		batch.report(cout);
 	} else {
 		try {
 			for (unsigned i = 0; i < pkgs.size(); i++) {
@@ -54,6 +91,7 @@ int main(int argc, char *argv[]) {
 		} catch (PIFError *e) {
 			e->disp();
 			cerr << "KYAAAA ! IT DIDN'T COMPILE !!" << endl;
+			checksFailed++;
 		}
 	}
 
@@ -61,6 +99,6 @@ int main(int argc, char *argv[]) {
 	llvm::raw_fd_ostream out("dump.llvm", err, 0);
 	gen->TheModule->print(out, 0);
 
-	return 0;
+	return (checksFailed > 0 ? 1 : 0);
 }
 
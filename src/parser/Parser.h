@@ -9,6 +9,7 @@ class Parser {
 	private:
 	Lexer &Lex;
 	std::map<std::string, int> BinopPrecedence;
+	std::map<std::string, TypeAST*> &Types;		// named types of the package
 
 	ExprAST *ParseBoolExpr();
 	ExprAST *ParseIntExpr();
@@ -20,20 +21,31 @@ class Parser {
 	ExprAST *ParseBinOpRHS(int ExprPrec, ExprAST *LHS);
 	ExprAST *ParseDotMember(ExprAST *obj);
 	ExprAST *ParseCall(ExprAST *callee);
+	std::vector<ExprAST*> ParseArgs();
+	ExprAST *ParseIndex(ExprAST *obj);
+	ExprAST *ParseArrayExpr();
 	ExprAST *ParseExtern();
 	ExprAST *ParseIfThenElse();
 	ExprAST *ParseWhile();
+	ExprAST *ParseFor(bool parallel);
+	ExprAST *ParseSpawnJoin();
+	ExprAST *ParseFence();
+	ExprAST *ParseNewChan();
+	ExprAST *ParseLambda();
 
 	ExprAST *ParseBlock();
 
 	ExprAST *ParseExpression();
 
 	TypeAST *ParseType();
+	TypeAST *ParseStructType();
 	FuncArgAST *ParseFuncArg();
 	FuncTypeAST *ParsePrototype();
 
+	DefAST *ParseGenericDefinition(const FTag &tag, const std::string &name);
+
 	public:
-	Parser(Lexer &l) : Lex(l) {
+	Parser(Lexer &l, std::map<std::string, TypeAST*> &types) : Lex(l), Types(types) {
 		setBinopPrec("=", 2);
 		setBinopPrec("||", 10);
 		setBinopPrec("&&", 10);
@@ -51,12 +63,16 @@ class Parser {
 		setBinopPrec("%", 60);
 		setBinopPrec(":", 80);
 		setBinopPrec("(", 100); // Everything above 100 has priority over a function-call expression
+		setBinopPrec("[", 100);
 		setBinopPrec(".", 120);
 		setBinopPrec("@", 130);
 	}
 
+	DefAST *ParseDefinition();
 	DefAST *ParseVarDefinition();
 	DefAST *ParseFuncDefinition();
+	DefAST *ParseFuncBody(const FTag &tag, const std::string &name);
+	void ParseTypeDefinition();
 	ImportAST *ParseImport();
 
 	void setBinopPrec(std::string op, int prec) {
@@ -39,18 +39,34 @@ ExprAST *Parser::ParseParenExpr() {
 //		::= identifier '(' expression* ')'
 ExprAST *Parser::ParseIdentifierExpr() {
 	std::string idname = Lex.tokStr;
+	FTag tag = Lex.tag();
 	Lex.gettok();		// eat identifier
 
+	if (Types.count(idname) != 0) {
+		// record : Point(x, y)
+		StructTypeAST *st = dynamic_cast<StructTypeAST*>(Types[idname]);
+		if (st == 0) tag.Throw("Type '" + idname + "' is not a record, it cannot be built like one.");
+		if (Lex.tokStr != "(") Lex.tag().Throw("Expected '(' and field values after record type '" + idname + "'.");
+		return new StructExprAST(tag, st, ParseArgs());
+	}
 	return new VarExprAST(Lex.tag(), idname);
 }
 
 // primary
 //		::= identifierexpr
+//		::= typename args		(record)
 //		::= floatexpr
 //		::= intexpr
 //		::= boolexpr
 //		::= parenexpr
+//		::= arrayexpr
 //		::= externexpr
+//		::= spawnexpr
+//		::= joinexpr
+//		::= fence
+//		::= newchan
+//		::= lambda
+//		::= ordering		(last argument of atomic operations)
 ExprAST *Parser::ParsePrimary() {
 	if (Lex.tok == tok_extern) return ParseExtern();
 	if (Lex.tok == tok_identifier) return ParseIdentifierExpr();
@@ -59,12 +75,28 @@ ExprAST *Parser::ParsePrimary() {
 	if (Lex.tok == tok_float) return ParseFloatExpr();
 	if (Lex.tok == tok_if) return ParseIfThenElse();
 	if (Lex.tok == tok_while || Lex.tok == tok_until) return ParseWhile();
+	if (Lex.tok == tok_for) return ParseFor(false);
+	if (Lex.tok == tok_spawn || Lex.tok == tok_join) return ParseSpawnJoin();
+	if (Lex.tok == tok_fence) return ParseFence();
+	if (Lex.tok == tok_chan) return ParseNewChan();
+	if (Lex.tok == tok_func) return ParseLambda();
+	if (Lex.tok == tok_ordering) {
+		ExprAST *e = new OrderingExprAST(Lex.tag(), Lex.tokStr);
+		Lex.gettok();
+		return e;
+	}
+	if (Lex.tok == tok_parallel) {
+		Lex.gettok();	// eat 'parallel'
+		if (Lex.tok != tok_for) Lex.tag().Throw("Expected 'for' after 'parallel'.");
+		return ParseFor(true);
+	}
 	if (Lex.tok == tok_break || Lex.tok == tok_continue) {
 		BreakContE t = (Lex.tok == tok_break ? bc_break : bc_continue);
 		Lex.gettok();
 		return new BreakContAST(Lex.tag(), t);
 	}
 	if (Lex.tokStr == "(") return ParseParenExpr();
+	if (Lex.tokStr == "[") return ParseArrayExpr();
 	Lex.tag().Throw("Unknown token '" + Lex.tokStr + "' when expecting an expression.");
 	return 0;
 }
@@ -74,6 +106,7 @@ ExprAST *Parser::ParsePrimary() {
 //		::= primary binoprhs
 //		::= primary binoprhs '(' arguments ')'
 //		::= block
+//		::= 'yield' expression		(in generators)
 ExprAST *Parser::ParseExpression() {
 	if (Lex.tokStr == "{") {
 		return ParseBlock();
@@ -85,6 +118,10 @@ ExprAST *Parser::ParseExpression() {
 			ExprAST *v = ParseExpression();
 			return new ReturnAST(Lex.tag(), v);
 		}
+	} else if (Lex.tok == tok_yield) {
+		FTag tag = Lex.tag();
+		Lex.gettok();		// eat yield
+		return new YieldAST(tag, ParseExpression());
 	} else {
 		ExprAST *LHS = ParseBinOpLHS();
 		return ParseBinOpRHS(0, LHS);
@@ -105,6 +142,7 @@ ExprAST *Parser::ParseBinOpLHS() {
 // binoprhs
 //		::= ('+' primary)*
 //		::= functioncall
+//		::= index
 ExprAST *Parser::ParseBinOpRHS(int ExprPrec, ExprAST *LHS) {
 	while (1) {
 		int tokPrec = getBinopPrec(Lex.tokStr);
@@ -124,6 +162,8 @@ ExprAST *Parser::ParseBinOpRHS(int ExprPrec, ExprAST *LHS) {
 		} else if (Lex.tokStr == ".") {
 			LHS = ParseDotMember(LHS);
 			if (LHS == 0) return 0;
+		} else if (Lex.tokStr == "[") {	// indexing, not a binary expression either
+			LHS = ParseIndex(LHS);
 		} else {
 			std::string binop = Lex.tokStr;
 			Lex.gettok();
@@ -164,6 +204,13 @@ ExprAST *Parser::ParseDotMember(ExprAST *obj) {
 //		::= '(' args* ')'
 ExprAST *Parser::ParseCall(ExprAST *callee) {
 	// Function call
+	std::vector<ExprAST *> args = ParseArgs();
+	return new CallExprAST(Lex.tag(), callee, args);
+}
+
+// args
+//		::= '(' (expression (',' expression)*)? ')'
+std::vector<ExprAST*> Parser::ParseArgs() {
 	Lex.gettok(); //eat '('
 	std::vector<ExprAST *> args;
 	if (Lex.tokStr != ")") {
@@ -177,7 +224,44 @@ ExprAST *Parser::ParseCall(ExprAST *callee) {
 		}
 	}
 	Lex.gettok();	// eat ')'
-	return new CallExprAST(Lex.tag(), callee, args);
+	return args;
+}
+
+// index
+//		::= '[' expression ']'
+//		::= '[' expression? '..' expression? ']'
+ExprAST *Parser::ParseIndex(ExprAST *obj) {
+	FTag tag = Lex.tag();
+	Lex.gettok();	// eat '['
+	ExprAST *idx = 0;
+	if (Lex.tokStr != "..") idx = ParseExpression();
+	if (Lex.tokStr == "..") {
+		Lex.gettok();	// eat '..'
+		ExprAST *hi = 0;
+		if (Lex.tokStr != "]") hi = ParseExpression();
+		if (Lex.tokStr != "]") Lex.tag().Throw("Expected ']' after slice bounds.");
+		Lex.gettok();	// eat ']'
+		return new SliceExprAST(tag, obj, idx, hi);
+	}
+	if (Lex.tokStr != "]") Lex.tag().Throw("Expected ']' after index.");
+	Lex.gettok();	// eat ']'
+	return new IndexExprAST(tag, obj, idx);
+}
+
+// arrayexpr
+//		::= '[' expression (',' expression)* ']'
+ExprAST *Parser::ParseArrayExpr() {
+	FTag tag = Lex.tag();
+	Lex.gettok();	// eat '['
+	std::vector<ExprAST*> elems;
+	while (1) {
+		elems.push_back(ParseExpression());
+		if (Lex.tokStr == "]") break;
+		if (Lex.tokStr != ",") Lex.tag().Throw("Expected ']' or ',' in array.");
+		Lex.gettok();
+	}
+	Lex.gettok();	// eat ']'
+	return new ArrayExprAST(tag, elems);
 }
 
 // externexpr
@@ -235,6 +319,152 @@ ExprAST *Parser::ParseWhile() {
 	return new WhileAST(tag, cond, cont, isUntil);
 }
 
+// for
+//		::= 'for' hint* identifier 'in' expr '..' expr ('step' expr)? 'do' expr
+//		::= 'for' hint* identifier 'in' expr '..' expr ('step' expr)? block
+//		::= 'parallel' 'for' hint* identifier 'in' expr '..' expr ('step' expr)?
+//				('grain' expr)? ('reduce' reduction (',' reduction)*)? ('do' expr | block)
+//		::= 'for' identifier 'in' expr ('do' expr | block)		(expr is a generator)
+// hint
+//		::= '@unroll' '(' int ')'
+//		::= '@vectorize' '(' int ')'
+// reduction
+//		::= ('+' | '*' | 'min' | 'max') identifier
+ExprAST *Parser::ParseFor(bool parallel) {
+	FTag tag = Lex.tag();
+	Lex.gettok();		// eat for
+
+	INT unroll = 0, vectorize = 0;
+	while (Lex.tokStr == "@") {
+		Lex.gettok();	// eat '@'
+		std::string hint = Lex.tokStr;
+		if (hint != "unroll" && hint != "vectorize") Lex.tag().Throw("Unknown loop hint '" + hint + "'.");
+		Lex.gettok();
+		if (Lex.tokStr != "(") Lex.tag().Throw("Expected '(' after loop hint.");
+		Lex.gettok();
+		if (Lex.tok != tok_int || Lex.tokInt < 1) Lex.tag().Throw("Expected a positive integer in loop hint.");
+		INT n = Lex.tokInt;
+		Lex.gettok();
+		if (Lex.tokStr != ")") Lex.tag().Throw("Expected ')' after loop hint.");
+		Lex.gettok();
+		if (hint == "unroll") {
+			unroll = n;
+		} else {
+			if ((n & (n - 1)) != 0) Lex.tag().Throw("Vectorization width must be a power of two.");
+			vectorize = n;
+		}
+	}
+
+	if (Lex.tok != tok_identifier) Lex.tag().Throw("Expected loop variable after 'for'.");
+	std::string var = Lex.tokStr;
+	Lex.gettok();
+	if (Lex.tokStr != "in") Lex.tag().Throw("Expected 'in' after loop variable.");
+	Lex.gettok();
+
+	ExprAST *from = ParseExpression();
+	if (Lex.tokStr != "..") {
+		// not a range : values of a generator
+		if (parallel || unroll != 0 || vectorize != 0) Lex.tag().Throw("Expected '..' in loop range.");
+		if (Lex.tok == tok_do) Lex.gettok();
+		ExprAST *cont = ParseExpression();
+		return new ForInAST(tag, var, from, cont);
+	}
+	Lex.gettok();
+	ExprAST *to = ParseExpression();
+	ExprAST *step = 0;
+	if (Lex.tok == tok_identifier && Lex.tokStr == "step") {
+		Lex.gettok();
+		step = ParseExpression();
+	}
+
+	ExprAST *grain = 0;
+	std::vector<std::pair<std::string, std::string> > reductions;
+	if (parallel && Lex.tok == tok_identifier && Lex.tokStr == "grain") {
+		Lex.gettok();
+		grain = ParseExpression();
+	}
+	if (parallel && Lex.tok == tok_identifier && Lex.tokStr == "reduce") {
+		Lex.gettok();
+		while (1) {
+			std::string op = Lex.tokStr;
+			if (op != "+" && op != "*" && op != "min" && op != "max") {
+				Lex.tag().Throw("Unknown reduction '" + op + "', expected '+', '*', 'min' or 'max'.");
+			}
+			Lex.gettok();
+			if (Lex.tok != tok_identifier) Lex.tag().Throw("Expected variable name after reduction operator.");
+			reductions.push_back(std::pair<std::string, std::string>(op, Lex.tokStr));
+			Lex.gettok();
+			if (Lex.tokStr != ",") break;
+			Lex.gettok();
+		}
+	}
+
+	if (Lex.tok == tok_do) Lex.gettok();
+	ExprAST *cont = ParseExpression();
+
+	if (parallel) return new ParallelForAST(tag, var, from, to, step, cont, unroll, vectorize, grain, reductions);
+	return new ForAST(tag, var, from, to, step, cont, unroll, vectorize);
+}
+
+// spawnexpr
+//		::= 'spawn' primary binoprhs		(only calls, members and indexing : spawn f(x) + 1 is (spawn f(x)) + 1)
+// joinexpr
+//		::= 'join' primary binoprhs
+ExprAST *Parser::ParseSpawnJoin() {
+	FTag tag = Lex.tag();
+	bool spawn = (Lex.tok == tok_spawn);
+	Lex.gettok();		// eat spawn or join
+
+	ExprAST *e = ParseBinOpRHS(getBinopPrec("("), ParsePrimary());
+	if (spawn) return new SpawnExprAST(tag, e);
+	return new JoinExprAST(tag, e);
+}
+
+// fence
+//		::= 'fence'
+//		::= 'fence' '(' ordering ')'
+ExprAST *Parser::ParseFence() {
+	FTag tag = Lex.tag();
+	Lex.gettok();		// eat fence
+	std::string order = "seq_cst";
+	if (Lex.tokStr == "(") {
+		Lex.gettok();
+		if (Lex.tok != tok_ordering) Lex.tag().Throw("Expected memory ordering in 'fence'.");
+		order = Lex.tokStr;
+		Lex.gettok();
+		if (Lex.tokStr != ")") Lex.tag().Throw("Expected ')' after memory ordering.");
+		Lex.gettok();
+	}
+	return new FenceExprAST(tag, order);
+}
+
+// newchan
+//		::= 'chan' type '(' expression ')'		(the expression is the capacity)
+ExprAST *Parser::ParseNewChan() {
+	FTag tag = Lex.tag();
+	Lex.gettok();		// eat chan
+	TypeAST *t = ParseType();
+	if (t == VOIDTYPE) Lex.tag().Throw("Channels of void make no sense.");
+	if (Lex.tokStr != "(") Lex.tag().Throw("Expected '(' and capacity after channel type.");
+	Lex.gettok();
+	ExprAST *cap = ParseExpression();
+	if (Lex.tokStr != ")") Lex.tag().Throw("Expected ')' after channel capacity.");
+	Lex.gettok();
+	return new NewChanExprAST(tag, t, cap);
+}
+
+// lambda
+//		::= 'func' prototype block		(the variables of enclosing functions are copied when it is made)
+ExprAST *Parser::ParseLambda() {
+	FTag tag = Lex.tag();
+	Lex.gettok();		// eat func
+	if (Lex.tokStr != "(") Lex.tag().Throw("Expected '(' and arguments after 'func' in a lambda.");
+	FuncTypeAST *type = ParsePrototype();
+	if (Lex.tokStr != "{") Lex.tag().Throw("Expected '{' after the prototype of a lambda.");
+	BlockAST *b = dynamic_cast<BlockAST*>(ParseBlock());
+	return new FuncExprAST(tag, type, b);
+}
+
 // block
 //		::= (expression ';')*
 ExprAST *Parser::ParseBlock() {
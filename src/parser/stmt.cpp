@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "Parser.h"
 
 
@@ -28,10 +30,110 @@ ImportAST *Parser::ParseImport() {
 	return new ImportAST(tag, path, as);
 }
 
+// type definition
+//		::= 'type' identifier '=' type
+void Parser::ParseTypeDefinition() {
+	FTag tag = Lex.tag();
+	Lex.gettok();		// eat 'type'
+	if (Lex.tok != tok_identifier) Lex.tag().Throw("Expected type name after 'type'.");
+	std::string name = Lex.tokStr;
+	Lex.gettok();
+	if (Lex.tokStr != "=") Lex.tag().Throw("Expected '=' after type name.");
+	Lex.gettok();
+	TypeAST *t = ParseType();
+	if (Types.count(name) != 0) tag.Throw("Redefinition of type '" + name + "'.");
+	Types[name] = t;
+}
+
+// toplevel definition
+//		::= vardefinition
+//		::= funcdefinition
+//		::= 'lazy' vardefinition
+//		::= 'threadlocal' vardefinition		(only 'var')
+//		::= 'const' funcdefinition
+//		::= 'gen' funcdefinition
+//		::= 'memo' funcdefinition
+//		::= 'memo' '(' int ')' funcdefinition		(keeps at most int results)
+//		::= 'fastmath' definition		(a function, with any of the above)
+//		::= 'fastmath' 'package'		(not a definition : 0 is returned, see Package::inputFile)
+DefAST *Parser::ParseDefinition() {
+	if (Lex.tok == tok_identifier && Lex.tokStr == "fastmath") {
+		FTag tag = Lex.tag();
+		Lex.gettok();	// eat 'fastmath'
+		if (Lex.tok == tok_identifier && Lex.tokStr == "package") {
+			Lex.gettok();	// eat 'package'
+			return 0;
+		}
+		FuncDefAST *d = dynamic_cast<FuncDefAST*>(ParseDefinition());
+		if (d == 0) tag.Throw("Expected a (non generic) function definition or 'package' after 'fastmath'.");
+		d->Val->FastMath = true;
+		return d;
+	}
+	if (Lex.tok == tok_identifier && Lex.tokStr == "lazy") {
+		FTag tag = Lex.tag();
+		Lex.gettok();	// eat 'lazy'
+		if (Lex.tok != tok_let && Lex.tok != tok_var) tag.Throw("Expected 'let' or 'var' after 'lazy'.");
+		VarDefAST *d = dynamic_cast<VarDefAST*>(ParseVarDefinition());
+		d->Lazy = true;
+		return d;
+	}
+	if (Lex.tok == tok_identifier && Lex.tokStr == "threadlocal") {
+		FTag tag = Lex.tag();
+		Lex.gettok();	// eat 'threadlocal'
+		if (Lex.tok != tok_var) tag.Throw("Expected 'var' after 'threadlocal'.");
+		VarDefAST *d = dynamic_cast<VarDefAST*>(ParseVarDefinition());
+		d->ThreadLocal = true;
+		return d;
+	}
+	if (Lex.tok == tok_identifier && Lex.tokStr == "gen") {
+		FTag tag = Lex.tag();
+		Lex.gettok();	// eat 'gen'
+		if (Lex.tok != tok_func) tag.Throw("Expected 'func' after 'gen'.");
+		FuncDefAST *d = dynamic_cast<FuncDefAST*>(ParseFuncDefinition());
+		if (d == 0) tag.Throw("Generators cannot be extern or generic.");
+		d->Val->makeGenerator();
+		return d;
+	}
+	if (Lex.tok == tok_identifier && Lex.tokStr == "memo") {
+		FTag tag = Lex.tag();
+		Lex.gettok();	// eat 'memo'
+		INT bound = 0;
+		if (Lex.tokStr == "(") {
+			Lex.gettok();
+			if (Lex.tok != tok_int || Lex.tokInt < 1) Lex.tag().Throw("Expected the number of results a memo function keeps.");
+			bound = Lex.tokInt;
+			Lex.gettok();
+			if (Lex.tokStr != ")") Lex.tag().Throw("Expected ')' after the number of results kept.");
+			Lex.gettok();
+		}
+		if (Lex.tok != tok_func) tag.Throw("Expected 'func' after 'memo'.");
+		FuncDefAST *d = dynamic_cast<FuncDefAST*>(ParseFuncDefinition());
+		if (d == 0) tag.Throw("Memo functions cannot be extern or generic.");
+		d->Memo = true;
+		d->MemoBound = bound;
+		d->Const = true;		// reusing results is only right for pure functions
+		return d;
+	}
+	if (Lex.tok == tok_const) {
+		FTag tag = Lex.tag();
+		Lex.gettok();	// eat 'const'
+		if (Lex.tok != tok_func) tag.Throw("Expected 'func' after 'const'.");
+		DefAST *d = ParseFuncDefinition();
+		d->Const = true;
+		return d;
+	}
+	if (Lex.tok == tok_func) return ParseFuncDefinition();
+	if (Lex.tok == tok_let || Lex.tok == tok_var) return ParseVarDefinition();
+	Lex.tag().Throw("Error: expected definition in toplevel input.");
+	return 0;
+}
+
 // definition			(definition of a variable)
-//		::= let id ':' type '=' expression 
+//		::= let id ':' type align? '=' expression 
 //		::= let id '=' fctproto fctblock
-//		::= let id '=' expression
+//		::= let id align? '=' expression
+// align
+//		::= 'align' '(' int ')'		(a power of two, in bytes)
 DefAST *Parser::ParseVarDefinition() {
 	FTag tag = Lex.tag();
 
@@ -42,22 +144,41 @@ DefAST *Parser::ParseVarDefinition() {
 	if (Lex.tok != tok_identifier) Lex.tag().Throw("Expected identifier after 'let'/'var'.");
 	std::string name = Lex.tokStr;
 	Lex.gettok();		// eat identifier
+	TypeAST *type = 0;
 	if (Lex.tokStr == ":") {
 		Lex.gettok();	// eat ':'
-		TypeAST *type = ParseType();
-		if (Lex.tokStr != "=") Lex.tag().Throw("Expected '= expression' in 'let'/'var'.");
-		Lex.gettok();	// eat '='
-		ExprAST *val = ParseExpression();
-		return new VarDefAST(tag, type, name, val, var); 
-	} else if (Lex.tokStr == "=") {
-		Lex.gettok();		// eat '='
-		ExprAST *val = ParseExpression();
-		return new VarDefAST(tag, 0, name, val, var);
-	} else {
+		type = ParseType();
+	}
+	INT align = 0;
+	if (Lex.tok == tok_identifier && Lex.tokStr == "align") {
+		Lex.gettok();	// eat 'align'
+		if (Lex.tokStr != "(") Lex.tag().Throw("Expected '(' after 'align'.");
+		Lex.gettok();
+		if (Lex.tok != tok_int || Lex.tokInt < 1 || (Lex.tokInt & (Lex.tokInt - 1)) != 0) {
+			Lex.tag().Throw("Alignment must be a power of two.");
+		}
+		align = Lex.tokInt;
+		Lex.gettok();
+		if (Lex.tokStr != ")") Lex.tag().Throw("Expected ')' after alignment.");
+		Lex.gettok();
+	}
+	if (Lex.tokStr != "=") {
+		if (type != 0) Lex.tag().Throw("Expected '= expression' in 'let'/'var'.");
 		Lex.tag().Throw("Expected either ': type' or '= expression' after 'let/var " + name + "'.");
 	}
+	Lex.gettok();	// eat '='
+	ExprAST *val = ParseExpression();
+	VarDefAST *d = new VarDefAST(tag, type, name, val, var);
+	d->Align = align;
+	return d;
 };
 
+// funcdefinition
+//		::= 'func' identifier funcbody
+//		::= 'func' identifier '[' identifier (',' identifier)* ']' funcbody		(generic)
+// funcbody
+//		::= ':' prototype block
+//		::= ':' prototype extern
 DefAST *Parser::ParseFuncDefinition() {
 	FTag tag = Lex.tag();	// definitions usually span several lines, so save tag for now.
 
@@ -65,6 +186,45 @@ DefAST *Parser::ParseFuncDefinition() {
 	if (Lex.tok != tok_identifier) Lex.tag().Throw("Expected identifier after 'func'.");
 	std::string name = Lex.tokStr;
 	Lex.gettok();		// eat function name
+	if (Lex.tokStr == "[") return ParseGenericDefinition(tag, name);
+	return ParseFuncBody(tag, name);
+}
+
+// The type parameters are bound to TypeParamAST while parsing the generic, which only
+// gives its prototype : the text of the body is kept, and parsed again for each
+// instance with the actual types (see Package::instantiate)
+DefAST *Parser::ParseGenericDefinition(const FTag &tag, const std::string &name) {
+	Lex.gettok();		// eat '['
+	std::vector<std::string> params;
+	while (Lex.tok == tok_identifier) {
+		if (find(params.begin(), params.end(), Lex.tokStr) != params.end()) {
+			Lex.tag().Throw("Type parameter '" + Lex.tokStr + "' appears twice.");
+		}
+		params.push_back(Lex.tokStr);
+		Lex.gettok();
+		if (Lex.tokStr == ",") Lex.gettok();
+		else break;
+	}
+	if (params.size() == 0) Lex.tag().Throw("Expected type parameters after '['.");
+	if (Lex.tokStr != "]") Lex.tag().Throw("Expected ']' after type parameters.");
+
+	std::string text;
+	int line = Lex.line();
+	Lex.record(&text);
+	Lex.gettok();		// eat ']'
+
+	std::map<std::string, TypeAST*> saved = Types;
+	for (unsigned i = 0; i < params.size(); i++) Types[params[i]] = TypeParamAST::Get(params[i]);
+	DefAST *d = ParseFuncBody(tag, name);
+	Types = saved;
+	Lex.record(0);
+
+	FuncDefAST *fd = dynamic_cast<FuncDefAST*>(d);
+	if (fd == 0) tag.Throw("A generic function cannot be extern.");
+	return new GenericFuncDefAST(tag, name, params, fd->Val->FType, text, Lex.file(), line);
+}
+
+DefAST *Parser::ParseFuncBody(const FTag &tag, const std::string &name) {
 	if (Lex.tokStr != ":") Lex.tag().Throw("Expected ':' in function definition.");
 	Lex.gettok();
 
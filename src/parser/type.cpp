@@ -1,41 +1,182 @@
+#include <cstdlib>
+#include <cctype>
+
 #include "Parser.h"
 
+// Scalar types, that can also be vector elements
+static TypeAST *scalarType(const std::string &name) {
+	if (name == "bool") return BaseTypeAST::Get(bt_bool);
+	if (name == "float" || name == "f64") return BaseTypeAST::Get(bt_float);
+	if (name == "f32") return BaseTypeAST::Get(bt_f32);
+	if (name == "f16") return BaseTypeAST::Get(bt_f16);
+	if (name == "bf16") return BaseTypeAST::Get(bt_bf16);
+	if (name == "int") return INTTYPE;
+	if (name == "s64i") return IntTypeAST::Get(64, true);
+	if (name == "u8i" || name == "byte") return IntTypeAST::Get(8, false);
+	if (name == "u16i") return IntTypeAST::Get(16, false);
+	if (name == "u32i") return IntTypeAST::Get(32, false);
+	if (name == "u64i") return IntTypeAST::Get(64, false);
+	if (name == "s8i") return IntTypeAST::Get(8, true);
+	if (name == "s16i") return IntTypeAST::Get(16, true);
+	if (name == "s32i") return IntTypeAST::Get(32, true);
+	return 0;
+}
+
+// Vector types : element type, 'x', number of lanes (f64x4, s32ix8, boolx4)
+static TypeAST *vectorType(const std::string &name, const FTag &tag) {
+	size_t x = name.rfind('x');
+	if (x == std::string::npos || x == 0 || x + 1 == name.size()) return 0;
+	for (size_t i = x + 1; i < name.size(); i++) {
+		if (!isdigit(name[i])) return 0;
+	}
+	std::string elem = name.substr(0, x);
+	TypeAST *et = scalarType(elem);
+	if (et == 0) return 0;
+	if (BaseTypeAST::isFloat(et, true) != 0 && BaseTypeAST::isFloat(et) == 0) {
+		tag.Throw("Vectors of " + elem + " are not supported : f16 and bf16 are only for storage.");
+	}
+	unsigned width = atoi(name.substr(x + 1).c_str());
+	if (width < 2 || width > 64 || (width & (width - 1)) != 0) {
+		tag.Throw("Vector width must be a power of two between 2 and 64.");
+	}
+	return VectorTypeAST::Get(et, width);
+}
 
 // type
 //		::= 'void'
 //		::= 'int'
 //		::= 'float'
+//		::= vectortype
 //		::= prototype
+//		::= '&' type
+//		::= '[' int ']' type
+//		::= '[' ']' type
+//		::= 'soa' '[' int ']' type		(array of records, stored field by field)
+//		::= 'task' type
+//		::= 'atomic' type
+//		::= 'chan' type
+//		::= 'gen' type
+//		::= structtype
+//		::= identifier ('.' identifier)?		(named type, of the package or of an import)
 TypeAST *Parser::ParseType() {
 	if (Lex.tokStr == "(") {
 		return ParsePrototype();
 	}
+	if (Lex.tokStr == "[") {
+		Lex.gettok();	// eat '['
+		if (Lex.tokStr == "]") {
+			Lex.gettok();	// eat ']'
+			TypeAST *t = ParseType();
+			if (t == 0) return 0;
+			if (t == VOIDTYPE) Lex.tag().Throw("Slices of void make no sense.");
+			return SliceTypeAST::Get(t);
+		}
+		if (Lex.tok != tok_int || Lex.tokInt <= 0) Lex.tag().Throw("Expected array length or ']' in type.");
+		INT len = Lex.tokInt;
+		Lex.gettok();	// eat length
+		if (Lex.tokStr != "]") Lex.tag().Throw("Expected ']' after array length.");
+		Lex.gettok();	// eat ']'
+		TypeAST *t = ParseType();
+		if (t == 0) return 0;
+		if (t == VOIDTYPE) Lex.tag().Throw("Arrays of void make no sense.");
+		return ArrayTypeAST::Get(t, len);
+	}
+	if (Lex.tok == tok_identifier && Lex.tokStr == "soa") {
+		FTag tag = Lex.tag();
+		Lex.gettok();	// eat 'soa'
+		ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(ParseType());
+		if (at == 0 || dynamic_cast<StructTypeAST*>(at->ElemType) == 0) {
+			tag.Throw("'soa' is a layout for arrays of records, like 'soa [64]Point'.");
+		}
+		return ArrayTypeAST::Get(at->ElemType, at->Length, true);
+	}
 	if (Lex.tokStr == "&") {
 		Lex.gettok();
 		TypeAST *t = ParseType();
 		if (t == 0) return 0;
 		return RefTypeAST::Get(t);
 	}
+	if (Lex.tok == tok_identifier && Lex.tokStr == "task") {
+		Lex.gettok();
+		TypeAST *t = ParseType();
+		if (t == 0) return 0;
+		return TaskTypeAST::Get(t);
+	}
+	if (Lex.tok == tok_identifier && Lex.tokStr == "struct") return ParseStructType();
+	if (Lex.tok == tok_identifier && Lex.tokStr == "gen") {
+		Lex.gettok();
+		TypeAST *t = ParseType();
+		if (t == 0) return 0;
+		if (t == VOIDTYPE) Lex.tag().Throw("Generators of void make no sense.");
+		return GenTypeAST::Get(t);
+	}
+	if (Lex.tok == tok_identifier && Lex.tokStr == "atomic") {
+		Lex.gettok();
+		TypeAST *t = ParseType();
+		if (t == 0) return 0;
+		if (dynamic_cast<IntTypeAST*>(t) == 0 && dynamic_cast<RefTypeAST*>(t) == 0) {
+			Lex.tag().Throw("Only integers and references can be atomic.");
+		}
+		return AtomicTypeAST::Get(t);
+	}
+	if (Lex.tok == tok_chan) {
+		Lex.gettok();
+		TypeAST *t = ParseType();
+		if (t == 0) return 0;
+		if (t == VOIDTYPE) Lex.tag().Throw("Channels of void make no sense.");
+		return ChanTypeAST::Get(t);
+	}
 	TypeAST *ret = 0;
 	if (Lex.tokStr == "void") ret = BaseTypeAST::Get(bt_void);
-	if (Lex.tokStr == "bool") ret = BaseTypeAST::Get(bt_bool);
-	if (Lex.tokStr == "float") ret = BaseTypeAST::Get(bt_float);
-	if (Lex.tokStr == "int") ret = INTTYPE;
-	if (Lex.tokStr == "s64i") ret = IntTypeAST::Get(64, true);
-	if (Lex.tokStr == "u8i" || Lex.tokStr == "byte") ret = IntTypeAST::Get(8, false);
-	if (Lex.tokStr == "u16i") ret = IntTypeAST::Get(16, false);
-	if (Lex.tokStr == "u32i") ret = IntTypeAST::Get(32, false);
-	if (Lex.tokStr == "u64i") ret = IntTypeAST::Get(64, false);
-	if (Lex.tokStr == "s8i") ret = IntTypeAST::Get(8, true);
-	if (Lex.tokStr == "s16i") ret = IntTypeAST::Get(16, true);
-	if (Lex.tokStr == "s32i") ret = IntTypeAST::Get(32, true);
+	if (ret == 0) ret = scalarType(Lex.tokStr);
+	if (ret == 0 && Lex.tok == tok_identifier) ret = vectorType(Lex.tokStr, Lex.tag());
 	if (ret != 0) {
 		Lex.gettok();
 		return ret;
 	}
+	if (Lex.tok == tok_identifier) {
+		FTag tag = Lex.tag();
+		std::string name = Lex.tokStr;
+		Lex.gettok();
+		if (Lex.tokStr == "." && Types.count(name) == 0) {
+			Lex.gettok();	// eat '.'
+			name += "." + Lex.tokStr;
+			Lex.gettok();
+		}
+		if (Types.count(name) == 0) tag.Throw("Unknown type '" + name + "'.");
+		return Types[name];
+	}
 	Lex.tag().Throw("Invalid type definiton, starting by '" + Lex.tokStr + "'.");
 }
 
+// structtype
+//		::= 'struct' '{' (identifier ':' type ','?)+ '}'
+TypeAST *Parser::ParseStructType() {
+	FTag tag = Lex.tag();
+	Lex.gettok();	// eat 'struct'
+	if (Lex.tokStr != "{") Lex.tag().Throw("Expected '{' after 'struct'.");
+	Lex.gettok();
+	std::vector<std::pair<std::string, TypeAST*> > fields;
+	while (Lex.tokStr != "}") {
+		if (Lex.tok != tok_identifier) Lex.tag().Throw("Expected field name in record type.");
+		std::string name = Lex.tokStr;
+		for (unsigned i = 0; i < fields.size(); i++) {
+			if (fields[i].first == name) Lex.tag().Throw("Duplicate field '" + name + "' in record type.");
+		}
+		Lex.gettok();
+		if (Lex.tokStr != ":") Lex.tag().Throw("Expected ':' and type after field name.");
+		Lex.gettok();
+		TypeAST *t = ParseType();
+		if (t == 0) return 0;
+		if (t == VOIDTYPE) Lex.tag().Throw("Fields of type void make no sense.");
+		fields.push_back(std::pair<std::string, TypeAST*>(name, t));
+		if (Lex.tokStr == "," || Lex.tokStr == ";") Lex.gettok();
+	}
+	Lex.gettok();	// eat '}'
+	if (fields.empty()) tag.Throw("A record needs at least one field.");
+	return StructTypeAST::Get(fields);
+}
+
 
 
 // funcarg
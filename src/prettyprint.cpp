@@ -46,6 +46,100 @@ void CastExprAST::prettyprint(std::ostream &out) {
 	out << " : " << FType->typeDescStr();
 }
 
+void StructExprAST::prettyprint(std::ostream &out) {
+	out << SType->typeDescStr() << "(";
+	for (unsigned int i = 0; i < Vals.size(); i++) {
+		if (i >= 1) out << ",";
+		Vals[i]->prettyprint(out);
+	}
+	out << ")";
+}
+
+void ArrayExprAST::prettyprint(std::ostream &out) {
+	out << "[";
+	for (unsigned int i = 0; i < Elems.size(); i++) {
+		if (i >= 1) out << ",";
+		Elems[i]->prettyprint(out);
+	}
+	out << "]";
+}
+
+void IndexExprAST::prettyprint(std::ostream &out) {
+	out << "(";
+	Obj->prettyprint(out);
+	out << ")[";
+	Idx->prettyprint(out);
+	out << "]";
+}
+
+void SliceExprAST::prettyprint(std::ostream &out) {
+	out << "(";
+	Obj->prettyprint(out);
+	out << ")[";
+	if (Lo != 0) Lo->prettyprint(out);
+	out << "..";
+	if (Hi != 0) Hi->prettyprint(out);
+	out << "]";
+}
+
+void SpawnExprAST::prettyprint(std::ostream &out) {
+	out << "spawn ";
+	Call->prettyprint(out);
+}
+
+void JoinExprAST::prettyprint(std::ostream &out) {
+	out << "join (";
+	Handle->prettyprint(out);
+	out << ")";
+}
+
+void AtomicOpExprAST::prettyprint(std::ostream &out) {
+	out << "(";
+	Ref->prettyprint(out);
+	out << ")." << Op << "(";
+	for (unsigned int i = 0; i < Args.size(); i++) {
+		Args[i]->prettyprint(out);
+		out << ",";
+	}
+	out << Order << ")";
+}
+
+void OrderingExprAST::prettyprint(std::ostream &out) {
+	out << Order;
+}
+
+void FenceExprAST::prettyprint(std::ostream &out) {
+	out << " fence(" << Order << ") ";
+}
+
+void NewChanExprAST::prettyprint(std::ostream &out) {
+	out << "chan " << ElemType->typeDescStr() << "(";
+	Capacity->prettyprint(out);
+	out << ")";
+}
+
+void ChanOpExprAST::prettyprint(std::ostream &out) {
+	out << "(";
+	Chan->prettyprint(out);
+	out << ")." << Op << "(";
+	for (unsigned int i = 0; i < Args.size(); i++) {
+		if (i >= 1) out << ",";
+		Args[i]->prettyprint(out);
+	}
+	out << ")";
+}
+
+void GenOpExprAST::prettyprint(std::ostream &out) {
+	out << "(";
+	Gen->prettyprint(out);
+	out << ")." << Op << "(";
+	for (unsigned int i = 0; i < Args.size(); i++) {
+		if (i >= 1) out << ",";
+		Args[i]->prettyprint(out);
+	}
+	out << ")";
+}
+
 void CallExprAST::prettyprint(std::ostream &out) {
 	out << "call[";
 	Callee->prettyprint(out);
@@ -61,6 +155,17 @@ void CallExprAST::prettyprint(std::ostream &out) {
 	out << "]";
 }
 
+void VectorOpExprAST::prettyprint(std::ostream &out) {
+	out << "(";
+	Vec->prettyprint(out);
+	out << ")." << Op << "(";
+	for (unsigned int i = 0; i < Args.size(); i++) {
+		if (i >= 1) out << ",";
+		Args[i]->prettyprint(out);
+	}
+	out << ")";
+}
+
 void IfThenElseAST::prettyprint(std::ostream &out) {
 	out << " if (";
 	Cond->prettyprint(out);
@@ -79,6 +184,44 @@ void WhileAST::prettyprint(std::ostream &out) {
 	Inside->prettyprint(out);
 }
 
+void ForAST::prettyprint(std::ostream &out) {
+	out << " for ";
+	if (Unroll != 0) out << "@unroll(" << Unroll << ") ";
+	if (Vectorize != 0) out << "@vectorize(" << Vectorize << ") ";
+	out << Var << " in (";
+	From->prettyprint(out);
+	out << ")..(";
+	To->prettyprint(out);
+	out << ")";
+	if (Step != 0) {
+		out << " step (";
+		Step->prettyprint(out);
+		out << ")";
+	}
+	out << " do ";
+	Inside->prettyprint(out);
+}
+
+void ParallelForAST::prettyprint(std::ostream &out) {
+	out << " parallel";
+	if (Grain != 0) {
+		out << " grain (";
+		Grain->prettyprint(out);
+		out << ")";
+	}
+	for (unsigned int i = 0; i < Reductions.size(); i++) {
+		out << " reduce " << Reductions[i].first << " " << Reductions[i].second;
+	}
+	ForAST::prettyprint(out);
+}
+
+void ForInAST::prettyprint(std::ostream &out) {
+	out << " for " << Var << " in (";
+	Gen->prettyprint(out);
+	out << ") do ";
+	Inside->prettyprint(out);
+}
+
 void BreakContAST::prettyprint(std::ostream &out) {
 	out << (SType == bc_break ? " BREAK " : " CONTINUE ");
 }
@@ -112,8 +255,14 @@ void ReturnAST::prettyprint(std::ostream &out) {
 	out << ")";
 }
 
+void YieldAST::prettyprint(std::ostream &out) {
+	out << " yield(";
+	Val->prettyprint(out);
+	out << ")";
+}
+
 void FuncExprAST::prettyprint(std::ostream &out) {
-	out << " func " << FType->typeDescStr();
+	out << (YieldType != 0 ? " gen func " : " func ") << FType->typeDescStr();
 	out << "  ";
 	Code->prettyprint(out);
 }
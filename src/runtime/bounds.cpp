@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "runtime.h"
+
+// Called by generated code when an index is not in the bounds of an array or slice,
+// or when the step of a 'for' loop is zero at runtime. The generated code only calls
+// these when the check failed, so they never return.
+
+extern "C" void pif_bounds_fail(INT idx, INT len) {
+	fprintf(stderr, "[runtime error] \tindex %lld out of bounds (length %lld).\n", (long long)idx, (long long)len);
+	abort();
+}
+
+extern "C" void pif_step_fail() {
+	fprintf(stderr, "[runtime error] \tstep of 'for' loop is zero.\n");
+	abort();
+}
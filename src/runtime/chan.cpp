@@ -0,0 +1,136 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "runtime.h"
+
+using namespace std;
+
+// Channels : bounded lock-free ring buffers (D. Vyukov's MPMC queue).
+// Every slot has a sequence number telling whose turn it is : a sender may fill
+// slot i when its sequence is its position, a receiver may empty it when it is
+// position + 1. Senders and receivers each have their own counter, so with one
+// sender and one receiver neither CAS is ever contended.
+// A blocked sender or receiver first runs pending tasks (the other end of the
+// channel may be one of them), then spins a little, then parks on a condition
+// variable until the other side makes progress.
+
+struct Slot {
+	atomic<size_t> Seq;
+	// element data follows
+};
+
+struct Chan {
+	size_t Mask, SlotSize, ElemSize;
+	char *Slots;
+
+	atomic<size_t> SendPos;
+	char Pad1[64];
+	atomic<size_t> RecvPos;
+	char Pad2[64];
+
+	mutex Lock;
+	condition_variable Changed;
+	atomic<int> Parked;
+};
+
+static inline Slot *slotAt(Chan *c, size_t pos) {
+	return (Slot*)(c->Slots + (pos & c->Mask) * c->SlotSize);
+}
+
+extern "C" void *pif_chan_new(INT elemSize, INT capacity) {
+	size_t cap = 2;
+	while ((INT)cap < capacity) cap *= 2;
+
+	Chan *c = new Chan();
+	c->Mask = cap - 1;
+	c->ElemSize = elemSize;
+	c->SlotSize = (sizeof(Slot) + elemSize + 15) / 16 * 16;
+	c->Slots = (char*)malloc(cap * c->SlotSize);
+	for (size_t i = 0; i < cap; i++) {
+		new (slotAt(c, i)) Slot();
+		slotAt(c, i)->Seq.store(i, memory_order_relaxed);
+	}
+	c->SendPos = 0;
+	c->RecvPos = 0;
+	c->Parked = 0;
+	return c;
+}
+
+static void wakeUp(Chan *c) {
+	if (c->Parked.load() == 0) return;
+	lock_guard<mutex> lk(c->Lock);
+	c->Changed.notify_all();
+}
+
+extern "C" int pif_chan_try_send(void *chan, void *elem) {
+	Chan *c = (Chan*)chan;
+	size_t pos = c->SendPos.load(memory_order_relaxed);
+	while (1) {
+		Slot *s = slotAt(c, pos);
+		intptr_t dif = (intptr_t)s->Seq.load(memory_order_acquire) - (intptr_t)pos;
+		if (dif == 0) {
+			if (c->SendPos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+				memcpy((char*)s + sizeof(Slot), elem, c->ElemSize);
+				s->Seq.store(pos + 1, memory_order_release);
+				wakeUp(c);
+				return 1;
+			}
+		} else if (dif < 0) {
+			return 0;		// full
+		} else {
+			pos = c->SendPos.load(memory_order_relaxed);
+		}
+	}
+}
+
+extern "C" int pif_chan_try_recv(void *chan, void *elem) {
+	Chan *c = (Chan*)chan;
+	size_t pos = c->RecvPos.load(memory_order_relaxed);
+	while (1) {
+		Slot *s = slotAt(c, pos);
+		intptr_t dif = (intptr_t)s->Seq.load(memory_order_acquire) - (intptr_t)(pos + 1);
+		if (dif == 0) {
+			if (c->RecvPos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+				memcpy(elem, (char*)s + sizeof(Slot), c->ElemSize);
+				s->Seq.store(pos + c->Mask + 1, memory_order_release);
+				wakeUp(c);
+				return 1;
+			}
+		} else if (dif < 0) {
+			return 0;		// empty
+		} else {
+			pos = c->RecvPos.load(memory_order_relaxed);
+		}
+	}
+}
+
+static void wait(Chan *c, int (*attempt)(void*, void*), void *elem) {
+	for (int i = 0; ; i++) {
+		if (attempt(c, elem)) return;
+		if (pif_sched_help()) continue;
+		if (i < 64) {
+			this_thread::yield();
+			continue;
+		}
+		// park : the timeout covers a wake up sent between the attempt and the wait
+		unique_lock<mutex> lk(c->Lock);
+		c->Parked++;
+		c->Changed.wait_for(lk, chrono::milliseconds(1));
+		c->Parked--;
+	}
+}
+
+extern "C" void pif_chan_send(void *chan, void *elem) {
+	wait((Chan*)chan, pif_chan_try_send, elem);
+}
+
+extern "C" void pif_chan_recv(void *chan, void *elem) {
+	wait((Chan*)chan, pif_chan_try_recv, elem);
+}
@@ -0,0 +1,61 @@
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "runtime.h"
+
+using namespace std;
+
+// Closures that escape (see FuncExprAST::Codegen) : a block holds the trampoline,
+// code that LLVM writes there and that calls the lambda with the environment, then
+// the environment. No page is both writable and executable : blocks come from
+// chunks mapped twice, read-write where the generated code writes the block, and
+// read-execute where the trampoline is called (pif_closure_code). A block records
+// the distance between the two, just before it.
+// Closures are values that may be copied anywhere, so the blocks of those that
+// escape are never freed ; those that do not escape are on the stack and never
+// come here.
+
+#define TRAMPOLINE_SIZE 64		// the environment follows, aligned ; a header of the same size precedes
+#define CHUNK_SIZE (1 << 20)
+
+static mutex Lock;
+static char *Chunk = 0;			// the writable mapping
+static intptr_t ToCode = 0;		// from it to the executable one
+static size_t Used = CHUNK_SIZE;
+
+static void newChunk(size_t len) {
+	int fd = memfd_create("pif-closures", MFD_CLOEXEC);
+	if (fd < 0 || ftruncate(fd, len) != 0) {
+		perror("[runtime error] \tclosures");
+		abort();
+	}
+	void *rw = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	void *rx = mmap(0, len, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+	close(fd);
+	if (rw == MAP_FAILED || rx == MAP_FAILED) {
+		perror("[runtime error] \tclosures");
+		abort();
+	}
+	Chunk = (char*)rw;
+	ToCode = (char*)rx - (char*)rw;
+	Used = 0;
+}
+
+extern "C" void *pif_closure_new(INT envSize) {
+	size_t size = (2 * TRAMPOLINE_SIZE + envSize + TRAMPOLINE_SIZE - 1) / TRAMPOLINE_SIZE * TRAMPOLINE_SIZE;
+	lock_guard<mutex> lk(Lock);
+	if (Used + size > CHUNK_SIZE) newChunk(size > CHUNK_SIZE ? size : CHUNK_SIZE);
+	char *block = Chunk + Used + TRAMPOLINE_SIZE;
+	*(intptr_t*)(block - TRAMPOLINE_SIZE) = ToCode;
+	Used += size;
+	return block;
+}
+
+// Where the trampoline of a block is executed
+extern "C" void *pif_closure_code(void *block) {
+	return (char*)block + *(intptr_t*)((char*)block - TRAMPOLINE_SIZE);
+}
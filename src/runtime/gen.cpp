@@ -0,0 +1,18 @@
+#include <stdlib.h>
+
+#include "runtime.h"
+
+// Frames of generators (see Generator::buildGenerator). Frames of generators
+// used only by a 'for' loop are on the stack of the loop and never come here.
+
+#define FRAME_ALIGN 64		// keeps vectors in the frame aligned
+
+extern "C" void *pif_frame_new(INT size) {
+	void *p = 0;
+	if (posix_memalign(&p, FRAME_ALIGN, size) != 0) abort();
+	return p;
+}
+
+extern "C" void pif_frame_free(void *frame) {
+	free(frame);
+}
@@ -0,0 +1,40 @@
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "runtime.h"
+
+using namespace std;
+
+// Lazy globals : the generated code checks the guard itself and only calls
+// this when the value is not available yet.
+// Guard states : 0 = not computed, 2 = being computed, 1 = available
+
+static __thread vector<int*> *Computing = 0;		// guards of values this thread is computing
+
+extern "C" void pif_lazy_init(int *guard, void (*init)()) {
+	if (__sync_bool_compare_and_swap(guard, 0, 2)) {
+		if (Computing == 0) Computing = new vector<int*>();
+		Computing->push_back(guard);
+		init();
+		Computing->pop_back();
+		__sync_synchronize();
+		*(volatile int*)guard = 1;
+		return;
+	}
+
+	if (Computing != 0) {
+		for (unsigned i = 0; i < Computing->size(); i++) {
+			if ((*Computing)[i] == guard) {
+				fprintf(stderr, "[runtime error] \tlazy global depends on its own value.\n");
+				abort();
+			}
+		}
+	}
+	// Another thread is computing the value, wait for it
+	while (*(volatile int*)guard != 1) {
+		sched_yield();
+	}
+	__sync_synchronize();
+}
@@ -0,0 +1,222 @@
+#include <mutex>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "runtime.h"
+
+using namespace std;
+
+// Caches of memo functions (see Generator::buildMemo) : results by arguments, all
+// of them as 64 bits words. An unbounded function of one integer argument has a
+// direct-mapped table for the arguments in [0, MEMO_DIRECT), read without locking :
+// the function is pure, so threads that store the same entry at once store the same
+// result.
+// Other arguments go in an open-addressing hash table (linear probing) under a lock.
+// 'memo(N) func' keeps at most N results in the table, evicting the least recently
+// used one to make room ; the table of the others grows to keep all of them.
+// Caches are never freed, like the functions they belong to.
+
+#define MEMO_DIRECT 4096
+#define MEMO_MIN_SLOTS 64
+#define NIL ((size_t)-1)
+
+struct DirectEntry {
+	atomic<int> Set;
+	atomic<INT> Val;
+};
+
+struct Memo {
+	INT NKey, Bound;
+	DirectEntry *Direct;		// 0 unless the function has one integer argument
+
+	mutex Lock;
+	size_t Mask, Count;
+	INT *Keys;					// NKey words by slot
+	INT *Vals;
+	char *Used;
+	size_t *Prev, *Next;		// bounded caches : slots from the most recently used (Head) to the least (Tail)
+	size_t Head, Tail;
+};
+
+static size_t hashKey(const INT *key, INT n) {
+	uint64_t h = 0x9E3779B97F4A7C15ull;
+	for (INT i = 0; i < n; i++) {
+		h = (h ^ (uint64_t)key[i]) * 0xBF58476D1CE4E5B9ull;
+		h ^= h >> 31;
+	}
+	return (size_t)h;
+}
+
+static inline INT *keyAt(Memo *m, size_t i) {
+	return m->Keys + i * m->NKey;
+}
+
+static void allocSlots(Memo *m, size_t slots) {
+	m->Mask = slots - 1;
+	m->Count = 0;
+	m->Keys = (INT*)malloc(slots * m->NKey * sizeof(INT));
+	m->Vals = (INT*)malloc(slots * sizeof(INT));
+	m->Used = (char*)calloc(slots, 1);
+	m->Prev = m->Next = 0;
+	if (m->Bound > 0) {
+		m->Prev = (size_t*)malloc(slots * sizeof(size_t));
+		m->Next = (size_t*)malloc(slots * sizeof(size_t));
+	}
+	m->Head = m->Tail = NIL;
+}
+
+static void freeSlots(Memo *m) {
+	free(m->Keys);
+	free(m->Vals);
+	free(m->Used);
+	free(m->Prev);
+	free(m->Next);
+}
+
+// Slot of the key, or the free slot where it goes
+static size_t findSlot(Memo *m, const INT *key) {
+	size_t i = hashKey(key, m->NKey) & m->Mask;
+	while (m->Used[i] && memcmp(keyAt(m, i), key, m->NKey * sizeof(INT)) != 0) i = (i + 1) & m->Mask;
+	return i;
+}
+
+static void unlink(Memo *m, size_t i) {
+	if (m->Prev[i] != NIL) m->Next[m->Prev[i]] = m->Next[i];
+	else m->Head = m->Next[i];
+	if (m->Next[i] != NIL) m->Prev[m->Next[i]] = m->Prev[i];
+	else m->Tail = m->Prev[i];
+}
+
+static void pushFront(Memo *m, size_t i) {
+	m->Prev[i] = NIL;
+	m->Next[i] = m->Head;
+	if (m->Head != NIL) m->Prev[m->Head] = i;
+	else m->Tail = i;
+	m->Head = i;
+}
+
+static void moveSlot(Memo *m, size_t from, size_t to) {
+	memcpy(keyAt(m, to), keyAt(m, from), m->NKey * sizeof(INT));
+	m->Vals[to] = m->Vals[from];
+	m->Used[to] = 1;
+	m->Used[from] = 0;
+	if (m->Bound > 0) {
+		size_t p = m->Prev[from], n = m->Next[from];
+		m->Prev[to] = p;
+		m->Next[to] = n;
+		if (p != NIL) m->Next[p] = to;
+		else m->Head = to;
+		if (n != NIL) m->Prev[n] = to;
+		else m->Tail = to;
+	}
+}
+
+// Empty slot i, moving back the entries after it that could not be found anymore
+// (those whose home slot is not between the hole and them) : no tombstones
+static void removeSlot(Memo *m, size_t i) {
+	if (m->Bound > 0) unlink(m, i);
+	m->Used[i] = 0;
+	m->Count--;
+	size_t j = i;
+	while (1) {
+		j = (j + 1) & m->Mask;
+		if (!m->Used[j]) return;
+		size_t home = hashKey(keyAt(m, j), m->NKey) & m->Mask;
+		if (((j - home) & m->Mask) < ((j - i) & m->Mask)) continue;
+		moveSlot(m, j, i);
+		i = j;
+	}
+}
+
+// Unbounded caches : twice as many slots, so that at most half of them are used
+static void grow(Memo *m) {
+	size_t slots = m->Mask + 1;
+	INT *keys = m->Keys, *vals = m->Vals;
+	char *used = m->Used;
+	allocSlots(m, slots * 2);
+	for (size_t i = 0; i < slots; i++) {
+		if (!used[i]) continue;
+		size_t j = findSlot(m, keys + i * m->NKey);
+		memcpy(keyAt(m, j), keys + i * m->NKey, m->NKey * sizeof(INT));
+		m->Vals[j] = vals[i];
+		m->Used[j] = 1;
+		m->Count++;
+	}
+	free(keys);
+	free(vals);
+	free(used);
+}
+
+extern "C" void *pif_memo_cache(void **memo, INT nkey, INT bound, int direct) {
+	Memo *m = new Memo();
+	m->NKey = nkey;
+	m->Bound = bound;
+	m->Direct = 0;
+	if (direct && bound == 0) {
+		m->Direct = (DirectEntry*)malloc(MEMO_DIRECT * sizeof(DirectEntry));
+		for (size_t i = 0; i < MEMO_DIRECT; i++) {
+			new (&m->Direct[i]) DirectEntry();
+			m->Direct[i].Set.store(0, memory_order_relaxed);
+		}
+	}
+	size_t slots = MEMO_MIN_SLOTS;
+	while ((INT)slots < 2 * bound) slots *= 2;
+	allocSlots(m, slots);
+
+	// threads calling the function for the first time at once : the first cache stays
+	void *prev = __sync_val_compare_and_swap(memo, (void*)0, (void*)m);
+	if (prev == 0) return m;
+	freeSlots(m);
+	free(m->Direct);
+	delete m;
+	return prev;
+}
+
+extern "C" int pif_memo_get(void *cache, const INT *key, INT *val) {
+	Memo *m = (Memo*)cache;
+	if (m->Direct != 0 && (uint64_t)key[0] < MEMO_DIRECT) {
+		DirectEntry *e = &m->Direct[key[0]];
+		if (e->Set.load(memory_order_acquire) == 0) return 0;
+		*val = e->Val.load(memory_order_relaxed);
+		return 1;
+	}
+
+	lock_guard<mutex> lk(m->Lock);
+	size_t i = findSlot(m, key);
+	if (!m->Used[i]) return 0;
+	*val = m->Vals[i];
+	if (m->Bound > 0 && m->Head != i) {
+		unlink(m, i);
+		pushFront(m, i);
+	}
+	return 1;
+}
+
+extern "C" void pif_memo_put(void *cache, const INT *key, INT val) {
+	Memo *m = (Memo*)cache;
+	if (m->Direct != 0 && (uint64_t)key[0] < MEMO_DIRECT) {
+		DirectEntry *e = &m->Direct[key[0]];
+		e->Val.store(val, memory_order_relaxed);
+		e->Set.store(1, memory_order_release);
+		return;
+	}
+
+	lock_guard<mutex> lk(m->Lock);
+	size_t i = findSlot(m, key);
+	if (m->Used[i]) return;		// cached meanwhile by another thread
+	if (m->Bound > 0 && (INT)m->Count >= m->Bound) {
+		removeSlot(m, m->Tail);
+		i = findSlot(m, key);		// entries may have moved into the free slot
+	} else if (m->Bound == 0 && (m->Count + 1) * 2 > m->Mask + 1) {
+		grow(m);
+		i = findSlot(m, key);
+	}
+	memcpy(keyAt(m, i), key, m->NKey * sizeof(INT));
+	m->Vals[i] = val;
+	m->Used[i] = 1;
+	m->Count++;
+	if (m->Bound > 0) pushFront(m, i);
+}
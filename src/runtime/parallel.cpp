@@ -0,0 +1,76 @@
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "runtime.h"
+
+using namespace std;
+
+// Parallel loops, on the task scheduler of spawn/join (sched.cpp) : one pool of
+// threads for both.
+// The iterations of a loop are split in ranges. The thread running a range cuts
+// it in two until it is no larger than the grain, spawning a task for the upper
+// half every time and keeping the lower one : the largest ranges are the oldest
+// tasks of its deque, those other threads steal. The thread that started the loop
+// runs tasks until all the iterations are done, so loops may be nested.
+
+struct Loop {
+	pif_task Body;
+	void *Env;
+	INT Grain;
+	atomic<INT> Remaining;		// iterations not done yet
+};
+
+struct RangeTask {
+	Loop *L;
+	INT Lo, Hi;
+};
+
+static mutex ReduceLock;
+
+static void runRange(void *data);
+
+static void split(Loop *l, INT lo, INT hi) {
+	while (hi - lo > l->Grain) {
+		INT mid = lo + (hi - lo) / 2;
+		RangeTask *r = (RangeTask*)pif_task_new(runRange, sizeof(RangeTask));
+		r->L = l;
+		r->Lo = mid;
+		r->Hi = hi;
+		pif_task_spawn_detached(r);
+		hi = mid;
+	}
+	l->Body(l->Env, lo, hi);
+	l->Remaining.fetch_sub(hi - lo, memory_order_release);
+}
+
+static void runRange(void *data) {
+	RangeTask *r = (RangeTask*)data;
+	split(r->L, r->Lo, r->Hi);
+}
+
+extern "C" void pif_parallel_for(pif_task body, void *env, INT count, INT grain) {
+	if (count <= 0) return;
+	if (grain <= 0) grain = count / (pif_sched_threads() * 8);
+	if (grain < 1) grain = 1;
+
+	Loop l;
+	l.Body = body;
+	l.Env = env;
+	l.Grain = grain;
+	l.Remaining.store(count, memory_order_relaxed);
+
+	split(&l, 0, count);
+	while (l.Remaining.load(memory_order_acquire) > 0) {
+		if (!pif_sched_help()) this_thread::yield();
+	}
+}
+
+// Reductions : each range combines its partial result into the variable under this lock
+extern "C" void pif_parallel_lock() {
+	ReduceLock.lock();
+}
+
+extern "C" void pif_parallel_unlock() {
+	ReduceLock.unlock();
+}
@@ -0,0 +1,63 @@
+#ifndef DEF_RUNTIME_H
+#define DEF_RUNTIME_H
+
+#include "../config.h"
+
+/* Functions of the PIF runtime. They are linked into the compiler binary
+   and called by name from JIT-compiled code, so they must stay extern "C". */
+
+extern "C" {
+
+// tls.cpp - per-thread copies of package globals
+void *pif_tls_addr(INT id, void *master, INT size);
+void pif_tls_release();
+
+// lazy.cpp - lazy globals
+void pif_lazy_init(int *guard, void (*init)());
+
+// bounds.cpp - array and slice bounds checks, zero steps of 'for' loops
+void pif_bounds_fail(INT idx, INT len);
+void pif_step_fail();
+
+// parallel.cpp - parallel loops, on the scheduler of sched.cpp
+typedef void (*pif_task)(void *env, INT lo, INT hi);
+void pif_parallel_for(pif_task body, void *env, INT count, INT grain);
+void pif_parallel_lock();
+void pif_parallel_unlock();
+
+// sched.cpp - tasks for spawn/join
+void *pif_task_new(void (*run)(void *data), INT size);
+void pif_task_spawn(void *data);
+void pif_task_spawn_detached(void *data);
+void pif_task_join(void *data);
+void pif_task_free(void *data);
+INT pif_sched_tasks();
+INT pif_sched_steals();
+FLOAT pif_sched_idle_ms();
+void pif_sched_reset();
+int pif_sched_help();
+INT pif_sched_threads();
+
+// chan.cpp - channels
+void *pif_chan_new(INT elemSize, INT capacity);
+int pif_chan_try_send(void *chan, void *elem);
+int pif_chan_try_recv(void *chan, void *elem);
+void pif_chan_send(void *chan, void *elem);
+void pif_chan_recv(void *chan, void *elem);
+
+// gen.cpp - frames of generators
+void *pif_frame_new(INT size);
+void pif_frame_free(void *frame);
+
+// closure.cpp - trampolines and environments of closures
+void *pif_closure_new(INT envSize);
+void *pif_closure_code(void *block);
+
+// memo.cpp - caches of memo functions
+void *pif_memo_cache(void **memo, INT nkey, INT bound, int direct);
+int pif_memo_get(void *cache, const INT *key, INT *val);
+void pif_memo_put(void *cache, const INT *key, INT val);
+
+}
+
+#endif
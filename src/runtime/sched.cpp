@@ -0,0 +1,315 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+
+#include "runtime.h"
+
+using namespace std;
+
+// Task scheduler for spawn/join and parallel loops (see parallel.cpp).
+// A task record is a header followed by the data of the generated code : the
+// result of the call first, then the function and its arguments. The generated
+// code only knows the address of the data.
+// Every thread that spawns tasks has a Chase-Lev deque : the owner pushes and
+// takes at the bottom without locking, other threads steal from the top with a
+// compare-and-swap. Taking back LIFO means a join usually runs the task it waits
+// for itself. Pool threads with nothing to do steal, and after a short spin sleep
+// until more work is spawned. Joining never blocks : the thread runs other tasks
+// until the one it waits for is done.
+// Records are reused through per-thread free lists by size, so spawning does not
+// go through the allocator. Records on the lists of a thread that exits are lost.
+
+#define TASK_HEADER 64		// keeps the data aligned for vectors, and off the header's cache line
+#define TASK_CLASSES 16		// records of up to TASK_CLASSES * TASK_HEADER bytes of data are reused
+#define FREE_MAX 256		// records kept by thread and size
+#define MAX_DEQUES 256		// threads that spawn : the others run their tasks right away
+#define DEQUE_SLOTS 256		// initial size of a deque, it grows when full
+
+struct Task {
+	void (*Run)(void *data);
+	atomic<int> Done;
+	int Class;				// size of the record, in TASK_HEADER units, minus one
+	int Detached;			// freed when run, nobody joins it
+	Task *Next;				// in a free list
+};
+
+static inline void *dataOf(Task *t) { return (char*)t + TASK_HEADER; }
+static inline Task *taskOf(void *data) { return (Task*)((char*)data - TASK_HEADER); }
+
+struct Buffer {
+	INT Mask;				// slots - 1, slots being a power of 2
+	atomic<Task*> *Slots;
+	Buffer *Prev;			// replaced by this one : thieves may still read it, so it is kept
+};
+
+struct Deque {
+	atomic<INT> Top;		// next to steal
+	char Pad1[64];
+	atomic<INT> Bottom;		// next free slot, only written by the owner
+	atomic<Buffer*> Buf;
+	atomic<INT> Spawned;	// only written by the owner too
+	char Pad2[64];			// no false sharing between the deques of two threads
+};
+
+static atomic<Deque*> Deques[MAX_DEQUES];
+static atomic<unsigned> NDeques(0);
+static __thread Deque *Mine = 0;
+static __thread unsigned Self = 0;
+static __thread Task *FreeTasks[TASK_CLASSES];
+static __thread unsigned NFree[TASK_CLASSES];
+
+static once_flag Started;
+static atomic<bool> Ready(false);		// the pool is started
+static unsigned Workers = 0;
+
+static mutex SleepLock;
+static condition_variable Wake;
+static atomic<int> Sleeping(0);
+
+static atomic<INT> Steals(0), IdleNs(0);
+
+static Buffer *newBuffer(INT slots) {
+	Buffer *a = new Buffer();
+	a->Mask = slots - 1;
+	a->Slots = new atomic<Task*>[slots];
+	a->Prev = 0;
+	return a;
+}
+
+// The deque of this thread, made on its first spawn ; 0 when there are too many
+static Deque *myDeque() {
+	if (Mine != 0) return Mine;
+	unsigned i = NDeques.fetch_add(1);
+	if (i >= MAX_DEQUES) return 0;
+	Deque *d = new Deque();
+	d->Top.store(0, memory_order_relaxed);
+	d->Bottom.store(0, memory_order_relaxed);
+	d->Buf.store(newBuffer(DEQUE_SLOTS), memory_order_relaxed);
+	d->Spawned.store(0, memory_order_relaxed);
+	Deques[i].store(d, memory_order_release);
+	Mine = d;
+	Self = i;
+	return d;
+}
+
+static Buffer *grow(Deque *d, Buffer *a, INT top, INT bottom) {
+	Buffer *b = newBuffer((a->Mask + 1) * 2);
+	for (INT i = top; i < bottom; i++) {
+		b->Slots[i & b->Mask].store(a->Slots[i & a->Mask].load(memory_order_relaxed), memory_order_relaxed);
+	}
+	b->Prev = a;
+	d->Buf.store(b, memory_order_release);
+	return b;
+}
+
+static void push(Deque *d, Task *t) {
+	INT b = d->Bottom.load(memory_order_relaxed);
+	INT top = d->Top.load(memory_order_acquire);
+	Buffer *a = d->Buf.load(memory_order_relaxed);
+	if (b - top > a->Mask) a = grow(d, a, top, b);
+	a->Slots[b & a->Mask].store(t, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	d->Bottom.store(b + 1, memory_order_relaxed);
+}
+
+// Owner : the last task pushed. Thieves race for the last task left.
+static Task *pop(Deque *d) {
+	INT b = d->Bottom.load(memory_order_relaxed) - 1;
+	Buffer *a = d->Buf.load(memory_order_relaxed);
+	d->Bottom.store(b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	INT top = d->Top.load(memory_order_relaxed);
+	if (top > b) {
+		d->Bottom.store(b + 1, memory_order_relaxed);
+		return 0;
+	}
+	Task *t = a->Slots[b & a->Mask].load(memory_order_relaxed);
+	if (top == b) {
+		if (!d->Top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed)) t = 0;
+		d->Bottom.store(b + 1, memory_order_relaxed);
+	}
+	return t;
+}
+
+// Other threads : the oldest task, 0 when there is none or another thread took it first
+static Task *steal(Deque *d) {
+	INT top = d->Top.load(memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	INT b = d->Bottom.load(memory_order_acquire);
+	if (top >= b) return 0;
+	Buffer *a = d->Buf.load(memory_order_acquire);
+	Task *t = a->Slots[top & a->Mask].load(memory_order_relaxed);
+	if (!d->Top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed)) return 0;
+	return t;
+}
+
+static Task *take() {
+	if (Mine != 0) {
+		Task *t = pop(Mine);
+		if (t != 0) return t;
+	}
+	unsigned n = NDeques.load(memory_order_acquire);
+	if (n > MAX_DEQUES) n = MAX_DEQUES;
+	for (unsigned i = 1; i <= n; i++) {
+		Deque *d = Deques[(Self + i) % n].load(memory_order_acquire);
+		if (d == 0 || d == Mine) continue;
+		Task *t = steal(d);
+		if (t == 0) continue;
+		Steals.fetch_add(1, memory_order_relaxed);
+		return t;
+	}
+	return 0;
+}
+
+static void release(Task *t) {
+	int c = t->Class;
+	if (c < TASK_CLASSES && NFree[c] < FREE_MAX) {
+		t->Next = FreeTasks[c];
+		FreeTasks[c] = t;
+		NFree[c]++;
+	} else {
+		free(t);
+	}
+}
+
+static void run(Task *t) {
+	t->Run(dataOf(t));
+	if (t->Detached) release(t);
+	else t->Done.store(1, memory_order_release);
+}
+
+static void worker() {
+	myDeque();
+	while (1) {
+		Task *t = take();
+		if (t == 0) {
+			chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			// spin a little, then sleep until there is new work
+			for (int i = 0; i < 64 && t == 0; i++) {
+				this_thread::yield();
+				t = take();
+			}
+			if (t == 0) {
+				unique_lock<mutex> lk(SleepLock);
+				Sleeping++;
+				Wake.wait_for(lk, chrono::milliseconds(1));
+				Sleeping--;
+			}
+			IdleNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count();
+		}
+		if (t != 0) run(t);
+	}
+}
+
+// One pool thread per core besides the thread that started it
+static void start() {
+	unsigned n = thread::hardware_concurrency();
+	if (n < 2) n = 2;
+	Workers = n - 1;
+	for (unsigned i = 0; i < Workers; i++) {
+		thread(worker).detach();
+	}
+	Ready = true;
+}
+
+extern "C" INT pif_sched_threads() {
+	call_once(Started, start);
+	return Workers + 1;
+}
+
+extern "C" void *pif_task_new(void (*run)(void *data), INT size) {
+	int c = (int)((size + TASK_HEADER - 1) / TASK_HEADER);
+	Task *t = 0;
+	if (c < TASK_CLASSES && FreeTasks[c] != 0) {
+		t = FreeTasks[c];
+		FreeTasks[c] = t->Next;
+		NFree[c]--;
+	} else {
+		void *p = 0;
+		if (posix_memalign(&p, TASK_HEADER, TASK_HEADER * (c + 1)) != 0) abort();
+		t = (Task*)p;
+	}
+	t->Run = run;
+	t->Done.store(0, memory_order_relaxed);
+	t->Class = c;
+	t->Detached = 0;
+	return dataOf(t);
+}
+
+extern "C" void pif_task_spawn(void *data) {
+	call_once(Started, start);
+	Deque *d = myDeque();
+	if (d == 0) {
+		run(taskOf(data));
+		return;
+	}
+	push(d, taskOf(data));
+	d->Spawned.store(d->Spawned.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	if (Sleeping.load(memory_order_relaxed) > 0) Wake.notify_one();
+}
+
+// A task nobody joins : its record is freed once it has run
+extern "C" void pif_task_spawn_detached(void *data) {
+	taskOf(data)->Detached = 1;
+	pif_task_spawn(data);
+}
+
+extern "C" void pif_task_join(void *data) {
+	Task *t = taskOf(data);
+	while (t->Done.load(memory_order_acquire) == 0) {
+		Task *other = take();
+		if (other != 0) {
+			run(other);
+		} else {
+			this_thread::yield();
+		}
+	}
+}
+
+// Run one task waiting in some deque, if there is one : for threads waiting for
+// something else than a task (see chan.cpp and parallel.cpp), so that what they
+// wait for may happen
+extern "C" int pif_sched_help() {
+	if (!Ready) return 0;
+	Task *t = take();
+	if (t == 0) return 0;
+	run(t);
+	return 1;
+}
+
+extern "C" void pif_task_free(void *data) {
+	release(taskOf(data));
+}
+
+// Counters, for tuning (see package pif.sched)
+
+extern "C" INT pif_sched_tasks() {
+	INT n = 0;
+	unsigned k = NDeques.load(memory_order_acquire);
+	for (unsigned i = 0; i < k && i < MAX_DEQUES; i++) {
+		Deque *d = Deques[i].load(memory_order_acquire);
+		if (d != 0) n += d->Spawned.load(memory_order_relaxed);
+	}
+	return n;
+}
+
+extern "C" INT pif_sched_steals() {
+	return Steals;
+}
+
+extern "C" FLOAT pif_sched_idle_ms() {
+	return IdleNs / 1e6;
+}
+
+extern "C" void pif_sched_reset() {
+	unsigned k = NDeques.load(memory_order_acquire);
+	for (unsigned i = 0; i < k && i < MAX_DEQUES; i++) {
+		Deque *d = Deques[i].load(memory_order_acquire);
+		if (d != 0) d->Spawned.store(0, memory_order_relaxed);
+	}
+	Steals = 0;
+	IdleNs = 0;
+}
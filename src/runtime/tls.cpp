@@ -0,0 +1,43 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "runtime.h"
+
+// Per-thread copies of package globals. The generator numbers the globals it
+// accesses this way (see Generator::globalAddr), and a thread finds its copies in
+// an array indexed by that number.
+// A copy is created on first access from a thread, starting with the
+// current content of the master copy. Copies take whole cache lines, so that
+// threads updating their own copies do not slow each other down.
+
+#define LINE 64
+
+static __thread void **Copies = 0;
+static __thread INT NCopies = 0;
+
+extern "C" void *pif_tls_addr(INT id, void *master, INT size) {
+	if (id < NCopies && Copies[id] != 0) return Copies[id];
+
+	if (id >= NCopies) {
+		INT n = (NCopies == 0 ? 16 : NCopies);
+		while (n <= id) n *= 2;
+		Copies = (void**)realloc(Copies, n * sizeof(void*));
+		if (Copies == 0) abort();
+		memset(Copies + NCopies, 0, (n - NCopies) * sizeof(void*));
+		NCopies = n;
+	}
+	void *copy = 0;
+	if (posix_memalign(&copy, LINE, (size + LINE - 1) / LINE * LINE) != 0) abort();
+	memcpy(copy, master, size);
+	Copies[id] = copy;
+	return copy;
+}
+
+extern "C" void pif_tls_release() {
+	for (INT i = 0; i < NCopies; i++) {
+		free(Copies[i]);
+	}
+	free(Copies);
+	Copies = 0;
+	NCopies = 0;
+}
@@ -0,0 +1,462 @@
+#include <cmath>
+
+#include "../ast/stmt.h"
+#include "../Package.h"
+#include "../codegen-llvm/Generator.h"
+
+#include <llvm/ExecutionEngine/GenericValue.h>
+
+#include "../util.h"
+#include "../error.h"
+
+using namespace llvm;
+using namespace std;
+
+// Constant folding - done after type checking, before code generation.
+// Expressions whose value can be computed at compile time are replaced by literals,
+// and uses of constants (let definitions with a literal value, local or global,
+// in this package or in an imported one) are replaced by a copy of that literal.
+// Calls to const functions with literal arguments are run by the JIT and replaced
+// by their result.
+
+class ConstFold {
+	public:
+	static bool isLit(ExprAST *e) {
+		return (dynamic_cast<IntExprAST*>(e) != 0 || dynamic_cast<FloatExprAST*>(e) != 0
+			|| dynamic_cast<BoolExprAST*>(e) != 0);
+	}
+
+	// Value wrapped to the size of the type, like the machine would : literals retyped
+	// by asType keep the value they were written with, like 200 as an s8i
+	static INT wrap(INT v, IntTypeAST *t) {
+		if (t->Size < 64) {
+			unsigned long long mask = (1ULL << t->Size) - 1;
+			unsigned long long u = (unsigned long long)v & mask;
+			if (t->Signed && (u >> (t->Size - 1)) != 0) u |= ~mask;
+			v = (INT)u;
+		}
+		return v;
+	}
+
+	static ExprAST *makeInt(const FTag &tag, INT v, IntTypeAST *t, Context *ctx) {
+		ExprAST *e = new IntExprAST(tag, wrap(v, t), t);
+		e->type(ctx);
+		return e;
+	}
+	static ExprAST *makeFloat(const FTag &tag, FLOAT v, Context *ctx, BaseTypeAST *t = FLOATTYPE) {
+		ExprAST *e = new FloatExprAST(tag, v, t);
+		e->type(ctx);
+		return e;
+	}
+	static ExprAST *makeBool(const FTag &tag, bool v, Context *ctx) {
+		ExprAST *e = new BoolExprAST(tag, v);
+		e->type(ctx);
+		return e;
+	}
+
+	static bool isTrue(ExprAST *e) {
+		BoolExprAST *b = dynamic_cast<BoolExprAST*>(e);
+		return (b != 0 && b->Val);
+	}
+
+	static ExprAST *copy(ExprAST *e, const FTag &tag, Context *ctx) {
+		if (IntExprAST *i = dynamic_cast<IntExprAST*>(e)) return makeInt(tag, i->Val, i->IType, ctx);
+		if (FloatExprAST *f = dynamic_cast<FloatExprAST*>(e)) return makeFloat(tag, f->Val, ctx, f->FType);
+		if (BoolExprAST *b = dynamic_cast<BoolExprAST*>(e)) return makeBool(tag, b->Val, ctx);
+		throw new InternalError("Copying something that is not a literal.");
+	}
+
+	static ExprAST *unary(const FTag &tag, string op, ExprAST *e, Context *ctx) {
+		if (IntExprAST *i = dynamic_cast<IntExprAST*>(e)) {
+			if (op == "-") return makeInt(tag, (INT)(0ULL - (unsigned long long)i->Val), i->IType, ctx);
+		} else if (FloatExprAST *f = dynamic_cast<FloatExprAST*>(e)) {
+			if (op == "-") return makeFloat(tag, -f->Val, ctx, f->FType);
+		} else if (BoolExprAST *b = dynamic_cast<BoolExprAST*>(e)) {
+			if (op == "!") return makeBool(tag, !b->Val, ctx);
+		}
+		return 0;
+	}
+
+	static ExprAST *binary(const FTag &tag, string op, ExprAST *l, ExprAST *r, Context *ctx) {
+		IntExprAST *li = dynamic_cast<IntExprAST*>(l), *ri = dynamic_cast<IntExprAST*>(r);
+		FloatExprAST *lf = dynamic_cast<FloatExprAST*>(l), *rf = dynamic_cast<FloatExprAST*>(r);
+
+		if (lf != 0 && rf != 0) {
+			FLOAT a = lf->Val, b = rf->Val;
+			BaseTypeAST *t = lf->FType;		// f32 results are rounded by makeFloat
+			if (op == "+") return makeFloat(tag, a + b, ctx, t);
+			if (op == "-") return makeFloat(tag, a - b, ctx, t);
+			if (op == "*") return makeFloat(tag, a * b, ctx, t);
+			if (op == "/") return makeFloat(tag, a / b, ctx, t);
+			if (op == "%") return makeFloat(tag, fmod(a, b), ctx, t);
+			if (op == "<") return makeBool(tag, a < b, ctx);
+			if (op == ">") return makeBool(tag, a > b, ctx);
+			if (op == "<=") return makeBool(tag, a <= b, ctx);
+			if (op == ">=") return makeBool(tag, a >= b, ctx);
+			if (op == "==") return makeBool(tag, a == b, ctx);
+			if (op == "!=") return makeBool(tag, a != b, ctx);
+		} else if (li != 0 && ri != 0) {
+			IntTypeAST *t = li->IType;
+			INT a = wrap(li->Val, t), b = wrap(ri->Val, t);
+			unsigned long long ua = a, ub = b;		// zero-extended when t is unsigned
+			if (op == "+") return makeInt(tag, (INT)(ua + ub), t, ctx);
+			if (op == "-") return makeInt(tag, (INT)(ua - ub), t, ctx);
+			if (op == "*") return makeInt(tag, (INT)(ua * ub), t, ctx);
+			if (op == "/" || op == "%") {
+				if (ub == 0) return 0;		// leave that to the runtime
+				if (t->Signed) {
+					if (a == (INT)(1ULL << 63) && b == -1) return 0;
+					return makeInt(tag, (op == "/" ? a / b : a % b), t, ctx);
+				}
+				return makeInt(tag, (INT)(op == "/" ? ua / ub : ua % ub), t, ctx);
+			}
+			if (t->Signed) {
+				if (op == "<") return makeBool(tag, a < b, ctx);
+				if (op == ">") return makeBool(tag, a > b, ctx);
+				if (op == "<=") return makeBool(tag, a <= b, ctx);
+				if (op == ">=") return makeBool(tag, a >= b, ctx);
+			} else {
+				if (op == "<") return makeBool(tag, ua < ub, ctx);
+				if (op == ">") return makeBool(tag, ua > ub, ctx);
+				if (op == "<=") return makeBool(tag, ua <= ub, ctx);
+				if (op == ">=") return makeBool(tag, ua >= ub, ctx);
+			}
+			if (op == "==") return makeBool(tag, ua == ub, ctx);
+			if (op == "!=") return makeBool(tag, ua != ub, ctx);
+		}
+		return 0;
+	}
+
+	// A global constant used in a const function must be known at compile time,
+	// since the function may be run before the package is initialized.
+	static void checkPureUse(ExprAST *e, const FTag &tag, Context *userCtx) {
+		if (userCtx == 0 || userCtx->More == 0 || !userCtx->More->Pure || isLit(e)) return;
+		Symbol *s = e->refSymbol();
+		if (s != 0 && dynamic_cast<VarDefAST*>(s->Def) != 0) {
+			tag.Throw("Purity error: const function uses a global constant whose value is not known at compile time.");
+		}
+	}
+
+	// Run a const function at compile time
+	static ExprAST *evalCall(const FTag &tag, Symbol *s, const vector<ExprAST*> &args, TypeAST *retT, Context *ctx) {
+		Function *f = dyn_cast_or_null<Function>(s->llvmVal);
+		if (f == 0) return 0;
+		if (f->empty() && dynamic_cast<FuncDefAST*>(s->Def) != 0) {
+			ctx->Gen->buildConsts(ctx->Pkg);
+			if (f->empty()) return 0;	// we are building the const functions of this package right now
+		}
+
+		IntTypeAST *reti = dynamic_cast<IntTypeAST*>(retT);
+		if (reti == 0 && BaseTypeAST::isFloat(retT) == 0 && retT != BOOLTYPE) return 0;
+
+		vector<GenericValue> gargs;
+		for (unsigned i = 0; i < args.size(); i++) {
+			GenericValue g;
+			if (IntExprAST *ie = dynamic_cast<IntExprAST*>(args[i])) {
+				g.IntVal = APInt(ie->IType->Size, ie->Val, ie->IType->Signed);
+			} else if (FloatExprAST *fe = dynamic_cast<FloatExprAST*>(args[i])) {
+				if (fe->FType == F32TYPE) {
+					g.FloatVal = fe->Val;
+				} else {
+					g.DoubleVal = fe->Val;
+				}
+			} else if (BoolExprAST *be = dynamic_cast<BoolExprAST*>(args[i])) {
+				g.IntVal = APInt(1, (be->Val ? 1 : 0));
+			} else {
+				return 0;
+			}
+			gargs.push_back(g);
+		}
+
+		DBGP(cerr << "compile-time call: " << f->getName().str() << endl)
+
+		GenericValue r;
+		string why;
+		if (!ctx->Gen->evalCall(f, gargs, r, why)) {
+			tag.Warn("call to const function '" + s->Def->Name + "' left to the runtime: " + why + ".");
+			return 0;
+		}
+		if (reti != 0) {
+			return makeInt(tag, (reti->Signed ? r.IntVal.getSExtValue() : (INT)r.IntVal.getZExtValue()), reti, ctx);
+		} else if (retT == FLOATTYPE) {
+			return makeFloat(tag, r.DoubleVal, ctx);
+		} else if (retT == F32TYPE) {
+			return makeFloat(tag, r.FloatVal, ctx, F32TYPE);
+		} else {
+			return makeBool(tag, r.IntVal.getBoolValue(), ctx);
+		}
+	}
+
+	static ExprAST *cast(const FTag &tag, ExprAST *e, TypeAST *to, Context *ctx) {
+		IntTypeAST *toi = dynamic_cast<IntTypeAST*>(to);
+		BaseTypeAST *tof = BaseTypeAST::isFloat(to);		// not f16 and bf16, see BaseTypeAST::castCodegen
+
+		if (IntExprAST *i = dynamic_cast<IntExprAST*>(e)) {
+			INT v = wrap(i->Val, i->IType);
+			if (toi != 0) return makeInt(tag, v, toi, ctx);
+			if (tof != 0) {
+				if (i->IType->Signed) return makeFloat(tag, (FLOAT)v, ctx, tof);
+				return makeFloat(tag, (FLOAT)(unsigned long long)v, ctx, tof);
+			}
+		} else if (FloatExprAST *f = dynamic_cast<FloatExprAST*>(e)) {
+			if (tof != 0) return makeFloat(tag, f->Val, ctx, tof);
+			if (toi != 0) {
+				// out of range conversions are undefined, keep them for the runtime
+				FLOAT lim = ldexp((FLOAT)1, toi->Size - (toi->Signed ? 1 : 0));
+				if (!(f->Val < lim) || !(f->Val > (toi->Signed ? -lim - 1 : -1))) return 0;
+				if (toi->Signed) return makeInt(tag, (INT)f->Val, toi, ctx);
+				return makeInt(tag, (INT)(unsigned long long)f->Val, toi, ctx);
+			}
+		}
+		return 0;
+	}
+};
+
+// ============= Expressions =============
+
+ExprAST *ExprAST::fold() {
+	return this;
+}
+
+ExprAST *VarExprAST::fold() {
+	if (Sym == 0) return this;
+	if (VarDefAST *d = dynamic_cast<VarDefAST*>(Sym->Def)) {
+		if (d->Var) return this;
+		d->fold();
+		if (ConstFold::isLit(d->Val)) return ConstFold::copy(d->Val, Tag, Ctx);
+		if (IsGlobalConst) ConstFold::checkPureUse(this, Tag, Ctx);
+		if (VarExprAST *v = dynamic_cast<VarExprAST*>(d->Val)) {
+			// let f = some_function : refer directly to the function
+			if (v->Sym != 0 && (dynamic_cast<FuncDefAST*>(v->Sym->Def) != 0 ||
+					dynamic_cast<ExternFuncDefAST*>(v->Sym->Def) != 0)) {
+				VarExprAST *r = new VarExprAST(Tag, v->Name);
+				r->Sym = v->Sym;
+				r->Ctx = Ctx;
+				r->EType = v->EType;
+				return r;
+			}
+		}
+	}
+	return this;
+}
+
+ExprAST *DerefExprAST::fold() {
+	Val = Val->fold();
+	return this;
+}
+
+ExprAST *UnaryExprAST::fold() {
+	Expr = Expr->fold();
+	if (ConstFold::isLit(Expr)) {
+		ExprAST *r = ConstFold::unary(Tag, Op, Expr, Ctx);
+		if (r != 0) return r;
+	}
+	return this;
+}
+
+ExprAST *BinaryExprAST::fold() {
+	LHS = LHS->fold();
+	RHS = RHS->fold();
+	if (ConstFold::isLit(LHS) && ConstFold::isLit(RHS)) {
+		ExprAST *r = ConstFold::binary(Tag, Op, LHS, RHS, Ctx);
+		if (r != 0) return r;
+	}
+	return this;
+}
+
+ExprAST *DotMemberExprAST::fold() {
+	Obj = Obj->fold();
+	if (Member == "") {		// package member, already resolved
+		ConstFold::checkPureUse(Obj, Tag, Ctx);
+		return Obj;
+	}
+	if (Member == "len") {
+		TypeAST *t = Obj->type(Ctx);
+		if (RefTypeAST *rt = dynamic_cast<RefTypeAST*>(t)) t = rt->VType;
+		if (ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(t)) return ConstFold::makeInt(Tag, at->Length, INTTYPE, Ctx);
+		if (VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(t)) return ConstFold::makeInt(Tag, vt->Width, INTTYPE, Ctx);
+	}
+	return this;
+}
+
+ExprAST *CastExprAST::fold() {
+	Expr = Expr->fold();
+	if (!NeedCast) return Expr;
+	if (ConstFold::isLit(Expr)) {
+		ExprAST *r = ConstFold::cast(Tag, Expr, FType, Ctx);
+		if (r != 0) return r;
+	}
+	return this;
+}
+
+ExprAST *CallExprAST::fold() {
+	if (Subst != 0) return Subst->fold();
+
+	Callee = Callee->fold();
+	bool constArgs = true;
+	for (unsigned i = 0; i < Args.size(); i++) {
+		Args[i] = Args[i]->fold();
+		if (!ConstFold::isLit(Args[i])) constArgs = false;
+	}
+
+	Symbol *s = Callee->refSymbol();
+	if (constArgs && s != 0 && s->Def != 0 && s->Def->Const) {
+		ExprAST *r = ConstFold::evalCall(Tag, s, Args, EType, Ctx);
+		if (r != 0) return r;
+	}
+	return this;
+}
+
+ExprAST *StructExprAST::fold() {
+	for (unsigned i = 0; i < Vals.size(); i++) {
+		Vals[i] = Vals[i]->fold();
+	}
+	return this;
+}
+
+ExprAST *ArrayExprAST::fold() {
+	for (unsigned i = 0; i < Elems.size(); i++) {
+		Elems[i] = Elems[i]->fold();
+	}
+	return this;
+}
+
+ExprAST *IndexExprAST::fold() {
+	Obj = Obj->fold();
+	Idx = Idx->fold();
+	return this;
+}
+
+ExprAST *SliceExprAST::fold() {
+	Obj = Obj->fold();
+	if (Lo != 0) Lo = Lo->fold();
+	if (Hi != 0) Hi = Hi->fold();
+	return this;
+}
+
+// The call itself is not folded : it has to stay a call to be spawned
+ExprAST *SpawnExprAST::fold() {
+	CallExprAST *call = dynamic_cast<CallExprAST*>(Call);
+	call->Callee = call->Callee->fold();
+	for (unsigned i = 0; i < call->Args.size(); i++) {
+		call->Args[i] = call->Args[i]->fold();
+	}
+	return this;
+}
+
+ExprAST *JoinExprAST::fold() {
+	Handle = Handle->fold();
+	return this;
+}
+
+ExprAST *AtomicOpExprAST::fold() {
+	Ref = Ref->fold();
+	for (unsigned i = 0; i < Args.size(); i++) {
+		Args[i] = Args[i]->fold();
+	}
+	return this;
+}
+
+ExprAST *NewChanExprAST::fold() {
+	Capacity = Capacity->fold();
+	return this;
+}
+
+ExprAST *ChanOpExprAST::fold() {
+	Chan = Chan->fold();
+	for (unsigned i = 0; i < Args.size(); i++) {
+		Args[i] = Args[i]->fold();
+	}
+	return this;
+}
+
+ExprAST *GenOpExprAST::fold() {
+	Gen = Gen->fold();
+	for (unsigned i = 0; i < Args.size(); i++) {
+		Args[i] = Args[i]->fold();
+	}
+	return this;
+}
+
+ExprAST *VectorOpExprAST::fold() {
+	Vec = Vec->fold();
+	for (unsigned i = 0; i < Args.size(); i++) {
+		Args[i] = Args[i]->fold();
+	}
+	return this;
+}
+
+ExprAST *IfThenElseAST::fold() {
+	Cond = Cond->fold();
+	TrueBr = TrueBr->fold();
+	if (FalseBr != 0) FalseBr = FalseBr->fold();
+
+	if (ConstFold::isLit(Cond) && ConstFold::isLit(TrueBr) && FalseBr != 0 && ConstFold::isLit(FalseBr)) {
+		return ConstFold::copy(ConstFold::isTrue(Cond) ? TrueBr : FalseBr, Tag, Ctx);
+	}
+	return this;
+}
+
+ExprAST *WhileAST::fold() {
+	Cond = Cond->fold();
+	Inside = Inside->fold();
+	return this;
+}
+
+ExprAST *ForAST::fold() {
+	From = From->fold();
+	To = To->fold();
+	if (Step != 0) Step = Step->fold();
+	Inside = Inside->fold();
+	return this;
+}
+
+ExprAST *ForInAST::fold() {
+	Gen = Gen->fold();
+	Inside = Inside->fold();
+	return this;
+}
+
+ExprAST *ParallelForAST::fold() {
+	if (Grain != 0) Grain = Grain->fold();
+	return ForAST::fold();
+}
+
+ExprAST *BlockAST::fold() {
+	for (unsigned i = 0; i < Instructions.size(); i++) {
+		Instructions[i]->fold();
+	}
+	return this;
+}
+
+ExprAST *ReturnAST::fold() {
+	if (Val != 0) Val = Val->fold();
+	return this;
+}
+
+ExprAST *YieldAST::fold() {
+	Val = Val->fold();
+	return this;
+}
+
+ExprAST *FuncExprAST::fold() {
+	Code->fold();
+	return this;
+}
+
+// ============= Statements & definitions =============
+
+void ExprStmtAST::fold() {
+	Expr = Expr->fold();
+}
+
+void VarDefAST::fold() {
+	if (FoldState != 0) return;		// done, or dependency loop (caught by type checking)
+	FoldState = 1;
+	Val = Val->fold();
+	FoldState = 2;
+}
+
+void FuncDefAST::fold() {
+	Val->fold();
+}
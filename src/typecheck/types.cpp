@@ -33,6 +33,9 @@ std::string BaseTypeAST::typeDescStr() {
 	if (BaseType == bt_void) return "void";
 	if (BaseType == bt_bool) return "bool";
 	if (BaseType == bt_float) return "float";
+	if (BaseType == bt_f32) return "f32";
+	if (BaseType == bt_f16) return "f16";
+	if (BaseType == bt_bf16) return "bf16";
 	throw new InternalError("unknown base type");
 }
 
@@ -56,6 +59,66 @@ std::string RefTypeAST::typeDescStr() {
 	return "&" + VType->typeDescStr();
 }
 
+std::string ArrayTypeAST::typeDescStr() {
+	std::stringstream o;
+	o << (SoA ? "soa [" : "[") << Length << "]" << ElemType->typeDescStr();
+	return o.str();
+}
+
+std::string SliceTypeAST::typeDescStr() {
+	return "[]" + ElemType->typeDescStr();
+}
+
+std::string AtomicTypeAST::typeDescStr() {
+	return "atomic " + ValType->typeDescStr();
+}
+
+std::string ChanTypeAST::typeDescStr() {
+	return "chan " + ElemType->typeDescStr();
+}
+
+std::string TaskTypeAST::typeDescStr() {
+	return "task " + ResultType->typeDescStr();
+}
+
+std::string StructTypeAST::typeDescStr() {
+	std::string s = "struct {";
+	for (unsigned i = 0; i < Fields.size(); i++) {
+		s += (i == 0 ? " " : ", ") + Fields[i].first + " : " + Fields[i].second->typeDescStr();
+	}
+	return s + " }";
+}
+
+int StructTypeAST::fieldIndex(const std::string &name) {
+	for (unsigned i = 0; i < Fields.size(); i++) {
+		if (Fields[i].first == name) return i;
+	}
+	return -1;
+}
+
+std::string GenTypeAST::typeDescStr() {
+	return "gen " + YieldType->typeDescStr();
+}
+
+std::string VectorTypeAST::typeDescStr() {
+	std::stringstream o;
+	o << (ElemType == FLOATTYPE ? "f64" : ElemType->typeDescStr()) << "x" << Width;
+	return o.str();
+}
+
+std::string TypeParamAST::typeDescStr() {
+	return Name;
+}
+
+// Float types : the ones computations can be made with, or also the storage ones (f16, bf16)
+BaseTypeAST *BaseTypeAST::isFloat(TypeAST *t, bool storage) {
+	BaseTypeAST *b = dynamic_cast<BaseTypeAST*>(t);
+	if (b == 0) return 0;
+	if (b->BaseType == bt_float || b->BaseType == bt_f32) return b;
+	if (storage && (b->BaseType == bt_f16 || b->BaseType == bt_bf16)) return b;
+	return 0;
+}
+
 // Type dereferencing possibilities
 
 bool TypeAST::canDeref() {
@@ -66,6 +129,79 @@ bool RefTypeAST::canDeref() {
 	return (dynamic_cast<FuncTypeAST*>(VType) == 0);
 }
 
+// Type parameters : the type t of an argument is matched with the type of the argument
+// in the prototype of a generic function (this type). Each type parameter is bound to
+// the type it matches the first time, variables standing for their value. Returns
+// false when t does not have the same shape : the call is checked later anyway.
+
+TypeAST *RefTypeAST::valueType(TypeAST *t) {
+	while (t->canDeref()) t = dynamic_cast<RefTypeAST*>(t)->VType;
+	return t;
+}
+
+bool TypeAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	return RefTypeAST::valueType(t) == this;
+}
+
+bool TypeParamAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	if (params.count(Name) == 0) params[Name] = RefTypeAST::valueType(t);
+	return true;
+}
+
+bool FuncTypeAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	FuncTypeAST *ft = dynamic_cast<FuncTypeAST*>(t);
+	if (ft == 0 || ft->Args.size() != Args.size()) return false;
+	for (unsigned i = 0; i < Args.size(); i++) {
+		if (!Args[i]->ArgType->bindParams(ft->Args[i]->ArgType, params)) return false;
+	}
+	return ReturnType->bindParams(ft->ReturnType, params);
+}
+
+bool RefTypeAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	RefTypeAST *rt = dynamic_cast<RefTypeAST*>(t);
+	return rt != 0 && VType->bindParams(rt->VType, params);
+}
+
+bool ArrayTypeAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(RefTypeAST::valueType(t));
+	return at != 0 && at->Length == Length && at->SoA == SoA && ElemType->bindParams(at->ElemType, params);
+}
+
+bool SliceTypeAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	SliceTypeAST *st = dynamic_cast<SliceTypeAST*>(RefTypeAST::valueType(t));
+	return st != 0 && ElemType->bindParams(st->ElemType, params);
+}
+
+bool TaskTypeAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	TaskTypeAST *tt = dynamic_cast<TaskTypeAST*>(RefTypeAST::valueType(t));
+	return tt != 0 && ResultType->bindParams(tt->ResultType, params);
+}
+
+bool AtomicTypeAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	AtomicTypeAST *at = dynamic_cast<AtomicTypeAST*>(RefTypeAST::valueType(t));
+	return at != 0 && ValType->bindParams(at->ValType, params);
+}
+
+bool ChanTypeAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	ChanTypeAST *ct = dynamic_cast<ChanTypeAST*>(RefTypeAST::valueType(t));
+	return ct != 0 && ElemType->bindParams(ct->ElemType, params);
+}
+
+bool StructTypeAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	StructTypeAST *st = dynamic_cast<StructTypeAST*>(RefTypeAST::valueType(t));
+	if (st == 0 || st->Fields.size() != Fields.size()) return false;
+	for (unsigned i = 0; i < Fields.size(); i++) {
+		if (st->Fields[i].first != Fields[i].first) return false;
+		if (!Fields[i].second->bindParams(st->Fields[i].second, params)) return false;
+	}
+	return true;
+}
+
+bool GenTypeAST::bindParams(TypeAST *t, map<string, TypeAST*> &params) {
+	GenTypeAST *gt = dynamic_cast<GenTypeAST*>(RefTypeAST::valueType(t));
+	return gt != 0 && YieldType->bindParams(gt->YieldType, params);
+}
+
 // Type conversions
 
 ExprAST *ExprAST::asTypeOrError(TypeAST *ty) {
@@ -87,6 +223,25 @@ ExprAST *ExprAST::asType(TypeAST *ty) {
 	TypeAST *thisty = this->type(Ctx);
 	if (thisty == ty) return this;
 
+	if (AtomicTypeAST *at = dynamic_cast<AtomicTypeAST*>(ty)) return asAtomic(this, at);
+
+	// arrays in memory can be used as slices
+	if (SliceTypeAST *st = dynamic_cast<SliceTypeAST*>(ty)) {
+		RefTypeAST *rt = dynamic_cast<RefTypeAST*>(thisty);
+		ArrayTypeAST *at = (rt != 0 ? dynamic_cast<ArrayTypeAST*>(rt->VType) : 0);
+		if (at != 0 && at->ElemType == st->ElemType && !at->SoA) {
+			ExprAST *s = new SliceExprAST(Tag, this, 0, 0);
+			if (s->type(Ctx) == ty) return s;
+		}
+	}
+
+	// arrays of records are converted to the other layout
+	if (otherLayout(thisty, ty)) {
+		ExprAST *c = new CastExprAST(Tag, this, ty);
+		c->type(Ctx);
+		return c;
+	}
+
 	if (thisty->canDeref()) {
 		ExprAST *at = new DerefExprAST(Tag, this);
 		if (at->type(Ctx) == ty) return at;
@@ -100,19 +255,41 @@ ExprAST *ExprAST::asType(TypeAST *ty) {
 ExprAST *IntExprAST::asType(TypeAST *ty) {
 	if (this->Ctx == 0) throw new InternalError("Context not defined in IntExprAST::asType.");
 
+	if (AtomicTypeAST *at = dynamic_cast<AtomicTypeAST*>(ty)) return asAtomic(this, at);
+
 	IntTypeAST *tyi = dynamic_cast<IntTypeAST*>(ty);
 	if (tyi != 0) {
 		//TODO someday : check size...
 		IType = tyi;
 		return this;
 	}
-	BaseTypeAST *tyb = dynamic_cast<BaseTypeAST*>(ty);
-	if (tyb != 0 && tyb->BaseType == bt_float) {
-		return new FloatExprAST(Tag, (FLOAT)Val);
+	if (BaseTypeAST::isFloat(ty, true) != 0) {
+		ExprAST *f = new FloatExprAST(Tag, (FLOAT)Val);
+		f->type(Ctx);
+		return f->asType(ty);
 	}
 	return 0;
 }
 
+// Float literals are of the type they are used as, f16 and bf16 ones are converted
+ExprAST *FloatExprAST::asType(TypeAST *ty) {
+	if (this->Ctx == 0) throw new InternalError("Context not defined in FloatExprAST::asType.");
+	if (ty == FType) return this;
+
+	if (AtomicTypeAST *at = dynamic_cast<AtomicTypeAST*>(ty)) return asAtomic(this, at);
+
+	BaseTypeAST *f = BaseTypeAST::isFloat(ty, true);
+	if (f == 0) return 0;
+	if (BaseTypeAST::isFloat(ty) == 0) {
+		ExprAST *c = new CastExprAST(Tag, asType(F32TYPE), ty);
+		c->type(Ctx);
+		return c;
+	}
+	ExprAST *e = new FloatExprAST(Tag, Val, f);
+	e->type(Ctx);
+	return e;
+}
+
 ExprAST *ExternAST::asType(TypeAST *ty) {
 	if (this->Ctx == 0) throw new InternalError("Context not defined in ExternAST::asType.");
 
@@ -130,6 +307,70 @@ ExprAST *ExternAST::asType(TypeAST *ty) {
 	}
 }
 
+// Arrays and slices
+
+// Dereference an expression until it is an array in memory (&[N]T), an array value or a slice
+// (or a vector in memory, except vectors of bool that have no addressable lanes)
+ExprAST *ExprAST::derefArray(ExprAST *e, Context *ctx) {
+	TypeAST *t = e->type(ctx);
+	while (RefTypeAST *rt = dynamic_cast<RefTypeAST*>(t)) {
+		if (dynamic_cast<ArrayTypeAST*>(rt->VType) != 0 || !t->canDeref()) break;
+		VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(rt->VType);
+		if (vt != 0 && vt->ElemType != BOOLTYPE) break;
+		e = new DerefExprAST(e->Tag, e);
+		t = e->type(ctx);
+	}
+	return e;
+}
+
+// Indices and slice bounds are ints, whatever integer type they were given as
+ExprAST *ExprAST::asIndex(ExprAST *e, Context *ctx) {
+	TypeAST *t = e->type(ctx);
+	while (t != 0 && t->canDeref()) {
+		e = new DerefExprAST(e->Tag, e);
+		t = e->type(ctx);
+	}
+	if (t == INTTYPE) return e;
+	if (dynamic_cast<IntTypeAST*>(t) == 0) e->Tag.Throw("Type error: array index must be an integer.");
+	e = new CastExprAST(e->Tag, e, INTTYPE);
+	e->type(ctx);
+	return e;
+}
+
+// Whether 'from' is (a reference to) an array of the same records as array type 'to',
+// in the other layout (see ArrayTypeAST::castCodegen)
+bool ExprAST::otherLayout(TypeAST *from, TypeAST *to) {
+	ArrayTypeAST *toa = dynamic_cast<ArrayTypeAST*>(to);
+	if (toa == 0) return false;
+	while (from->canDeref()) from = dynamic_cast<RefTypeAST*>(from)->VType;
+	ArrayTypeAST *froma = dynamic_cast<ArrayTypeAST*>(from);
+	return (froma != 0 && froma->ElemType == toa->ElemType && froma->Length == toa->Length && froma->SoA != toa->SoA);
+}
+
+// Atomics are initialized with a plain value of their type
+ExprAST *ExprAST::asAtomic(ExprAST *e, AtomicTypeAST *t) {
+	ExprAST *v = e->asType(t->ValType);
+	if (v == 0) return 0;
+	ExprAST *c = new CastExprAST(e->Tag, v, t);
+	c->type(e->Ctx);
+	return c;
+}
+
+// Symbol an expression refers to, when it is just a name
+
+Symbol *ExprAST::refSymbol() {
+	return 0;
+}
+
+Symbol *VarExprAST::refSymbol() {
+	return Sym;
+}
+
+Symbol *DotMemberExprAST::refSymbol() {
+	if (Member == "") return Obj->refSymbol();
+	return 0;
+}
+
 // Get TypeAST for expressions
 
 TypeAST* IntExprAST::getType() {
@@ -141,7 +382,7 @@ TypeAST* BoolExprAST::getType() {
 }
 
 TypeAST *FloatExprAST::getType() {
-	return FLOATTYPE;
+	return FType;
 }
 
 TypeAST *VarExprAST::getType() {
@@ -155,6 +396,9 @@ TypeAST *VarExprAST::getType() {
 				if (VarDefAST *d = dynamic_cast<VarDefAST*>(Sym->Def)) {
 					if (!d->Var) IsGlobalConst = true;
 				}
+				checkPure(Ctx);
+			} else if (Ctx->More != 0 && Ctx->More->Lambda != 0) {
+				Ctx->More->Lambda->capture(Sym, i);
 			}
 			return Sym->SType;
 		}
@@ -167,6 +411,17 @@ TypeAST *VarExprAST::getType() {
 	return 0;
 }
 
+// Const functions may use global constants, but not global variables
+// (the value of global constants is checked when folding, see fold.cpp)
+void VarExprAST::checkPure(Context *userCtx) {
+	if (userCtx->More == 0 || !userCtx->More->Pure) return;
+	if (VarDefAST *d = dynamic_cast<VarDefAST*>(Sym->Def)) {
+		if (d->Var || d->Lazy) {
+			Tag.Throw("Purity error: const function cannot use global variable '" + Name + "'.");
+		}
+	}
+}
+
 TypeAST *DerefExprAST::getType() {
 	TypeAST *t = Val->type(Ctx);
 	if (t == 0) return 0;
@@ -182,17 +437,25 @@ TypeAST *DerefExprAST::getType() {
 
 TypeAST *UnaryExprAST::getType() {
 	TypeAST *inType = Expr->type(Ctx);
+	while (inType != 0 && inType->canDeref()) {
+		Expr = new DerefExprAST(Tag, Expr);
+		inType = Expr->type(Ctx);
+	}
 	if (inType == 0) return 0;
 
+	// on vectors, operators work element-wise
+	TypeAST *elemType = inType;
+	if (VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(inType)) elemType = vt->ElemType;
+
 	if (Op == "!") {
-		if (inType == BOOLTYPE) {
+		if (elemType == BOOLTYPE) {
 			return inType;
 		} else {
 			Tag.Throw("Unary negation '!' only works with bools.");
 		}
 	} else if (Op == "-") {
-		if (inType == FLOATTYPE) return inType;
-		if (dynamic_cast<IntTypeAST*>(inType) != 0) return inType;
+		if (BaseTypeAST::isFloat(elemType) != 0) return inType;
+		if (dynamic_cast<IntTypeAST*>(elemType) != 0) return inType;
 		Tag.Throw("Unary negation '-' only works with ints or floats.");
 	} else {
 		Tag.Throw("Unknown unary operator '" + Op + "'.");
@@ -209,6 +472,7 @@ TypeAST *BinaryExprAST::getType() {
 
 		RefTypeAST *ltr = dynamic_cast<RefTypeAST*>(lt);
 		if (ltr == 0) Tag.Throw("Cannot affect to non-reference value.");
+		if (dynamic_cast<AtomicTypeAST*>(ltr->VType) != 0) Tag.Throw("Atomics are written with their method 'store'.");
 
 		if (rt == ltr->VType) {
 			return rt;
@@ -241,13 +505,53 @@ TypeAST *BinaryExprAST::getType() {
 
 		if (lt == 0 || rt == 0) return 0;
 
+		// f16 and bf16 values are computed with as f32
+		if (BaseTypeAST::isFloat(lt, true) != 0 && BaseTypeAST::isFloat(lt) == 0) {
+			LHS = new CastExprAST(Tag, LHS, F32TYPE);
+			lt = LHS->type(Ctx);
+		}
+		if (BaseTypeAST::isFloat(rt, true) != 0 && BaseTypeAST::isFloat(rt) == 0) {
+			RHS = new CastExprAST(Tag, RHS, F32TYPE);
+			rt = RHS->type(Ctx);
+		}
+
+		// SIMD vectors : element-wise operations, scalars are broadcast to all lanes
+		VectorTypeAST *lv = dynamic_cast<VectorTypeAST*>(lt), *rv = dynamic_cast<VectorTypeAST*>(rt);
+		if (lv != 0 || rv != 0) {
+			VectorTypeAST *vt = (lv != 0 ? lv : rv);
+			if (lv == 0) {
+				LHS = new CastExprAST(Tag, LHS, vt);
+				if (LHS->type(Ctx) == 0) Tag.Throw("cannot compute '" + Op + "' operation (LHS to vector fail).");
+			}
+			if (rv == 0) {
+				RHS = new CastExprAST(Tag, RHS, vt);
+				if (RHS->type(Ctx) == 0) Tag.Throw("cannot compute '" + Op + "' operation (RHS to vector fail).");
+			}
+			if (lv != 0 && rv != 0 && lv != rv) {
+				Tag.Throw("Operator '" + Op + "' on different vector types '" + lv->typeDescStr() +
+					"' and '" + rv->typeDescStr() + "'.");
+			}
+			if (vt->ElemType == BOOLTYPE) Tag.Throw("Operator '" + Op + "' only defined on vectors of integers and floats.");
+			return (retBool ? VectorTypeAST::Get(BOOLTYPE, vt->Width) : vt);
+		}
+
 		IntTypeAST *li = dynamic_cast<IntTypeAST*>(lt);
 		IntTypeAST *ri = dynamic_cast<IntTypeAST*>(rt);
-		BaseTypeAST *lf = dynamic_cast<BaseTypeAST*>(lt);
-		lf = (lf != 0 && lf->BaseType == bt_float ? lf : 0);
-		BaseTypeAST *rf = dynamic_cast<BaseTypeAST*>(rt);
-		rf = (rf != 0 && rf->BaseType == bt_float ? rf : 0);
+		BaseTypeAST *lf = BaseTypeAST::isFloat(lt);
+		BaseTypeAST *rf = BaseTypeAST::isFloat(rt);
 		
+		if (lf != 0 && rf != 0 && lf != rf) {
+			// float and f32 : literals take the type of the other side, otherwise f32 is widened
+			if (dynamic_cast<FloatExprAST*>(LHS) != 0 || (dynamic_cast<FloatExprAST*>(RHS) == 0 && rf == FLOATTYPE)) {
+				LHS = new CastExprAST(Tag, LHS, rf);
+				LHS->type(Ctx);
+				lf = rf;
+			} else {
+				RHS = new CastExprAST(Tag, RHS, lf);
+				RHS->type(Ctx);
+				rf = lf;
+			}
+		}
 		if ((lf != 0 && rf != 0) || (lf != 0 && ri != 0) || (li != 0 && rf != 0)) {
 			if (lf == 0) {
 				LHS = LHS->asTypeOrError(rf);
@@ -286,15 +590,63 @@ TypeAST *DotMemberExprAST::getType() {
 	TypeAST *inType = Obj->type(Ctx);
 	if (inType == 0) return 0;
 	if (PackageTypeAST *pt = dynamic_cast<PackageTypeAST*>(inType)) {
-		Obj = new VarExprAST(Tag, Member);
+		VarExprAST *v = new VarExprAST(Tag, Member);
+		Obj = v;
 		TypeAST *retType = (Obj->type(&pt->Pkg->Ctx));
 		if (retType == 0)
 			Tag.Throw( "no such member '" + Member + "' in package '" + pt->Pkg->Name + "'.");
+		v->checkPure(Ctx);
 		Member = "";
 		return retType;
-	} else {
-		Tag.Throw("accessing a member using '.' is only possible with packages.");
 	}
+
+	// fields of records, in place when the record is in memory
+	ExprAST *rec = Obj;
+	TypeAST *recType = inType;
+	while (RefTypeAST *rt = dynamic_cast<RefTypeAST*>(recType)) {
+		if (dynamic_cast<StructTypeAST*>(rt->VType) != 0 || !recType->canDeref()) break;
+		rec = new DerefExprAST(Tag, rec);
+		recType = rec->type(Ctx);
+	}
+	RefTypeAST *recRef = dynamic_cast<RefTypeAST*>(recType);
+	StructTypeAST *st = dynamic_cast<StructTypeAST*>(recRef != 0 ? recRef->VType : recType);
+	if (st != 0) {
+		Field = st->fieldIndex(Member);
+		if (Field < 0) Tag.Throw("No field '" + Member + "' in record of type " + st->typeDescStr() + ".");
+		Obj = rec;
+		TypeAST *ft = st->Fields[Field].second;
+		return (recRef != 0 ? RefTypeAST::Get(ft) : ft);
+	}
+
+	if (Member == "len") {
+		Obj = derefArray(Obj, Ctx);
+		inType = Obj->type(Ctx);
+		if (RefTypeAST *rt = dynamic_cast<RefTypeAST*>(inType)) inType = rt->VType;
+		if (dynamic_cast<ArrayTypeAST*>(inType) != 0 || dynamic_cast<SliceTypeAST*>(inType) != 0 ||
+				dynamic_cast<VectorTypeAST*>(inType) != 0) {
+			return INTTYPE;
+		}
+	}
+	Tag.Throw("accessing a member using '.' is only possible with packages and records (or '.len' with arrays, slices and vectors).");
+	return 0;
+}
+
+// Builtin methods, called like 'obj.method(args)'. Returns the expression the call
+// really is, or 0 when it is a normal call (of a function in a package).
+ExprAST *DotMemberExprAST::methodCall(const std::vector<ExprAST*> &args, Context *ctx) {
+	TypeAST *t = Obj->type(ctx);
+	if (t == 0 || dynamic_cast<PackageTypeAST*>(t) != 0) return 0;
+	while (t->canDeref()) {
+		// atomics are used in place
+		RefTypeAST *rt = dynamic_cast<RefTypeAST*>(t);
+		if (rt != 0 && dynamic_cast<AtomicTypeAST*>(rt->VType) != 0) return new AtomicOpExprAST(Tag, Obj, Member, args);
+		Obj = new DerefExprAST(Tag, Obj);
+		t = Obj->type(ctx);
+	}
+	if (dynamic_cast<VectorTypeAST*>(t) != 0) return new VectorOpExprAST(Tag, Obj, Member, args);
+	if (dynamic_cast<ChanTypeAST*>(t) != 0) return new ChanOpExprAST(Tag, Obj, Member, args);
+	if (dynamic_cast<GenTypeAST*>(t) != 0) return new GenOpExprAST(Tag, Obj, Member, args);
+	return 0;
 }
 
 TypeAST *CastExprAST::getType() {
@@ -307,6 +659,26 @@ TypeAST *CastExprAST::getType() {
 		return FType;
 	}
 
+	// atomics are made of a plain value (the LLVM value is the same)
+	if (AtomicTypeAST *toat = dynamic_cast<AtomicTypeAST*>(FType)) {
+		Expr = Expr->asTypeOrError(toat->ValType);
+		return FType;
+	}
+
+	// arrays of records in the other layout
+	if (otherLayout(fromT, FType)) {
+		while (fromT->canDeref()) {
+			Expr = new DerefExprAST(Tag, Expr);
+			fromT = Expr->type(Ctx);
+		}
+		return FType;
+	}
+
+	// to f16 and bf16, literals too are converted by BaseTypeAST::castCodegen
+	if (BaseTypeAST::isFloat(FType, true) != 0 && BaseTypeAST::isFloat(FType) == 0 && BaseTypeAST::isFloat(fromT) != 0) {
+		return FType;
+	}
+
 	ExprAST *contAsType = Expr->asType(FType);
 	if (contAsType != 0) {
 		Expr = contAsType;
@@ -314,16 +686,44 @@ TypeAST *CastExprAST::getType() {
 		return FType;
 	}
 
+	// Array filled with a value
+	if (ArrayTypeAST *toa = dynamic_cast<ArrayTypeAST*>(FType)) {
+		ExprAST *e = Expr->asType(toa->ElemType);
+		if (e != 0) {
+			Expr = e;
+			return FType;
+		}
+	}
+
+	// Vectors : broadcast of a scalar, lanes of an array, first elements of a slice,
+	// or conversion of the elements of another vector (see VectorTypeAST::castCodegen)
+	if (VectorTypeAST *tov = dynamic_cast<VectorTypeAST*>(FType)) {
+		ExprAST *e = Expr->asType(tov->ElemType);
+		if (e == 0 && tov->ElemType != BOOLTYPE) e = Expr->asType(SliceTypeAST::Get(tov->ElemType));
+		if (e != 0) {
+			Expr = e;
+			return FType;
+		}
+		while (fromT->canDeref()) {
+			Expr = new DerefExprAST(Tag, Expr);
+			fromT = Expr->type(Ctx);
+		}
+		ArrayTypeAST *froma = dynamic_cast<ArrayTypeAST*>(fromT);
+		if (froma != 0 && froma->ElemType == tov->ElemType && froma->Length == tov->Width) return FType;
+		VectorTypeAST *fromv = dynamic_cast<VectorTypeAST*>(fromT);
+		if (fromv != 0 && fromv->Width == tov->Width && fromv->ElemType != BOOLTYPE && tov->ElemType != BOOLTYPE) {
+			return FType;
+		}
+	}
+
 	while (1) {
 		
 		// Test INT<->FLOAT casts
 		IntTypeAST *fromi = dynamic_cast<IntTypeAST*>(fromT);
-		BaseTypeAST *fromf = dynamic_cast<BaseTypeAST*>(fromT);
-		fromf = (fromf != 0 && fromf->BaseType == bt_float ? fromf : 0);
+		BaseTypeAST *fromf = BaseTypeAST::isFloat(fromT, true);
 
 		IntTypeAST *toi = dynamic_cast<IntTypeAST*>(FType);
-		BaseTypeAST *tof = dynamic_cast<BaseTypeAST*>(FType);
-		tof = (tof != 0 && tof->BaseType == bt_float ? tof : 0);
+		BaseTypeAST *tof = BaseTypeAST::isFloat(FType, true);
 		if ((fromi != 0 || fromf != 0) && (toi != 0 || tof != 0)) {
 			return FType;
 		}
@@ -348,14 +748,33 @@ TypeAST *CastExprAST::getType() {
 }
 
 TypeAST *CallExprAST::getType() {
+	if (DotMemberExprAST *dm = dynamic_cast<DotMemberExprAST*>(Callee)) {
+		Subst = dm->methodCall(Args, Ctx);
+		if (Subst != 0) return Subst->type(Ctx);
+	}
+
 	TypeAST *t = Callee->type(Ctx);
 
+	// calls to generic functions call the instance for the types of the arguments
+	Symbol *s = Callee->refSymbol();
+	if (GenericFuncDefAST *g = dynamic_cast<GenericFuncDefAST*>(s != 0 ? s->Def : 0)) {
+		Callee = g->instanceCall(Args, Ctx, Tag);
+		t = Callee->type(Ctx);
+	}
+
 	FuncTypeAST *funct = 0; 
 	if (RefTypeAST *reft = dynamic_cast<RefTypeAST*>(t)) {
 		funct = dynamic_cast<FuncTypeAST*>(reft->VType);
 	}
 
 	if (funct != 0) {
+		if (Ctx->More != 0 && Ctx->More->Pure) {
+			Symbol *s = Callee->refSymbol();
+			if (s == 0 || s->Def == 0 || !s->Def->Const) {
+				Tag.Throw("Purity error: const function can only call other const functions.");
+			}
+		}
+
 		// Check argument types
 		if (Args.size() != funct->Args.size()) {
 			Tag.Throw(
@@ -378,6 +797,282 @@ TypeAST *CallExprAST::getType() {
 	}
 }
 
+TypeAST *SpawnExprAST::getType() {
+	CallExprAST *call = dynamic_cast<CallExprAST*>(Call);
+	if (call == 0) Tag.Throw("'spawn' must be followed by a function call.");
+	TypeAST *t = call->type(Ctx);
+	if (t == 0) return 0;
+	if (call->Subst != 0) Tag.Throw("Builtin methods cannot be spawned.");
+	return TaskTypeAST::Get(t);
+}
+
+TypeAST *JoinExprAST::getType() {
+	TypeAST *t = Handle->type(Ctx);
+	while (t != 0 && t->canDeref()) {
+		Handle = new DerefExprAST(Handle->Tag, Handle);
+		t = Handle->type(Ctx);
+	}
+	if (t == 0) return 0;
+	TaskTypeAST *tt = dynamic_cast<TaskTypeAST*>(t);
+	if (tt == 0) Tag.Throw("'join' waits for a task, not a " + t->typeDescStr() + ".");
+	return tt->ResultType;
+}
+
+TypeAST *StructExprAST::getType() {
+	if (Vals.size() != SType->Fields.size()) {
+		Tag.Throw("Wrong number of values for record of type " + SType->typeDescStr() + ".");
+	}
+	for (unsigned i = 0; i < Vals.size(); i++) {
+		if (Vals[i]->type(Ctx) == 0) return 0;
+		Vals[i] = Vals[i]->asTypeOrError(SType->Fields[i].second);
+	}
+	return SType;
+}
+
+TypeAST *ArrayExprAST::getType() {
+	TypeAST *et = Elems[0]->type(Ctx);
+	if (et == 0) return 0;
+	while (et->canDeref()) {
+		Elems[0] = new DerefExprAST(Tag, Elems[0]);
+		et = Elems[0]->type(Ctx);
+	}
+	if (et == VOIDTYPE) Tag.Throw("Arrays of void make no sense.");
+
+	for (unsigned i = 1; i < Elems.size(); i++) {
+		TypeAST *t = Elems[i]->type(Ctx);
+		if (t == 0) return 0;
+		if (t != et) {
+			Elems[i] = Elems[i]->asTypeOrError(et);
+		}
+	}
+	return ArrayTypeAST::Get(et, Elems.size());
+}
+
+TypeAST *IndexExprAST::getType() {
+	Obj = derefArray(Obj, Ctx);
+	TypeAST *t = Obj->type(Ctx);
+	if (t == 0) return 0;
+	Idx = asIndex(Idx, Ctx);
+
+	if (RefTypeAST *rt = dynamic_cast<RefTypeAST*>(t)) {
+		if (ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(rt->VType)) {
+			return RefTypeAST::Get(at->ElemType);
+		}
+		if (VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(rt->VType)) {
+			return RefTypeAST::Get(vt->ElemType);
+		}
+	}
+	if (ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(t)) return at->ElemType;
+	if (SliceTypeAST *st = dynamic_cast<SliceTypeAST*>(t)) return RefTypeAST::Get(st->ElemType);
+	if (VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(t)) return vt->ElemType;
+	Tag.Throw("Type error: indexing something that is not an array or a slice ('" + t->typeDescStr() + "').");
+	return 0;
+}
+
+TypeAST *SliceExprAST::getType() {
+	Obj = derefArray(Obj, Ctx);
+	TypeAST *t = Obj->type(Ctx);
+	if (t == 0) return 0;
+	if (Lo != 0) Lo = asIndex(Lo, Ctx);
+	if (Hi != 0) Hi = asIndex(Hi, Ctx);
+
+	if (RefTypeAST *rt = dynamic_cast<RefTypeAST*>(t)) {
+		if (ArrayTypeAST *at = dynamic_cast<ArrayTypeAST*>(rt->VType)) {
+			if (at->SoA) Tag.Throw("Type error: cannot take a slice of a soa array, its records are not contiguous.");
+			return SliceTypeAST::Get(at->ElemType);
+		}
+	}
+	if (dynamic_cast<SliceTypeAST*>(t) != 0) return t;
+	if (dynamic_cast<ArrayTypeAST*>(t) != 0) {
+		Tag.Throw("Type error: cannot take a slice of an array value, only of an array variable.");
+	}
+	Tag.Throw("Type error: taking a slice of something that is not an array or a slice ('" + t->typeDescStr() + "').");
+	return 0;
+}
+
+TypeAST *VectorOpExprAST::getType() {
+	VectorTypeAST *vt = dynamic_cast<VectorTypeAST*>(Vec->type(Ctx));
+	if (vt == 0) throw new InternalError("Vector operation on something that is not a vector.");
+	bool isMask = (vt->ElemType == BOOLTYPE);
+	for (unsigned i = 0; i < Args.size(); i++) {
+		if (Args[i]->type(Ctx) == 0) return 0;
+	}
+
+	if (Op == "sum" || Op == "product" || Op == "min" || Op == "max") {
+		// horizontal reductions
+		if (isMask) Tag.Throw("'" + Op + "' is not defined on vectors of bool.");
+		if (Args.size() != 0) Tag.Throw("'" + Op + "' takes no arguments.");
+		return vt->ElemType;
+	} else if (Op == "any" || Op == "all") {
+		if (!isMask) Tag.Throw("'" + Op + "' is only defined on vectors of bool.");
+		if (Args.size() != 0) Tag.Throw("'" + Op + "' takes no arguments.");
+		return BOOLTYPE;
+	} else if (Op == "select") {
+		// mask.select(a, b) : lanes of a where the mask is true, lanes of b elsewhere
+		if (!isMask) Tag.Throw("'select' is only defined on vectors of bool, like the result of comparisons.");
+		if (Args.size() != 2) Tag.Throw("'select' takes two arguments.");
+		VectorTypeAST *rt = 0;
+		for (unsigned i = 0; i < 2 && rt == 0; i++) {
+			TypeAST *t = Args[i]->type(Ctx);
+			if (RefTypeAST *r = dynamic_cast<RefTypeAST*>(t)) t = r->VType;
+			rt = dynamic_cast<VectorTypeAST*>(t);
+		}
+		if (rt == 0 || rt->Width != vt->Width) Tag.Throw("'select' needs vectors as wide as the mask.");
+		for (unsigned i = 0; i < 2; i++) {
+			ExprAST *e = Args[i]->asType(rt);
+			if (e == 0) {
+				e = new CastExprAST(Tag, Args[i], rt);		// scalar, broadcast to all lanes
+				if (e->type(Ctx) == 0) Tag.Throw("Wrong type for argument of 'select'.");
+			}
+			Args[i] = e;
+		}
+		return rt;
+	} else if (Op == "insert") {
+		// v.insert(i, x) : v with lane i replaced by x
+		if (Args.size() != 2) Tag.Throw("'insert' takes two arguments.");
+		Args[0] = asIndex(Args[0], Ctx);
+		Args[1] = Args[1]->asTypeOrError(vt->ElemType);
+		return vt;
+	} else if (Op == "shuffle") {
+		// v.shuffle(i, j, ...) or v.shuffle(w, i, j, ...) : vector made of the given lanes of v (and w)
+		unsigned first = 0;
+		if (Args.size() > 0) {
+			ExprAST *w = Args[0]->asType(vt);
+			if (w != 0) {
+				Args[0] = w;
+				first = 1;
+			}
+		}
+		unsigned width = Args.size() - first;
+		if (width < 2 || (width & (width - 1)) != 0) Tag.Throw("'shuffle' needs a power of two number of lanes.");
+		for (unsigned i = first; i < Args.size(); i++) {
+			Args[i] = asIndex(Args[i], Ctx);
+		}
+		return VectorTypeAST::Get(vt->ElemType, width);
+	} else if (Op == "store") {
+		// v.store(s) : write the lanes of v to the first elements of s
+		if (isMask) Tag.Throw("vectors of bool cannot be stored.");
+		if (Args.size() != 1) Tag.Throw("'store' takes one argument.");
+		Args[0] = Args[0]->asTypeOrError(SliceTypeAST::Get(vt->ElemType));
+		return VOIDTYPE;
+	} else if (Op == "bits" || Op == "frombits") {
+		// v.bits() : the float lanes of v as signed integers of the same size, frombits the other way
+		if (Args.size() != 0) Tag.Throw("'" + Op + "' takes no arguments.");
+		BaseTypeAST *ft = BaseTypeAST::isFloat(vt->ElemType);
+		IntTypeAST *it = dynamic_cast<IntTypeAST*>(vt->ElemType);
+		if (Op == "bits" && ft == FLOATTYPE) return VectorTypeAST::Get(IntTypeAST::Get(64, true), vt->Width);
+		if (Op == "bits" && ft == F32TYPE) return VectorTypeAST::Get(IntTypeAST::Get(32, true), vt->Width);
+		if (Op == "frombits" && it != 0 && it->Size == 64) return VectorTypeAST::Get(FLOATTYPE, vt->Width);
+		if (Op == "frombits" && it != 0 && it->Size == 32) return VectorTypeAST::Get(F32TYPE, vt->Width);
+		Tag.Throw("'" + Op + "' is not defined on '" + vt->typeDescStr() + "'.");
+	}
+	Tag.Throw("Unknown vector method '" + Op + "'.");
+	return 0;
+}
+
+TypeAST *AtomicOpExprAST::getType() {
+	AtomicTypeAST *at = dynamic_cast<AtomicTypeAST*>(dynamic_cast<RefTypeAST*>(Ref->type(Ctx))->VType);
+	if (at == 0) throw new InternalError("Atomic operation on something that is not an atomic.");
+	TypeAST *vt = at->ValType;
+
+	// memory ordering, given as last argument
+	if (!Args.empty()) {
+		if (OrderingExprAST *o = dynamic_cast<OrderingExprAST*>(Args.back())) {
+			Order = o->Order;
+			Args.pop_back();
+		}
+	}
+
+	unsigned nargs = 1;
+	TypeAST *ret = vt;
+	if (Op == "load") {
+		if (Order == "release" || Order == "acq_rel") Tag.Throw("An atomic load cannot have ordering '" + Order + "'.");
+		nargs = 0;
+	} else if (Op == "store") {
+		if (Order == "acquire" || Order == "acq_rel") Tag.Throw("An atomic store cannot have ordering '" + Order + "'.");
+		ret = VOIDTYPE;
+	} else if (Op == "compare_exchange") {
+		// c.compare_exchange(expected, desired) : the previous value, that is expected when it succeeded
+		nargs = 2;
+	} else if (Op == "fetch_add" || Op == "fetch_sub" || Op == "fetch_and" || Op == "fetch_or" ||
+			Op == "fetch_xor" || Op == "fetch_min" || Op == "fetch_max") {
+		if (dynamic_cast<IntTypeAST*>(vt) == 0) Tag.Throw("'" + Op + "' is only defined on atomic integers.");
+	} else if (Op != "exchange") {
+		Tag.Throw("Unknown atomic method '" + Op + "'.");
+	}
+
+	if (Args.size() != nargs) Tag.Throw("Wrong number of arguments for atomic method '" + Op + "'.");
+	for (unsigned i = 0; i < Args.size(); i++) {
+		if (Args[i]->type(Ctx) == 0) return 0;
+		Args[i] = Args[i]->asTypeOrError(vt);
+	}
+	return ret;
+}
+
+TypeAST *NewChanExprAST::getType() {
+	Capacity = asIndex(Capacity, Ctx);
+	return ChanTypeAST::Get(ElemType);
+}
+
+TypeAST *ChanOpExprAST::getType() {
+	ChanTypeAST *ct = dynamic_cast<ChanTypeAST*>(Chan->type(Ctx));
+	if (ct == 0) throw new InternalError("Channel operation on something that is not a channel.");
+	for (unsigned i = 0; i < Args.size(); i++) {
+		if (Args[i]->type(Ctx) == 0) return 0;
+	}
+
+	if (Op == "recv") {
+		if (Args.size() != 0) Tag.Throw("'recv' takes no arguments.");
+		return ct->ElemType;
+	}
+	if (Args.size() != 1) Tag.Throw("'" + Op + "' takes one argument.");
+	if (Op == "send" || Op == "try_send") {
+		Args[0] = Args[0]->asTypeOrError(ct->ElemType);
+		return (Op == "send" ? VOIDTYPE : BOOLTYPE);
+	} else if (Op == "try_recv") {
+		// c.try_recv(x) : false when there is nothing to receive, otherwise the value is put in x
+		if (Args[0]->type(Ctx) != RefTypeAST::Get(ct->ElemType)) {
+			Tag.Throw("'try_recv' needs a variable of type " + ct->ElemType->typeDescStr() + " to store the value.");
+		}
+		return BOOLTYPE;
+	}
+	Tag.Throw("Unknown channel method '" + Op + "'.");
+	return 0;
+}
+
+TypeAST *GenOpExprAST::getType() {
+	GenTypeAST *gt = dynamic_cast<GenTypeAST*>(Gen->type(Ctx));
+	if (gt == 0) throw new InternalError("Generator operation on something that is not a generator.");
+	for (unsigned i = 0; i < Args.size(); i++) {
+		if (Args[i]->type(Ctx) == 0) return 0;
+	}
+
+	if (Op == "next") {
+		// g.next(x) : false when the generator is done, otherwise the next value is put in x
+		if (Args.size() != 1 || Args[0]->type(Ctx) != RefTypeAST::Get(gt->YieldType)) {
+			Tag.Throw("'next' needs a variable of type " + gt->YieldType->typeDescStr() + " to store the value.");
+		}
+		return BOOLTYPE;
+	} else if (Op == "free") {
+		if (Args.size() != 0) Tag.Throw("'free' takes no arguments.");
+		return VOIDTYPE;
+	}
+	Tag.Throw("Unknown generator method '" + Op + "'.");
+	return 0;
+}
+
+TypeAST *OrderingExprAST::getType() {
+	Tag.Throw("Memory ordering '" + Order + "' can only be the last argument of an atomic operation.");
+	return 0;
+}
+
+TypeAST *FenceExprAST::getType() {
+	if (Order != "acquire" && Order != "release" && Order != "acq_rel" && Order != "seq_cst") {
+		Tag.Throw("Bad ordering '" + Order + "' for a fence (expected acquire, release, acq_rel or seq_cst).");
+	}
+	return VOIDTYPE;
+}
+
 TypeAST *IfThenElseAST::getType() {
 	TypeAST *condType = Cond->type(Ctx);
 	if (condType == 0) return 0;
@@ -413,6 +1108,72 @@ TypeAST *WhileAST::getType() {
 	return VOIDTYPE;
 }
 
+TypeAST *ForAST::getType() {
+	From = asIndex(From, Ctx);
+	To = asIndex(To, Ctx);
+	if (Step != 0) Step = asIndex(Step, Ctx);
+
+	// the loop variable lives in a scope of its own, like the variables of a block
+	Ctx = new Context(*Ctx);
+	Ctx->NamedValues.push_back(new map<string, Symbol*>());
+	Sym = new Symbol(INTTYPE, 0);
+	Ctx->NamedValues.back()->insert(pair<string, Symbol*>(Var, Sym));
+
+	TypeAST *contType = Inside->type(Ctx);
+	if (contType == 0) return 0;
+
+	return VOIDTYPE;
+}
+
+TypeAST *ForInAST::getType() {
+	TypeAST *t = Gen->type(Ctx);
+	while (t != 0 && t->canDeref()) {
+		Gen = new DerefExprAST(Gen->Tag, Gen);
+		t = Gen->type(Ctx);
+	}
+	if (t == 0) return 0;
+	GenTypeAST *gt = dynamic_cast<GenTypeAST*>(t);
+	if (gt == 0) Tag.Throw("'for' needs a range 'a..b' or a generator, not a " + t->typeDescStr() + ".");
+
+	Ctx = new Context(*Ctx);
+	Ctx->NamedValues.push_back(new map<string, Symbol*>());
+	Sym = new Symbol(gt->YieldType, 0);
+	Ctx->NamedValues.back()->insert(pair<string, Symbol*>(Var, Sym));
+
+	TypeAST *contType = Inside->type(Ctx);
+	if (contType == 0) return 0;
+
+	return VOIDTYPE;
+}
+
+TypeAST *ParallelForAST::getType() {
+	if (Grain != 0) Grain = asIndex(Grain, Ctx);
+
+	// reduction variables are local vars of a numeric type
+	for (unsigned i = 0; i < Reductions.size(); i++) {
+		string name = Reductions[i].second;
+		Symbol *s = 0;
+		for (int j = Ctx->NamedValues.size() - 1; j >= 1; j--) {
+			if (Ctx->NamedValues[j]->count(name) != 0) {
+				s = Ctx->NamedValues[j]->find(name)->second;
+				break;
+			}
+		}
+		VarDefAST *d = (s != 0 ? dynamic_cast<VarDefAST*>(s->Def) : 0);
+		if (d == 0 || !d->Var) Tag.Throw("Reduction on '" + name + "', which is not a local variable.");
+		TypeAST *t = dynamic_cast<RefTypeAST*>(s->SType)->VType;
+		if (dynamic_cast<IntTypeAST*>(t) == 0 && BaseTypeAST::isFloat(t) == 0) {
+			Tag.Throw("Reduction on '" + name + "', which is not a number.");
+		}
+		RedSyms.push_back(s);
+	}
+
+	Ctx = new Context(*Ctx);
+	Ctx->More = new MoreContext(*Ctx->More);
+	Ctx->More->Parallel = true;
+	return ForAST::getType();
+}
+
 TypeAST *BreakContAST::getType() {
 	// OOH THIS TIME WE HAVE NOTHING TO DO !! THAT'S GOOD !!
 	return VOIDTYPE;
@@ -424,6 +1185,10 @@ TypeAST *BlockAST::getType() {
 		Ctx->NamedValues.push_back(new map<string, Symbol*>());
 	}
 	for (unsigned i = 0; i < Instructions.size(); i++) {
+		VarDefAST *vd = dynamic_cast<VarDefAST*>(Instructions[i]);
+		if (vd != 0 && vd->Align != 0 && !vd->Var) {
+			vd->Tag.Throw("Only variables are in memory, 'let' in a function cannot be aligned.");
+		}
 		try {
 			Instructions[i]->typeCheck(Ctx);
 		} catch (PIFError *e) {
@@ -447,6 +1212,7 @@ TypeAST *BlockAST::getType() {
 }
 
 TypeAST *ReturnAST::getType() {
+	if (Ctx->More->Parallel) Tag.Throw("Cannot return from inside a parallel loop.");
 	TypeAST *retT = Ctx->More->FuncRetType;
 	if (Val != 0) {
 		TypeAST *exprT = Val->type(Ctx);
@@ -471,7 +1237,18 @@ TypeAST *ReturnAST::getType() {
 	Tag.Throw("Return statement does not return correct type value.");
 }
 
+TypeAST *YieldAST::getType() {
+	if (Ctx->More->YieldType == 0) Tag.Throw("'yield' can only be used in generators ('gen func').");
+	if (Ctx->More->Parallel) Tag.Throw("Cannot yield from inside a parallel loop.");
+	if (Val->type(Ctx) == 0) return 0;
+	Val = Val->asTypeOrError(Ctx->More->YieldType);
+	return VOIDTYPE;
+}
+
 TypeAST *ExternAST::getType() {
+	if (Ctx->More != 0 && Ctx->More->Pure) {
+		Tag.Throw("Purity error: const function cannot use extern symbol '" + Symbol + "', declare it as a const function.");
+	}
 	if (SType == 0) return VOIDTYPE;
 	return RefTypeAST::Get(SType);
 }
@@ -481,7 +1258,24 @@ TypeAST *FuncExprAST::getType() {
 		Ctx = new Context(*Ctx);
 		OwnContext = true;
 
-		Ctx->More = new MoreContext(FType->ReturnType);
+		// a function expression in a function is a lambda : it sees the variables
+		// of the scopes around it
+		MoreContext *around = Ctx->More;
+		if (around != 0) {
+			if (YieldType != 0) Tag.Throw("A lambda cannot be a generator.");
+			Lambda = true;
+			ScopeDepth = Ctx->NamedValues.size();
+			Outer = around->Lambda;
+			Pure = Pure || around->Pure;
+			FastMath = FastMath || around->FastMath;
+		}
+
+		// generators end with a plain 'return'
+		Ctx->More = new MoreContext(YieldType != 0 ? VOIDTYPE : FType->ReturnType);
+		Ctx->More->Pure = Pure;
+		Ctx->More->YieldType = YieldType;
+		Ctx->More->FastMath = (FastMath || Ctx->Pkg->FastMath);
+		Ctx->More->Lambda = (Lambda ? this : 0);
 		map<string, Symbol*> *m = new map<string, Symbol*>();
 		for (unsigned i = 0; i < FType->Args.size(); i++) {
 			m->insert(pair<string, Symbol*>(FType->Args[i]->Name, new Symbol(
@@ -495,6 +1289,23 @@ TypeAST *FuncExprAST::getType() {
 }
 
 
+// A variable of scope number 'scope' is used in the body : it is captured when
+// it belongs to an enclosing function (scope 0 is the package)
+void FuncExprAST::capture(Symbol *s, unsigned scope) {
+	if (scope == 0 || scope >= ScopeDepth) return;
+	if (find(Captures.begin(), Captures.end(), s) == Captures.end()) Captures.push_back(s);
+	if (Outer != 0) Outer->capture(s, scope);
+}
+
+// A 'gen func f : (args) -> T' really returns a 'gen T', the values of type T are
+// given by 'yield' (see Generator::buildGenerator)
+void FuncExprAST::makeGenerator() {
+	if (FType->ReturnType == VOIDTYPE) Tag.Throw("A generator must yield values of some type.");
+	YieldType = FType->ReturnType;
+	FType = FuncTypeAST::Get(FType->Args, GenTypeAST::Get(YieldType));
+}
+
+
 // ============= Type checking in definitions ==========
 
 void VarDefAST::typeCheck(Context *ctx) {
@@ -520,9 +1331,28 @@ void VarDefAST::typeCheck(Context *ctx) {
 	}
 }
 
+// Arguments and results of memo functions are cached as 64 bits words
+static bool memoWord(TypeAST *t) {
+	return dynamic_cast<IntTypeAST*>(t) != 0 || t == FLOATTYPE || t == F32TYPE || t == BOOLTYPE;
+}
+
 void FuncDefAST::typeCheck(Context *ctx) {
 	DBGC(cerr << "TC:\t"; Val->prettyprint(cerr); cerr << endl);
 
+	if (Memo) {
+		for (unsigned i = 0; i < Val->FType->Args.size(); i++) {
+			TypeAST *t = Val->FType->Args[i]->ArgType;
+			if (!memoWord(t)) {
+				Tag.Throw("Argument " + Val->FType->Args[i]->Name + " of memo function '" + Name + "' is a " +
+					t->typeDescStr() + " : only integers, floats and booleans can be cached.");
+			}
+		}
+		if (!memoWord(Val->FType->ReturnType)) {
+			Tag.Throw("Memo function '" + Name + "' returns a " + Val->FType->ReturnType->typeDescStr() +
+				" : only integers, floats and booleans can be cached.");
+		}
+	}
+	Val->Pure = Const;
 	if (Val->type(ctx) == 0) Tag.Throw("Type check error for '" + Name + "'.");
 }
 
@@ -558,3 +1388,28 @@ TypeAST *FuncDefAST::typeAtDef() {
 TypeAST *ExternFuncDefAST::typeAtDef() {
 	return RefTypeAST::Get(EType);
 }
+
+TypeAST *GenericFuncDefAST::typeAtDef() {
+	return RefTypeAST::Get(FType);
+}
+
+// The instance called by a call of the generic with these arguments
+ExprAST *GenericFuncDefAST::instanceCall(const vector<ExprAST*> &args, Context *ctx, const FTag &tag) {
+	if (args.size() != FType->Args.size()) {
+		tag.Throw("Wrong number of arguments for call to generic function '" + Name + "'.");
+	}
+	map<string, TypeAST*> bound;
+	for (unsigned i = 0; i < args.size(); i++) {
+		TypeAST *t = args[i]->type(ctx);
+		if (t == 0) return 0;
+		FType->Args[i]->ArgType->bindParams(t, bound);		// arguments that do not match are converted, or rejected, by the call
+	}
+	vector<TypeAST*> types;
+	for (unsigned i = 0; i < Params.size(); i++) {
+		if (bound.count(Params[i]) == 0) {
+			tag.Throw("Cannot infer type parameter '" + Params[i] + "' of '" + Name + "' from the arguments.");
+		}
+		types.push_back(bound[Params[i]]);
+	}
+	return Pkg->instantiate(this, types, tag);
+}